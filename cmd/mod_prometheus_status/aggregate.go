@@ -0,0 +1,154 @@
+package main
+
+/*
+#cgo CFLAGS: -I${SRCDIR}/../../src
+
+#include "mod_prometheus_status_shm.h"
+
+*/
+import "C"
+
+import (
+	"encoding/binary"
+	"errors"
+	"sync"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+var errAggregateFields = errors.New("aggregate record does not match the configured buckets")
+
+// aggregates is set when the apache children aggregate request metrics locally
+var aggregates *aggregateCollector
+
+// aggregateCollector exposes request metrics which are summed up by the apache children and sent as deltas
+type aggregateCollector struct {
+	lock        sync.Mutex
+	series      map[string]*mergedSeries
+	overflow    *mergedSeries       // label sets beyond the series limit
+	folded      map[string]struct{} // label sets already counted as folded into the overflow series
+	timeBuckets []float64
+	sizeBuckets []float64
+
+	requestsDesc *prometheus.Desc
+	timeDesc     *prometheus.Desc
+	sizeDesc     *prometheus.Desc
+}
+
+func newAggregateCollector(requestLabels []string, timeBuckets, sizeBuckets []float64) *aggregateCollector {
+	return &aggregateCollector{
+		series:      make(map[string]*mergedSeries),
+		folded:      make(map[string]struct{}),
+		timeBuckets: timeBuckets,
+		sizeBuckets: sizeBuckets,
+		requestsDesc: prometheus.NewDesc("apache_requests_total",
+			"is the total number of http requests", requestLabels, nil),
+		timeDesc: prometheus.NewDesc("apache_response_time_seconds",
+			"response time histogram", requestLabels, nil),
+		sizeDesc: prometheus.NewDesc("apache_response_size_bytes",
+			"response size histogram", requestLabels, nil),
+	}
+}
+
+// add sums up the deltas of an aggregate record
+func (c *aggregateCollector) add(rec *record) error {
+	numTime := len(c.timeBuckets) + 1
+	numSize := len(c.sizeBuckets) + 1
+	numValues := C.PROMETHEUS_STATUS_SHM_REC_BUCKETS + numTime + numSize
+	if rec.interned || len(rec.rawFields) < numValues*8 {
+		return errAggregateFields
+	}
+	field := func(n int) uint64 {
+		return binary.NativeEndian.Uint64(rec.rawFields[n*8:])
+	}
+
+	c.lock.Lock()
+	defer c.lock.Unlock()
+	series, ok := c.series[string(rec.labelKey)]
+	switch {
+	case ok:
+	case seriesLimit > 0 && len(c.series) >= seriesLimit:
+		if _, ok := c.folded[string(rec.labelKey)]; !ok {
+			if len(c.folded) >= max(seriesLimit, minFoldedSeries) {
+				clear(c.folded)
+			}
+			c.folded[string(rec.labelKey)] = struct{}{}
+			collectors["promSeriesDropped"].(prometheus.Counter).Inc()
+		}
+		if c.overflow == nil {
+			labels := make([]string, labelCount)
+			for i := range labels {
+				labels[i] = overflowLabel
+			}
+			c.overflow = newMergedSeries(labels, numTime, numSize)
+		}
+		series = c.overflow
+	default:
+		labels := make([]string, len(rec.labels))
+		for i, l := range rec.labels {
+			labels[i] = string(l)
+		}
+		series = newMergedSeries(normalizeLabels(labels), numTime, numSize)
+		c.series[string(rec.labelKey)] = series
+	}
+	series.lastUpdate = seriesClock.Load()
+	series.requests += field(C.PROMETHEUS_STATUS_SHM_REC_REQUESTS)
+	series.timeSum += field(C.PROMETHEUS_STATUS_SHM_REC_TIME_SUM)
+	series.sizeSum += field(C.PROMETHEUS_STATUS_SHM_REC_SIZE_SUM)
+	for i := range series.timeBuckets {
+		series.timeBuckets[i] += field(C.PROMETHEUS_STATUS_SHM_REC_BUCKETS + i)
+	}
+	for i := range series.sizeBuckets {
+		series.sizeBuckets[i] += field(C.PROMETHEUS_STATUS_SHM_REC_BUCKETS + numTime + i)
+	}
+
+	// the remaining fields are response time sketch bins
+	if quantiles != nil {
+		bins := make([]uint64, len(rec.rawFields)/8-numValues)
+		for i := range bins {
+			bins[i] = field(numValues + i)
+		}
+		quantiles.addBins(quantiles.sketch(series.labels), bins, float64(field(C.PROMETHEUS_STATUS_SHM_REC_TIME_SUM))/1e6)
+	}
+	return nil
+}
+
+// evict removes all series which have not been updated since cutoff, returns the number of evicted series
+func (c *aggregateCollector) evict(cutoff int64) int {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+	evicted := 0
+	for key, series := range c.series {
+		if series.lastUpdate < cutoff {
+			if quantiles != nil {
+				quantiles.remove(series.labels)
+			}
+			delete(c.series, key)
+			evicted++
+		}
+	}
+	// folded label sets may get their own series now
+	if evicted > 0 {
+		clear(c.folded)
+	}
+	return evicted
+}
+
+// Describe implements prometheus.Collector
+func (c *aggregateCollector) Describe(ch chan<- *prometheus.Desc) {
+	ch <- c.requestsDesc
+	ch <- c.timeDesc
+	ch <- c.sizeDesc
+}
+
+// Collect implements prometheus.Collector
+func (c *aggregateCollector) Collect(ch chan<- prometheus.Metric) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+	for _, s := range c.series {
+		s.collect(ch, c.requestsDesc, c.timeDesc, c.sizeDesc, c.timeBuckets, c.sizeBuckets)
+	}
+	if c.overflow != nil {
+		c.overflow.collect(ch, c.requestsDesc, c.timeDesc, c.sizeDesc, c.timeBuckets, c.sizeBuckets)
+	}
+}
@@ -0,0 +1,83 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"sort"
+	"strconv"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+const (
+	// InflightTopK sets how many of the oldest requests in flight are reported
+	InflightTopK = 20
+
+	// InflightContentType is the content type of the inflight report
+	InflightContentType = "text/plain; charset=utf-8"
+)
+
+// inflightBuckets are the age bounds of apache_inflight_requests, the response time buckets
+var inflightBuckets []float64
+
+// inflightRequest describes a single request in flight from the scoreboard
+type inflightRequest struct {
+	age     float64
+	pid     int
+	slot    int
+	thread  int
+	vhost   string
+	request string
+}
+
+// inflightBucket returns the index of the age bucket age falls into, ages above the last bound use len(inflightBuckets)
+func inflightBucket(age float64) int {
+	return sort.SearchFloat64s(inflightBuckets, age)
+}
+
+// setInflightRequests replaces the requests in flight by age with the counts per age bucket of a scoreboard pass.
+// Requests in flight come and go, so unlike a histogram the values are gauges which go down again.
+func setInflightRequests(counts []uint64, oldest float64) {
+	promInflightRequests := collectors["promInflightRequests"].(*prometheus.GaugeVec)
+	var total uint64
+	for i, bound := range inflightBuckets {
+		total += counts[i]
+		promInflightRequests.WithLabelValues(strconv.FormatFloat(bound, 'g', -1, 64)).Set(float64(total))
+	}
+	total += counts[len(inflightBuckets)]
+	promInflightRequests.WithLabelValues("+Inf").Set(float64(total))
+	collectors["promInflightOldest"].(prometheus.Gauge).Set(oldest)
+}
+
+// addOldest keeps the InflightTopK oldest requests sorted by age, the oldest first
+func addOldest(oldest []inflightRequest, req inflightRequest) []inflightRequest {
+	if len(oldest) == InflightTopK && oldest[len(oldest)-1].age >= req.age {
+		return oldest
+	}
+	i := sort.Search(len(oldest), func(i int) bool { return oldest[i].age < req.age })
+	if len(oldest) < InflightTopK {
+		oldest = append(oldest, inflightRequest{})
+	}
+	copy(oldest[i+1:], oldest[i:])
+	oldest[i] = req
+	return oldest
+}
+
+// inflightReport returns the oldest requests in flight as plain text, one request per line
+func inflightReport() []byte {
+	var buf bytes.Buffer
+	buf.WriteString("# age_seconds pid slot thread vhost request\n")
+	if scoreboard == nil {
+		return buf.Bytes()
+	}
+	var s scoreboardSample
+	scoreboard.sample(&s)
+	for _, req := range s.oldest {
+		vhost := req.vhost
+		if vhost == "" {
+			vhost = "-"
+		}
+		fmt.Fprintf(&buf, "%.3f %d %d %d %s %s\n", req.age, req.pid, req.slot, req.thread, vhost, req.request)
+	}
+	return buf.Bytes()
+}
@@ -0,0 +1,58 @@
+package main
+
+import (
+	"net/http"
+	"net/http/httptest"
+	"strings"
+	"testing"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestAddOldest(t *testing.T) {
+	t.Parallel()
+	var oldest []inflightRequest
+	for i := range 3 * InflightTopK {
+		// ages 0, 7, 14, ... modulo 50 in shuffled order
+		oldest = addOldest(oldest, inflightRequest{age: float64(i * 7 % 50), slot: i})
+	}
+	require.Len(t, oldest, InflightTopK)
+	assert.InDelta(t, 49, oldest[0].age, 0)
+	for i := 1; i < len(oldest); i++ {
+		assert.GreaterOrEqual(t, oldest[i-1].age, oldest[i].age)
+	}
+	// younger requests than the youngest kept one do not change the list
+	youngest := oldest[len(oldest)-1]
+	oldest = addOldest(oldest, inflightRequest{age: 0.5})
+	assert.Equal(t, youngest, oldest[len(oldest)-1])
+}
+
+func TestInflightRequests(t *testing.T) {
+	initTestMetrics(t)
+	counts := make([]uint64, len(inflightBuckets)+1)
+	for _, age := range []float64{0.005, 0.5, 2, 1000} {
+		counts[inflightBucket(age)]++
+	}
+	setInflightRequests(counts, 1000)
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_inflight_requests{le="0.01"} 1`)
+	assert.Contains(t, metrics, `apache_inflight_requests{le="1"} 2`)
+	assert.Contains(t, metrics, `apache_inflight_requests{le="+Inf"} 4`)
+	assert.Contains(t, metrics, `apache_inflight_requests_oldest_seconds 1000`)
+
+	// finished requests are not counted anymore
+	setInflightRequests(make([]uint64, len(inflightBuckets)+1), 0)
+	metrics = string(metricsGet())
+	assert.Contains(t, metrics, `apache_inflight_requests{le="+Inf"} 0`)
+	assert.Contains(t, metrics, `apache_inflight_requests_oldest_seconds 0`)
+}
+
+func TestInflightHandler(t *testing.T) {
+	initTestMetrics(t)
+	rec := httptest.NewRecorder()
+	newScrapeMux().ServeHTTP(rec, httptest.NewRequest(http.MethodGet, "/inflight", nil))
+	assert.Equal(t, http.StatusOK, rec.Code)
+	assert.Equal(t, InflightContentType, rec.Header().Get("Content-Type"))
+	assert.True(t, strings.HasPrefix(rec.Body.String(), "# age_seconds pid slot thread vhost request\n"))
+}
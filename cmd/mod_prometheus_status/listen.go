@@ -0,0 +1,152 @@
+package main
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"net"
+	"net/http"
+	"os"
+	"strconv"
+	"strings"
+	"syscall"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// ListenReadTimeout limits reading the request headers on the scrape listener
+	ListenReadTimeout = 10 * time.Second
+
+	// ListenIdleTimeout sets how long idle keep-alive connections of the scrape listener are kept open
+	ListenIdleTimeout = 120 * time.Second
+)
+
+// startScrapeListener serves the metrics on address, either host:port or unix:/path, without using apache workers
+func startScrapeListener(address string, userID, groupID int) error {
+	network := "tcp"
+	path, isUnix := strings.CutPrefix(address, "unix:")
+	if isUnix {
+		network = "unix"
+		address = path
+		// the collector of the previous generation keeps serving its open connections
+		os.Remove(path)
+	}
+
+	// the previous collector still listens on the same port during reloads
+	config := net.ListenConfig{Control: func(_, _ string, c syscall.RawConn) error {
+		var sockErr error
+		err := c.Control(func(fd uintptr) {
+			if !isUnix {
+				sockErr = unix.SetsockoptInt(int(fd), unix.SOL_SOCKET, unix.SO_REUSEPORT, 1)
+			}
+		})
+		if err != nil {
+			return err
+		}
+		return sockErr
+	}}
+	l, err := config.Listen(context.Background(), network, address)
+	if err != nil {
+		return fmt.Errorf("cannot listen on %s: %s", address, err.Error())
+	}
+	if isUnix {
+		// the socket file belongs to the next generation once this collector exits
+		l.(*net.UnixListener).SetUnlinkOnClose(false)
+		if os.Geteuid() == 0 {
+			err = os.Chown(path, userID, groupID)
+			if err != nil {
+				l.Close()
+				return fmt.Errorf("cannot chown scrape socket: %s", err.Error())
+			}
+		}
+	}
+
+	server := &http.Server{
+		Handler:           newScrapeMux(),
+		ReadHeaderTimeout: ListenReadTimeout,
+		IdleTimeout:       ListenIdleTimeout,
+	}
+	go func() {
+		err := server.Serve(l)
+		if err != nil && !errors.Is(err, http.ErrServerClosed) {
+			logErrorf("scrape listener error: %s", err.Error())
+		}
+	}()
+	logDebugf("listening for scrapes on %s:%s", network, address)
+	return nil
+}
+
+// newScrapeMux returns the handlers of the scrape listener
+func newScrapeMux() *http.ServeMux {
+	mux := http.NewServeMux()
+	mux.HandleFunc("/metrics", scrapeHandler)
+	mux.HandleFunc("/inflight", inflightHandler)
+	return mux
+}
+
+// scrapeHandler answers scrapes with the same rendered and cached metrics the apache handler returns
+func scrapeHandler(w http.ResponseWriter, r *http.Request) {
+	if r.Method != http.MethodGet && r.Method != http.MethodHead {
+		w.Header().Set("Allow", "GET, HEAD")
+		http.Error(w, "method not allowed", http.StatusMethodNotAllowed)
+		return
+	}
+	encoding := EncodingIdentity
+	if acceptsGzip(r.Header.Get("Accept-Encoding")) {
+		encoding = EncodingGzip
+	}
+	format, body := metricsGetEncoded(r.Header.Get("Accept"), encoding)
+
+	header := w.Header()
+	header.Set("Content-Type", string(format))
+	header.Set("Content-Length", strconv.Itoa(len(body)))
+	header.Set("Vary", "Accept, Accept-Encoding")
+	if encoding == EncodingGzip {
+		header.Set("Content-Encoding", EncodingGzip)
+	}
+	if r.Method == http.MethodHead {
+		return
+	}
+	_, err := w.Write(body)
+	if err != nil {
+		logDebugf("writing scrape response failed: %s", err.Error())
+	}
+}
+
+// inflightHandler lists the oldest requests in flight
+func inflightHandler(w http.ResponseWriter, r *http.Request) {
+	if r.Method != http.MethodGet && r.Method != http.MethodHead {
+		w.Header().Set("Allow", "GET, HEAD")
+		http.Error(w, "method not allowed", http.StatusMethodNotAllowed)
+		return
+	}
+	body := inflightReport()
+	w.Header().Set("Content-Type", InflightContentType)
+	w.Header().Set("Content-Length", strconv.Itoa(len(body)))
+	if r.Method == http.MethodHead {
+		return
+	}
+	_, err := w.Write(body)
+	if err != nil {
+		logDebugf("writing inflight response failed: %s", err.Error())
+	}
+}
+
+// acceptsGzip returns true if the Accept-Encoding header contains gzip without a zero quality
+func acceptsGzip(acceptEncoding string) bool {
+	for _, token := range strings.Split(acceptEncoding, ",") {
+		name, params, _ := strings.Cut(token, ";")
+		if !strings.EqualFold(strings.TrimSpace(name), EncodingGzip) {
+			continue
+		}
+		q, found := strings.CutPrefix(strings.TrimSpace(params), "q=")
+		if !found {
+			return true
+		}
+		quality, err := strconv.ParseFloat(q, 64)
+		return err == nil && quality > 0
+	}
+	return false
+}
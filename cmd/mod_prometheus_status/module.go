@@ -15,14 +15,23 @@ import "C"
 
 import (
 	"bufio"
+	"bytes"
 	"errors"
+	"fmt"
 	"io"
 	"net"
 	"os"
 	"os/signal"
+	"path/filepath"
+	"runtime"
 	"strings"
+	"sync/atomic"
 	"syscall"
 	"time"
+	"unsafe"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"golang.org/x/sys/unix"
 )
 
 const (
@@ -39,46 +48,149 @@ var Build string
 
 var defaultSocketTimeout = 1
 
+// datagramsProcessed counts all datagrams read from the datagram socket
+var datagramsProcessed atomic.Uint64
+
+// updatesReceived counts all text and binary updates read from any socket
+var updatesReceived atomic.Uint64
+
 const (
-	// SigHupDelayExitSeconds sets the amount of extra seconds till exiting after receiving a SIGHUP
+	// SigHupDelayExitSeconds sets the maximum amount of extra seconds till exiting after receiving a SIGHUP,
+	// a following SIGTERM ends the delay
 	SigHupDelayExitSeconds = 5
+
+	// ReadBufferSize sets the read buffer size for metric connections, must be larger than a single update
+	ReadBufferSize = 65536
+
+	// DatagramReaders sets the maximum number of goroutines reading from the datagram socket
+	DatagramReaders = 4
+
+	// DatagramSocketBuffer sets the kernel receive buffer size of the datagram socket
+	DatagramSocketBuffer = 4 * 1024 * 1024
 )
 
 //export prometheusStatusInit
-func prometheusStatusInit(metricsSocket, serverDesc *C.char, serverHostName, version *C.char, debug, userID, groupID C.int, labelNames *C.char, mpmName *C.char, socketTimeout C.int, timeBuckets, sizeBuckets *C.char) C.int {
+func prometheusStatusInit(metricsSocket, serverDesc *C.char, serverHostName, version *C.char, debug, userID, groupID C.int, labelNames *C.char, mpmName *C.char, socketTimeout C.int, timeBuckets, sizeBuckets *C.char, shm unsafe.Pointer, socketType, scrapeCacheTTL, backend, maxSeries, seriesTTLSeconds C.int, nativeFactor C.double, nativeMaxBuckets, nativeResetSeconds C.int, quantileValues *C.char, quantileWindowSeconds C.int, stats unsafe.Pointer, processDetails C.int, loadStart C.longlong, readyFD C.int, previousSocket, listen *C.char, scoreboardImage unsafe.Pointer, configGen, sampleRate C.int) C.int {
+	initStart := time.Now()
 	defaultSocketTimeout = int(socketTimeout)
+	scrapeCache.ttl = time.Duration(scrapeCacheTTL) * time.Millisecond
+	seriesLimit = int(maxSeries)
+	seriesTTL = time.Duration(seriesTTLSeconds) * time.Second
+	seriesClock.Store(time.Now().Unix())
+	nativeHistogram.factor = float64(nativeFactor)
+	nativeHistogram.maxBuckets = uint32(nativeMaxBuckets)
+	nativeHistogram.minReset = time.Duration(nativeResetSeconds) * time.Second
+	quantileWindow = time.Duration(quantileWindowSeconds) * time.Second
+	workerStats = stats
+	procDetails = processDetails != 0
+	scoreboard = newScoreboardReader(scoreboardImage)
+	configGeneration = int(configGen)
+	scoreboardSampleRate = int(sampleRate)
 
 	initLogging(int(debug))
 
-	err := registerMetrics(C.GoString(serverDesc), C.GoString(serverHostName), C.GoString(labelNames), C.GoString(mpmName), C.GoString(timeBuckets), C.GoString(sizeBuckets))
+	var err error
+	quantileList, err = expandQuantiles(C.GoString(quantileValues))
+	if err != nil {
+		logErrorf("invalid response time quantiles: %s", err.Error())
+		return C.int(1)
+	}
+
+	err = registerMetrics(C.GoString(serverDesc), C.GoString(serverHostName), C.GoString(labelNames), C.GoString(mpmName), C.GoString(timeBuckets), C.GoString(sizeBuckets), shm, backend == backendAggregate)
 	if err != nil {
 		logErrorf("failed to initialize metrics: %s", err.Error())
 		return C.int(1)
 	}
 
-	sigs := make(chan os.Signal, 1)
+	if seriesTTL > 0 {
+		go seriesEvictor(seriesTTL)
+	}
+
+	if scoreboard != nil && scoreboardSampleRate > 0 {
+		sampler = newScoreboardSampler(time.Now())
+		go sampler.run(scoreboard, scoreboardSampleRate)
+	}
+
+	// room for the sighup and sigterm of a reload, signals are dropped if the channel is full
+	sigs := make(chan os.Signal, 2)
 	signal.Notify(sigs, syscall.SIGINT, syscall.SIGTERM, syscall.SIGHUP)
 	go func() {
 		sig := <-sigs
 		logDebugf("got signal: %d(%s)", sig, sig.String())
-		// wait a few extra seconds on sighups to answer metrics requests during reloads
+		// on reloads apache sends a sighup first and a sigterm once it waits for this collector to exit.
+		// Metrics requests are answered till then, but apache must not be held up by the whole delay.
 		if sig == syscall.SIGHUP {
-			time.Sleep(time.Duration(SigHupDelayExitSeconds) * time.Second)
+			select {
+			case sig = <-sigs:
+				logDebugf("got signal: %d(%s)", sig, sig.String())
+			case <-time.After(time.Duration(SigHupDelayExitSeconds) * time.Second):
+			}
+			// apache only sends the sighup on reloads and starts the next collector once this one exited,
+			// it continues with the request metrics from the snapshot file
+			saveSnapshot(C.GoString(metricsSocket) + snapshotSuffix)
 		}
 		os.Remove(C.GoString(metricsSocket))
+		os.Remove(C.GoString(metricsSocket) + datagramSuffix)
 		os.Exit(0)
 	}()
 
+	// take over the request metrics of the previous generation before any updates arrive
+	restoreStart := time.Now()
+	if previous := C.GoString(previousSocket); previous != "" {
+		loadSnapshot(previous + snapshotSuffix)
+	}
+	removeStaleSnapshots(filepath.Dir(C.GoString(metricsSocket)))
+	restoreDuration := time.Since(restoreStart)
+
 	startChannel := make(chan bool)
-	go startMetricServer(startChannel, C.GoString(metricsSocket), int(userID), int(groupID))
-	<-startChannel
+	go startMetricServer(startChannel, C.GoString(metricsSocket), int(userID), int(groupID), socketType == socketTypeDatagram)
+	if !<-startChannel {
+		return C.int(1)
+	}
+
+	if address := C.GoString(listen); address != "" {
+		err = startScrapeListener(address, int(userID), int(groupID))
+		if err != nil {
+			logErrorf("scrape listener error: %s", err.Error())
+			return C.int(1)
+		}
+	}
+
+	// loading the module includes starting the go runtime
+	runtimeDuration := initStart.Sub(time.UnixMicro(int64(loadStart)))
+	initDuration := time.Since(initStart)
+	promStartupDuration := collectors["promStartupDuration"].(*prometheus.GaugeVec)
+	promStartupDuration.WithLabelValues("runtime").Set(runtimeDuration.Seconds())
+	promStartupDuration.WithLabelValues("init").Set(initDuration.Seconds())
+	promStartupDuration.WithLabelValues("restore").Set(restoreDuration.Seconds())
 
-	logInfof("mod_prometheus_status v%s initialized - socket:%s - uid:%d - gid:%d - build:%s", C.GoString(version), C.GoString(metricsSocket), userID, groupID, Build)
+	// the apache parent waits for this before it starts its children
+	if readyFD >= 0 {
+		_, err = unix.Write(int(readyFD), []byte{1})
+		if err != nil {
+			logErrorf("failed to signal readiness: %s", err.Error())
+		}
+		unix.Close(int(readyFD))
+	}
+
+	logInfof("mod_prometheus_status v%s initialized in %s (go runtime: %s) - socket:%s - uid:%d - gid:%d - build:%s", C.GoString(version), initDuration, runtimeDuration, C.GoString(metricsSocket), userID, groupID, Build)
 	return C.int(0)
 }
 
-func startMetricServer(startChannel chan bool, socketPath string, userID, groupID int) {
+func startMetricServer(startChannel chan bool, socketPath string, userID, groupID int, datagram bool) {
 	logDebugf("InitMetricsCollector: %s (uid: %d, gid: %d)", socketPath, userID, groupID)
+	// request metrics are sent to the datagram socket, the stream socket is
+	// still required for metrics requests and interning label sets
+	if datagram {
+		conn, err := startDatagramServer(socketPath+datagramSuffix, userID, groupID)
+		if err != nil {
+			logErrorf("datagram listen error: %s", err.Error())
+			startChannel <- false
+			return
+		}
+		defer conn.Close()
+	}
+
 	l, err := net.Listen("unix", socketPath)
 	if err != nil {
 		logErrorf("listen error: %s", err.Error())
@@ -103,45 +215,177 @@ func startMetricServer(startChannel chan bool, socketPath string, userID, groupI
 			// listener closed
 			return
 		}
-		conn.SetDeadline(time.Now().Add(time.Duration(defaultSocketTimeout) * time.Second))
+		// workers keep their connection open to send request metrics, so there is no
+		// fixed deadline here. Only answering metrics requests is limited by a timeout.
 		go metricServer(conn)
 	}
 }
 
-func metricServer(c net.Conn) {
-	defer c.Close()
+// startDatagramServer listens on a datagram socket and reads it with a fixed pool of goroutines
+func startDatagramServer(socketPath string, userID, groupID int) (*net.UnixConn, error) {
+	conn, err := net.ListenUnixgram("unixgram", &net.UnixAddr{Name: socketPath, Net: "unixgram"})
+	if err != nil {
+		return nil, err
+	}
+	// a large receive buffer absorbs bursts instead of blocking the workers
+	err = conn.SetReadBuffer(DatagramSocketBuffer)
+	if err != nil {
+		logDebugf("cannot set datagram socket buffer: %s", err.Error())
+	}
+	if os.Geteuid() == 0 {
+		err = os.Chown(socketPath, userID, groupID)
+		if err != nil {
+			conn.Close()
+			return nil, fmt.Errorf("cannot chown datagram socket: %s", err.Error())
+		}
+	}
 
-	buf := bufio.NewReader(c)
+	logDebugf("listening on datagram socket: %s", socketPath)
+	for range min(runtime.NumCPU(), DatagramReaders) {
+		go datagramServer(conn)
+	}
+	return conn, nil
+}
 
+// datagramServer processes datagrams until the socket gets closed, each datagram contains complete updates only
+func datagramServer(conn *net.UnixConn) {
+	data := make([]byte, maxDatagramSize)
+	reader := bytes.NewReader(nil)
+	buf := bufio.NewReaderSize(reader, maxDatagramSize)
 	for {
-		line, err := buf.ReadString('\n')
+		size, err := conn.Read(data)
 		if err != nil {
-			if errors.Is(err, io.EOF) {
+			if errors.Is(err, net.ErrClosed) {
 				return
 			}
-			logErrorf("Reading client error: %s", err.Error())
+			logErrorf("Reading datagram error: %s", err.Error())
+			continue
+		}
+		reader.Reset(data[:size])
+		buf.Reset(reader)
+		// intern requests cannot be answered here, workers send them over the stream socket
+		cmd, err := processUpdates(buf, io.Discard)
+		if err != nil && !errors.Is(err, io.EOF) {
+			logErrorf("Reading datagram error: %s", err.Error())
+		}
+		if cmd != "" {
+			logErrorf("unsupported request in datagram: %s", cmd)
+			countParseError()
+		}
+		datagramsProcessed.Add(1)
+	}
+}
+
+func metricServer(c net.Conn) {
+	defer c.Close()
+	collectors["promConnections"].(prometheus.Counter).Inc()
+	active := collectors["promConnectionsActive"].(prometheus.Gauge)
+	active.Inc()
+	defer active.Dec()
+
+	buf := bufio.NewReaderSize(c, ReadBufferSize)
+
+	cmd, err := processUpdates(buf, c)
+	if err != nil {
+		if errors.Is(err, io.EOF) {
 			return
 		}
-		line = strings.TrimSpace(line)
-		if line == "" {
+		logErrorf("Reading client error: %s", err.Error())
+		return
+	}
+	// commands may have arguments separated by colons, ex.: metrics:<content encoding>:<accept header>
+	cmd, arg, _ := strings.Cut(cmd, ":")
+	switch cmd {
+	case "":
+		return
+	case "metrics":
+		encoding, accept, _ := strings.Cut(arg, ":")
+		c.SetWriteDeadline(time.Now().Add(time.Duration(defaultSocketTimeout) * time.Second))
+		err = writeMetricsReply(c, accept, encoding)
+		if err != nil {
+			logErrorf("Writing client error: %s", err.Error())
 			return
 		}
-		args := strings.SplitN(line, ":", 2)
-		switch args[0] {
-		case "metrics":
-			_, err = c.Write(metricsGet())
+	case "inflight":
+		c.SetWriteDeadline(time.Now().Add(time.Duration(defaultSocketTimeout) * time.Second))
+		body := inflightReport()
+		_, err = fmt.Fprintf(c, "%s\n%d\n%s", InflightContentType, len(body), body)
+		if err != nil {
+			logErrorf("Writing client error: %s", err.Error())
+			return
+		}
+	default:
+		logErrorf("unknown metrics update request: %s", cmd)
+		countParseError()
+	}
+}
+
+// writeMetricsReply sends the content type and the body length, each on a separate line. On unix
+// sockets the body is passed as sealed memfd along with the header, otherwise the body follows the header.
+func writeMetricsReply(c net.Conn, accept, encoding string) error {
+	unixConn, isUnix := c.(*net.UnixConn)
+	format, body, fd := metricsGetShared(accept, encoding, isUnix)
+	header := []byte(fmt.Sprintf("%s\n%d\n", format, len(body)))
+	if fd >= 0 {
+		defer unix.Close(fd)
+		_, _, err := unixConn.WriteMsgUnix(header, unix.UnixRights(fd), nil)
+		return err
+	}
+	_, err := c.Write(header)
+	if err != nil {
+		return err
+	}
+	_, err = c.Write(body)
+	return err
+}
+
+// processUpdates reads text and binary metrics updates until it reads an empty line or any other command.
+// The command line is returned including its arguments. Replies to intern requests are written to w.
+func processUpdates(buf *bufio.Reader, w io.Writer) (string, error) {
+	rec := &record{}
+	updates := uint64(0)
+	defer func() { updatesReceived.Add(updates) }()
+	for {
+		// updates are counted whenever the buffer runs empty, so long lived connections are counted as well
+		if updates > 0 && buf.Buffered() == 0 {
+			updatesReceived.Add(updates)
+			updates = 0
+		}
+		first, err := buf.Peek(1)
+		if err != nil {
+			return "", err
+		}
+		if first[0] == protoMagic {
+			err = readRecord(buf, rec)
 			if err != nil {
-				logErrorf("Writing client error: %s", err.Error())
-				return
+				return "", err
 			}
-			return
-		case "server":
+			err = applyRecord(rec, w)
+			if err != nil {
+				return "", err
+			}
+			updates++
+			continue
+		}
+
+		line, err := buf.ReadString('\n')
+		if err != nil {
+			return "", err
+		}
+		line = strings.TrimSpace(line)
+		if line == "" {
+			return "", nil
+		}
+		args := strings.SplitN(line, ":", 2)
+		switch {
+		case args[0] == "server" && len(args) == 2:
 			metricsUpdate(ServerMetrics, args[1])
-		case "request":
+			updates++
+		case args[0] == "request" && len(args) == 2:
 			metricsUpdate(RequestMetrics, args[1])
+			updates++
 		default:
-			logErrorf("unknown metrics update request: %s", args[0])
-			return
+			return line, nil
 		}
 	}
 }
@@ -0,0 +1,163 @@
+package main
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"io"
+	"math"
+	"net"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+func TestDatagramServer(t *testing.T) {
+	initTestMetrics(t)
+	socketPath := filepath.Join(t.TempDir(), "mtr"+datagramSuffix)
+	conn, err := startDatagramServer(socketPath, os.Getuid(), os.Getgid())
+	require.NoError(t, err)
+	defer conn.Close()
+
+	var payload bytes.Buffer
+	payload.Write(encodeTestRecord(metricRequest, math.Float64bits(0.5), []uint64{100}, "datagram", "GET", "200"))
+	payload.Write(encodeTestRecord(metricRequest, math.Float64bits(0.5), []uint64{100}, "datagram", "GET", "200"))
+	start := datagramsProcessed.Load()
+	sendTestDatagram(t, socketPath, payload.Bytes())
+	require.Eventually(t, func() bool { return datagramsProcessed.Load() > start }, 5*time.Second, time.Millisecond)
+	require.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="200",vhost="datagram"} 2`)
+}
+
+func TestMetricsReplyMemfd(t *testing.T) {
+	initTestMetrics(t)
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_STREAM, 0)
+	require.NoError(t, err)
+	server, err := net.FileConn(os.NewFile(uintptr(fds[0]), "server"))
+	require.NoError(t, err)
+	defer server.Close()
+	client, err := net.FileConn(os.NewFile(uintptr(fds[1]), "client"))
+	require.NoError(t, err)
+	defer client.Close()
+
+	require.NoError(t, writeMetricsReply(server, "", EncodingIdentity))
+
+	header := make([]byte, 4096)
+	oob := make([]byte, unix.CmsgSpace(4))
+	n, oobn, _, _, err := client.(*net.UnixConn).ReadMsgUnix(header, oob)
+	require.NoError(t, err)
+	lines := strings.Split(string(header[:n]), "\n")
+	require.Len(t, lines, 3)
+	assert.Contains(t, lines[0], "text/plain")
+	size, err := strconv.Atoi(lines[1])
+	require.NoError(t, err)
+
+	msgs, err := unix.ParseSocketControlMessage(oob[:oobn])
+	require.NoError(t, err)
+	require.Len(t, msgs, 1)
+	rights, err := unix.ParseUnixRights(&msgs[0])
+	require.NoError(t, err)
+	require.Len(t, rights, 1)
+	file := os.NewFile(uintptr(rights[0]), "memfd")
+	defer file.Close()
+	// the descriptor shares its offset with the collector, so read at explicit offsets like the module does
+	body, err := io.ReadAll(io.NewSectionReader(file, 0, int64(size)))
+	require.NoError(t, err)
+	assert.Contains(t, string(body), "apache_server_uptime_seconds")
+
+	// sealed memfds cannot be modified by the receiver
+	_, err = file.WriteAt([]byte("x"), 0)
+	require.Error(t, err)
+}
+
+// sendTestDatagram sends data without connecting the socket, just like the apache module does
+func sendTestDatagram(tb testing.TB, socketPath string, data ...[]byte) {
+	tb.Helper()
+	fd, err := syscall.Socket(syscall.AF_UNIX, syscall.SOCK_DGRAM, 0)
+	require.NoError(tb, err)
+	defer syscall.Close(fd)
+	addr := &syscall.SockaddrUnix{Name: socketPath}
+	for _, d := range data {
+		for {
+			err = syscall.Sendto(fd, d, 0, addr)
+			if !errors.Is(err, syscall.EINTR) {
+				break
+			}
+		}
+		require.NoError(tb, err)
+	}
+}
+
+// benchmarkSocketIngest sends batches of combined request records through a real socket and reports
+// the sustained update rate and the cpu time of the whole process per update
+func benchmarkSocketIngest(b *testing.B, datagram bool) {
+	b.Helper()
+	initTestMetrics(b)
+	var payload bytes.Buffer
+	updates := 0
+	for i := 0; payload.Len() < 16384; i++ {
+		payload.Write(encodeTestRecord(metricRequest, math.Float64bits(0.0123), []uint64{4711}, fmt.Sprintf("vhost%d", i%10), "GET", "200"))
+		updates++
+	}
+	batches := make([][]byte, b.N)
+	for i := range batches {
+		batches[i] = payload.Bytes()
+	}
+	socketPath := filepath.Join(b.TempDir(), "mtr")
+
+	var usageStart, usageEnd syscall.Rusage
+	b.SetBytes(int64(payload.Len()))
+	b.ResetTimer()
+	require.NoError(b, syscall.Getrusage(syscall.RUSAGE_SELF, &usageStart))
+	if datagram {
+		conn, err := startDatagramServer(socketPath+datagramSuffix, os.Getuid(), os.Getgid())
+		require.NoError(b, err)
+		defer conn.Close()
+		start := datagramsProcessed.Load()
+		sendTestDatagram(b, socketPath+datagramSuffix, batches...)
+		for datagramsProcessed.Load()-start < uint64(b.N) {
+			time.Sleep(time.Millisecond)
+		}
+	} else {
+		listener, err := net.Listen("unix", socketPath)
+		require.NoError(b, err)
+		defer listener.Close()
+		done := make(chan bool)
+		go func() {
+			conn, err := listener.Accept()
+			if err == nil {
+				metricServer(conn)
+			}
+			close(done)
+		}()
+		conn, err := net.Dial("unix", socketPath)
+		require.NoError(b, err)
+		for _, batch := range batches {
+			_, err = conn.Write(batch)
+			require.NoError(b, err)
+		}
+		conn.Close()
+		<-done
+	}
+	require.NoError(b, syscall.Getrusage(syscall.RUSAGE_SELF, &usageEnd))
+	b.StopTimer()
+
+	cpu := time.Duration(usageEnd.Utime.Nano()-usageStart.Utime.Nano()) + time.Duration(usageEnd.Stime.Nano()-usageStart.Stime.Nano())
+	b.ReportMetric(float64(b.N*updates)/b.Elapsed().Seconds(), "updates/s")
+	b.ReportMetric(float64(cpu.Nanoseconds())/float64(b.N*updates), "cpu-ns/update")
+}
+
+func BenchmarkSocketIngestStream(b *testing.B) {
+	benchmarkSocketIngest(b, false)
+}
+
+func BenchmarkSocketIngestDatagram(b *testing.B) {
+	benchmarkSocketIngest(b, true)
+}
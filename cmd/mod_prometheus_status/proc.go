@@ -0,0 +1,334 @@
+package main
+
+/*
+#include <unistd.h>
+*/
+import "C"
+
+import (
+	"bytes"
+	"math"
+	"os"
+	"runtime"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/shirou/gopsutil/process"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// ProcReaders sets the maximum number of goroutines reading process statistics in parallel
+	ProcReaders = 8
+
+	// procBufferSize must be large enough for /proc/<pid>/stat, statm and io
+	procBufferSize = 4096
+)
+
+var (
+	// procDetails enables the per generation process metrics
+	procDetails bool
+
+	// procClockTicks is the unit of the cpu times in /proc/<pid>/stat
+	procClockTicks = float64(C.sysconf(C._SC_CLK_TCK))
+
+	// procBuffers are reused between scrapes
+	procBuffers = sync.Pool{New: func() any {
+		buf := make([]byte, procBufferSize)
+		return &buf
+	}}
+
+	// scoreboardProcesses is updated from the scoreboard before each scrape
+	scoreboardProcesses = &processList{}
+)
+
+type procUpdate struct {
+	Total      int
+	Threads    int
+	OpenFD     int
+	RSS        uint64
+	VMS        uint64
+	ReadBytes  uint64
+	WriteBytes uint64
+	CPU        float64
+}
+
+func (p *procUpdate) add(other *procUpdate) {
+	p.Total += other.Total
+	p.Threads += other.Threads
+	p.OpenFD += other.OpenFD
+	p.RSS += other.RSS
+	p.VMS += other.VMS
+	p.ReadBytes += other.ReadBytes
+	p.WriteBytes += other.WriteBytes
+	p.CPU += other.CPU
+}
+
+// scoreboardProcess is an apache child from the scoreboard
+type scoreboardProcess struct {
+	pid        int
+	generation int // -1 for processes not in the scoreboard
+}
+
+// processList contains the apache children of the last scoreboard pass
+type processList struct {
+	lock      sync.Mutex
+	processes []scoreboardProcess
+	received  bool
+}
+
+// set replaces the list
+func (l *processList) set(processes []scoreboardProcess) {
+	l.lock.Lock()
+	defer l.lock.Unlock()
+	l.processes = append(l.processes[:0], processes...)
+	l.received = true
+}
+
+// get returns a copy of the current list, ok is false if no list has been received yet
+func (l *processList) get() (processes []scoreboardProcess, ok bool) {
+	l.lock.Lock()
+	defer l.lock.Unlock()
+	return append([]scoreboardProcess(nil), l.processes...), l.received
+}
+
+// updateProcMetrics updates the process statistics of the apache main process, its scoreboard children and the
+// metrics collector. It falls back to walking the process tree until the first scoreboard process list arrives.
+func updateProcMetrics() {
+	processes, ok := scoreboardProcesses.get()
+	if !ok {
+		updateProcMetricsWalk()
+		return
+	}
+	processes = appendOwnProcesses(processes, os.Getppid(), os.Getpid())
+	stats, generations := collectProcStats(processes)
+	setProcMetrics(&stats)
+
+	if !procDetails {
+		return
+	}
+	rss := collectors["promProcGenerationRSS"].(*prometheus.GaugeVec)
+	cpu := collectors["promProcGenerationCPU"].(*prometheus.GaugeVec)
+	// generations without processes disappear
+	rss.Reset()
+	cpu.Reset()
+	for generation, gen := range generations {
+		rss.WithLabelValues(strconv.Itoa(generation)).Set(float64(gen.RSS))
+		cpu.WithLabelValues(strconv.Itoa(generation)).Set(gen.CPU)
+	}
+}
+
+// appendOwnProcesses adds the apache main process and the metrics collector, which are not in the scoreboard.
+// An orphaned collector has lost the main process, the children of the scoreboard are still counted then.
+func appendOwnProcesses(processes []scoreboardProcess, ppid, pid int) []scoreboardProcess {
+	if ppid != 1 {
+		processes = append(processes, scoreboardProcess{pid: ppid, generation: -1})
+	}
+	return append(processes, scoreboardProcess{pid: pid, generation: -1})
+}
+
+func setProcMetrics(stats *procUpdate) {
+	collectors["promProcCounter"].(prometheus.Gauge).Set(float64(stats.Total))
+	collectors["promThreads"].(prometheus.Gauge).Set(float64(stats.Threads))
+	collectors["promOpenFD"].(prometheus.Gauge).Set(float64(stats.OpenFD))
+	collectors["promMemoryReal"].(prometheus.Gauge).Set(float64(stats.RSS))
+	collectors["promMemoryVirt"].(prometheus.Gauge).Set(float64(stats.VMS))
+	collectors["promReadBytes"].(prometheus.Gauge).Set(float64(stats.ReadBytes))
+	collectors["promWriteBytes"].(prometheus.Gauge).Set(float64(stats.WriteBytes))
+}
+
+// collectProcStats reads the statistics of all processes in parallel and returns the total
+// and the sums per generation of the scoreboard processes
+func collectProcStats(processes []scoreboardProcess) (total procUpdate, generations map[int]*procUpdate) {
+	results := make([]procUpdate, len(processes))
+	var next atomic.Int64
+	var wg sync.WaitGroup
+	for range min(runtime.NumCPU(), ProcReaders, len(processes)) {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			buf := procBuffers.Get().(*[]byte)
+			defer procBuffers.Put(buf)
+			for i := int(next.Add(1) - 1); i < len(processes); i = int(next.Add(1) - 1) {
+				readProcStats(processes[i].pid, *buf, &results[i])
+			}
+		}()
+	}
+	wg.Wait()
+
+	generations = make(map[int]*procUpdate)
+	for i := range results {
+		total.add(&results[i])
+		if processes[i].generation < 0 || results[i].Total == 0 {
+			continue
+		}
+		gen, ok := generations[processes[i].generation]
+		if !ok {
+			gen = &procUpdate{}
+			generations[processes[i].generation] = gen
+		}
+		gen.add(&results[i])
+	}
+	return total, generations
+}
+
+// readProcStats reads /proc/<pid>/stat, statm and io with a single read each into buf.
+// Processes which are gone or cannot be read are not counted.
+func readProcStats(pid int, buf []byte, stats *procUpdate) bool {
+	dir := "/proc/" + strconv.Itoa(pid)
+
+	data, ok := readProcFile(dir+"/stat", buf)
+	// the command name may contain spaces, the remaining fields start after its closing parenthesis
+	end := bytes.LastIndexByte(data, ')')
+	if !ok || end < 0 || end+2 > len(data) {
+		return false
+	}
+	fields := procFields(data[end+2:], 22)
+	// fields are counted from the process state, which is field 3 in proc(5)
+	utime, _ := strconv.ParseUint(string(fields[11]), 10, 64)
+	stime, _ := strconv.ParseUint(string(fields[12]), 10, 64)
+	threads, _ := strconv.Atoi(string(fields[17]))
+
+	data, ok = readProcFile(dir+"/statm", buf)
+	if !ok {
+		return false
+	}
+	fields = procFields(data, 2)
+	size, _ := strconv.ParseUint(string(fields[0]), 10, 64)
+	resident, _ := strconv.ParseUint(string(fields[1]), 10, 64)
+	pageSize := uint64(os.Getpagesize())
+
+	stats.Total++
+	stats.Threads += threads
+	stats.CPU += float64(utime+stime) / procClockTicks
+	stats.VMS += size * pageSize
+	stats.RSS += resident * pageSize
+	stats.OpenFD += countProcFDs(dir + "/fd")
+
+	// io counters require the same permissions as ptrace, processes are still counted without them
+	data, ok = readProcFile(dir+"/io", buf)
+	for ok && len(data) > 0 {
+		var line []byte
+		line, data, _ = bytes.Cut(data, []byte("\n"))
+		name, value, _ := bytes.Cut(line, []byte(": "))
+		switch string(name) {
+		case "read_bytes":
+			stats.ReadBytes += parseProcUint(value)
+		case "write_bytes":
+			stats.WriteBytes += parseProcUint(value)
+		}
+	}
+	return true
+}
+
+// readProcFile reads a whole proc file with a single read into buf
+func readProcFile(path string, buf []byte) ([]byte, bool) {
+	fd, err := unix.Open(path, unix.O_RDONLY|unix.O_CLOEXEC, 0)
+	if err != nil {
+		return nil, false
+	}
+	defer unix.Close(fd)
+	n, err := unix.Read(fd, buf)
+	if err != nil || n <= 0 {
+		return nil, false
+	}
+	return buf[:n], true
+}
+
+// procFields splits data at spaces into at least num fields, missing fields are empty
+func procFields(data []byte, num int) [][]byte {
+	fields := make([][]byte, 0, num)
+	for _, field := range bytes.Fields(data) {
+		fields = append(fields, field)
+	}
+	for len(fields) < num {
+		fields = append(fields, nil)
+	}
+	return fields
+}
+
+func parseProcUint(value []byte) uint64 {
+	num, _ := strconv.ParseUint(string(bytes.TrimSpace(value)), 10, 64)
+	return num
+}
+
+// countProcFDs returns the number of open file descriptors. Recent kernels report it as size of the fd
+// folder, so only older kernels need to read the whole folder.
+func countProcFDs(dir string) int {
+	var st unix.Stat_t
+	if unix.Stat(dir, &st) == nil && st.Size > 0 {
+		return int(st.Size)
+	}
+	f, err := os.Open(dir)
+	if err != nil {
+		return 0
+	}
+	defer f.Close()
+	names, err := f.Readdirnames(-1)
+	if err != nil {
+		return 0
+	}
+	return len(names)
+}
+
+// updateProcMetricsWalk updates the process statistics for all children with match httpd/apache in its cmdline
+func updateProcMetricsWalk() {
+	stats := &procUpdate{}
+
+	pid := os.Getppid()
+	if pid == 1 {
+		pid = os.Getpid()
+	}
+	if pid >= math.MaxInt32 || pid <= math.MinInt32 {
+		return
+	}
+	mainProcess, _ := process.NewProcess(int32(pid))
+	countProcStats(mainProcess, stats)
+	setProcMetrics(stats)
+}
+
+func countProcStats(proc *process.Process, stats *procUpdate) {
+	cmdLine, err := proc.Cmdline()
+	if err != nil {
+		return
+	}
+
+	// only count apache processes
+	if !strings.Contains(cmdLine, "apache") && !strings.Contains(cmdLine, "httpd") {
+		return
+	}
+
+	memInfo, err := proc.MemoryInfo()
+	if err != nil {
+		return
+	}
+	ioInfo, err := proc.IOCounters()
+	if err != nil {
+		return
+	}
+	openFD, err := proc.NumFDs()
+	if err != nil {
+		return
+	}
+	numThreads, err := proc.NumThreads()
+	if err != nil {
+		return
+	}
+	stats.Total++
+	stats.Threads += int(numThreads)
+	stats.OpenFD += int(openFD)
+	stats.RSS += memInfo.RSS
+	stats.VMS += memInfo.VMS
+	stats.ReadBytes += ioInfo.ReadBytes
+	stats.WriteBytes += ioInfo.WriteBytes
+	children, err := proc.Children()
+	if err != nil {
+		return
+	}
+	for _, child := range children {
+		countProcStats(child, stats)
+	}
+}
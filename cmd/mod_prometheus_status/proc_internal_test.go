@@ -0,0 +1,91 @@
+package main
+
+import (
+	"os"
+	"os/exec"
+	"testing"
+
+	"github.com/shirou/gopsutil/process"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestProcessList(t *testing.T) {
+	t.Parallel()
+	list := &processList{}
+	_, ok := list.get()
+	assert.False(t, ok, "walk until the first list arrives")
+
+	list.set([]scoreboardProcess{{100, 1}, {101, 2}, {102, 2}})
+	procs, ok := list.get()
+	assert.True(t, ok)
+	assert.Equal(t, []scoreboardProcess{{100, 1}, {101, 2}, {102, 2}}, procs)
+
+	list.set(nil)
+	procs, ok = list.get()
+	assert.True(t, ok)
+	assert.Empty(t, procs)
+}
+
+func TestAppendOwnProcesses(t *testing.T) {
+	t.Parallel()
+	children := []scoreboardProcess{{100, 1}}
+	assert.Equal(t, []scoreboardProcess{{100, 1}, {10, -1}, {20, -1}}, appendOwnProcesses(children, 10, 20))
+
+	// the children are still counted once the main process is gone
+	assert.Equal(t, []scoreboardProcess{{100, 1}, {20, -1}}, appendOwnProcesses(children, 1, 20))
+}
+
+func TestReadProcStats(t *testing.T) {
+	t.Parallel()
+	stats := &procUpdate{}
+	buf := make([]byte, procBufferSize)
+	require.True(t, readProcStats(os.Getpid(), buf, stats))
+	assert.Equal(t, 1, stats.Total)
+	assert.Positive(t, stats.Threads)
+	assert.Positive(t, stats.OpenFD)
+	assert.Positive(t, stats.RSS)
+	assert.GreaterOrEqual(t, stats.VMS, stats.RSS)
+
+	assert.False(t, readProcStats(-1, buf, &procUpdate{}))
+
+	total, generations := collectProcStats([]scoreboardProcess{{os.Getpid(), 3}, {os.Getpid(), -1}})
+	assert.Equal(t, 2, total.Total)
+	require.Contains(t, generations, 3)
+	assert.Equal(t, 1, generations[3].Total)
+}
+
+// BenchmarkProcStats compares walking the process tree with reading the scoreboard pids directly
+func BenchmarkProcStats(b *testing.B) {
+	const children = 50
+	processes := []scoreboardProcess{}
+	for range children {
+		// the walk only counts processes with httpd in their command line
+		cmd := &exec.Cmd{Path: "/bin/sleep", Args: []string{"httpd", "60"}}
+		require.NoError(b, cmd.Start())
+		b.Cleanup(func() {
+			cmd.Process.Kill()
+			cmd.Wait()
+		})
+		processes = append(processes, scoreboardProcess{pid: cmd.Process.Pid, generation: 0})
+	}
+
+	b.Run("walk", func(b *testing.B) {
+		self, err := process.NewProcess(int32(os.Getpid()))
+		require.NoError(b, err)
+		b.ResetTimer()
+		for range b.N {
+			stats := &procUpdate{}
+			children, _ := self.Children()
+			for _, child := range children {
+				countProcStats(child, stats)
+			}
+		}
+	})
+
+	b.Run("scoreboard", func(b *testing.B) {
+		for range b.N {
+			collectProcStats(processes)
+		}
+	})
+}
@@ -1,22 +1,40 @@
 package main
 
+/*
+#cgo CFLAGS: -I${SRCDIR}/../../src
+
+#include "mod_prometheus_status_proto.h"
+
+*/
+import "C"
+
 import (
 	"bytes"
-	"math"
-	"os"
+	"compress/gzip"
+	"net/http"
+	runtimemetrics "runtime/metrics"
+	"slices"
 	"strconv"
 	"strings"
+	"sync"
+	"sync/atomic"
 	"time"
+	"unsafe"
 
 	"github.com/prometheus/client_golang/prometheus"
+	promcollectors "github.com/prometheus/client_golang/prometheus/collectors"
+	dto "github.com/prometheus/client_model/go"
 	"github.com/prometheus/common/expfmt"
-	"github.com/shirou/gopsutil/process"
+	"golang.org/x/sys/unix"
 )
 
 var (
 	registry   *prometheus.Registry
 	collectors = make(map[string]interface{})
 	labelCount = 0
+
+	// requestLabelNames contains the configured request label names
+	requestLabelNames []string
 )
 
 const (
@@ -26,17 +44,61 @@ const (
 
 var lastProcUpdate int64
 
-type procUpdate struct {
-	Total      int
-	Threads    int
-	OpenFD     int
-	RSS        uint64
-	VMS        uint64
-	ReadBytes  uint64
-	WriteBytes uint64
+// workerStats points to the prometheus_status_stats the apache children update in shared memory, nil if not available
+var workerStats unsafe.Pointer
+
+// invalidateInternedIDs tells the apache children to forget their interned label set ids, they request new ones
+func invalidateInternedIDs() {
+	if workerStats == nil {
+		return
+	}
+	stats := (*C.prometheus_status_stats)(workerStats)
+	atomic.AddUint64((*uint64)(unsafe.Pointer(&stats.interned_generation)), 1)
 }
 
-func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, sizeBuckets string) (err error) {
+var (
+	// quantileList contains the response time quantiles exposed as summary, empty disables quantiles
+	quantileList []float64
+
+	// quantileWindow is the sliding time window quantiles are computed over
+	quantileWindow time.Duration
+)
+
+// nativeHistogram configures request histograms as native histograms, they are only exposed in the protobuf format
+var nativeHistogram struct {
+	factor     float64       // growth factor between buckets, native histograms are disabled unless greater than 1
+	maxBuckets uint32        // maximum number of buckets per histogram, 0 means no limit
+	minReset   time.Duration // reset histograms exceeding maxBuckets after this duration instead of reducing the resolution
+}
+
+// scrapeCache contains the last gathered metrics and their rendered formats. Renders
+// are serialized so concurrent scrapes only trigger a single Gather.
+var scrapeCache = struct {
+	lock     sync.Mutex
+	ttl      time.Duration
+	started  time.Time // start of the last gather
+	families []*dto.MetricFamily
+	rendered map[scrapeCacheKey][]byte // rendered on first use
+	memfds   map[scrapeCacheKey]int    // sealed memfds of the rendered metrics, created on first use
+}{
+	rendered: make(map[scrapeCacheKey][]byte),
+	memfds:   make(map[scrapeCacheKey]int),
+}
+
+type scrapeCacheKey struct {
+	format   expfmt.Format
+	encoding string
+}
+
+const (
+	// EncodingIdentity returns uncompressed metrics
+	EncodingIdentity = ""
+
+	// EncodingGzip returns gzip compressed metrics
+	EncodingGzip = "gzip"
+)
+
+func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, sizeBuckets string, shm unsafe.Pointer, aggregate bool) (err error) {
 	if registry != nil {
 		return
 	}
@@ -47,6 +109,7 @@ func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, s
 		requestLabels = strings.Split(labelNames, ";")
 	}
 	labelCount = len(requestLabels)
+	requestLabelNames = requestLabels
 
 	/* server related metrics */
 	promServerInfo := prometheus.NewCounterVec(
@@ -129,6 +192,112 @@ func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, s
 	registry.MustRegister(promScoreboard)
 	collectors["promScoreboard"] = promScoreboard
 
+	promProcesses := prometheus.NewGaugeVec(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "processes",
+			Help:      "is the number of apache children from the scoreboard by generation and state",
+		},
+		[]string{"generation", "state"})
+	registry.MustRegister(promProcesses)
+	collectors["promProcesses"] = promProcesses
+
+	// only async mpms track connections per child
+	if mpmName == "event" {
+		promAsyncConnections := prometheus.NewGaugeVec(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "connections",
+				Help:      "is the number of connections handled by the apache children by state",
+			},
+			[]string{"state"})
+		registry.MustRegister(promAsyncConnections)
+		collectors["promAsyncConnections"] = promAsyncConnections
+	}
+
+	promVhostBusy := prometheus.NewGaugeVec(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "workers_busy",
+			Help:      "is the number of busy workers per vhost from the scoreboard",
+		},
+		[]string{"vhost"})
+	registry.MustRegister(promVhostBusy)
+	collectors["promVhostBusy"] = promVhostBusy
+
+	inflightBuckets, err = expandBuckets(timeBuckets)
+	if err != nil {
+		return err
+	}
+	promInflightRequests := prometheus.NewGaugeVec(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "inflight_requests",
+			Help:      "is the number of requests currently in flight from the scoreboard which are at most le seconds old",
+		},
+		[]string{"le"})
+	registry.MustRegister(promInflightRequests)
+	collectors["promInflightRequests"] = promInflightRequests
+
+	promInflightOldest := prometheus.NewGauge(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "inflight_requests_oldest_seconds",
+			Help:      "is the age of the oldest request currently in flight from the scoreboard",
+		})
+	registry.MustRegister(promInflightOldest)
+	collectors["promInflightOldest"] = promInflightOldest
+
+	if scoreboardSampleRate > 0 {
+		promScoreboardSeconds := prometheus.NewCounterVec(
+			prometheus.CounterOpts{
+				Namespace: "apache",
+				Name:      "workers_scoreboard_seconds_total",
+				Help:      "is the total time workers spent in each scoreboard state",
+			},
+			[]string{"state"})
+		registry.MustRegister(promScoreboardSeconds)
+		collectors["promScoreboardSeconds"] = promScoreboardSeconds
+
+		promScoreboardAverage := prometheus.NewGaugeVec(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "workers_scoreboard_average",
+				Help:      "is the time weighted average number of workers per scoreboard state since the previous scrape",
+			},
+			[]string{"state"})
+		registry.MustRegister(promScoreboardAverage)
+		collectors["promScoreboardAverage"] = promScoreboardAverage
+
+		promScoreboardMax := prometheus.NewGaugeVec(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "workers_scoreboard_max",
+				Help:      "is the maximum number of workers per scoreboard state since the previous scrape",
+			},
+			[]string{"state"})
+		registry.MustRegister(promScoreboardMax)
+		collectors["promScoreboardMax"] = promScoreboardMax
+
+		promScoreboardSamples := prometheus.NewCounter(
+			prometheus.CounterOpts{
+				Namespace: "apache",
+				Name:      "exporter_scoreboard_samples_total",
+				Help:      "is the total number of scoreboard samples",
+			})
+		registry.MustRegister(promScoreboardSamples)
+		collectors["promScoreboardSamples"] = promScoreboardSamples
+
+		promScoreboardSampleDuration := prometheus.NewGauge(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "exporter_scoreboard_sample_duration_seconds",
+				Help:      "is the average duration of a scoreboard sample since the previous scrape",
+			})
+		registry.MustRegister(promScoreboardSampleDuration)
+		collectors["promScoreboardSampleDuration"] = promScoreboardSampleDuration
+	}
+
 	/* process related metrics */
 	promProcessCounter := prometheus.NewGauge(
 		prometheus.GaugeOpts{
@@ -200,7 +369,189 @@ func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, s
 	promOpenFD.Set(0)
 	collectors["promOpenFD"] = promOpenFD
 
+	if procDetails {
+		promProcGenerationRSS := prometheus.NewGaugeVec(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "process_generation_rss_memory_bytes",
+				Help:      "rss bytes of the apache children by generation",
+			},
+			[]string{"generation"})
+		registry.MustRegister(promProcGenerationRSS)
+		collectors["promProcGenerationRSS"] = promProcGenerationRSS
+
+		promProcGenerationCPU := prometheus.NewGaugeVec(
+			prometheus.GaugeOpts{
+				Namespace: "apache",
+				Name:      "process_generation_cpu_seconds",
+				Help:      "cpu seconds used by the running apache children by generation",
+			},
+			[]string{"generation"})
+		registry.MustRegister(promProcGenerationCPU)
+		collectors["promProcGenerationCPU"] = promProcGenerationCPU
+	}
+
+	/* exporter self metrics */
+	promRenderDuration := prometheus.NewGauge(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_render_duration_seconds",
+			Help:      "time it took to render the metrics on the last uncached scrape",
+		})
+	registry.MustRegister(promRenderDuration)
+	collectors["promRenderDuration"] = promRenderDuration
+
+	promStartupDuration := prometheus.NewGaugeVec(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_startup_duration_seconds",
+			Help:      "time it took to start the metrics collector, by phase",
+		},
+		[]string{"phase"})
+	registry.MustRegister(promStartupDuration)
+	collectors["promStartupDuration"] = promStartupDuration
+
+	promCompressionRatio := prometheus.NewGauge(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_compression_ratio",
+			Help:      "uncompressed divided by compressed size of the last compressed scrape",
+		})
+	registry.MustRegister(promCompressionRatio)
+	collectors["promCompressionRatio"] = promCompressionRatio
+
+	promSeriesDropped := prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "apache",
+			Name:      "exporter_series_dropped_total",
+			Help:      "number of new request label sets folded into the __overflow__ series because the series limit was reached",
+		})
+	registry.MustRegister(promSeriesDropped)
+	collectors["promSeriesDropped"] = promSeriesDropped
+
+	promSeriesEvicted := prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "apache",
+			Name:      "exporter_series_evicted_total",
+			Help:      "number of request label sets removed after being idle for the series ttl",
+		})
+	registry.MustRegister(promSeriesEvicted)
+	collectors["promSeriesEvicted"] = promSeriesEvicted
+
+	registry.MustRegister(prometheus.NewCounterFunc(
+		prometheus.CounterOpts{
+			Namespace: "apache",
+			Name:      "exporter_updates_total",
+			Help:      "number of metrics updates received from apache children",
+		},
+		func() float64 { return float64(updatesReceived.Load()) }))
+
+	promParseErrors := prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "apache",
+			Name:      "exporter_parse_errors_total",
+			Help:      "number of metrics updates which could not be parsed or applied",
+		})
+	registry.MustRegister(promParseErrors)
+	collectors["promParseErrors"] = promParseErrors
+
+	promConnections := prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "apache",
+			Name:      "exporter_connections_total",
+			Help:      "number of accepted connections on the metrics socket",
+		})
+	registry.MustRegister(promConnections)
+	collectors["promConnections"] = promConnections
+
+	promConnectionsActive := prometheus.NewGauge(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_connections_active",
+			Help:      "number of open connections on the metrics socket",
+		})
+	registry.MustRegister(promConnectionsActive)
+	collectors["promConnectionsActive"] = promConnectionsActive
+
+	promRenderSize := prometheus.NewGauge(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_render_size_bytes",
+			Help:      "uncompressed size of the metrics rendered on the last uncached scrape",
+		})
+	registry.MustRegister(promRenderSize)
+	collectors["promRenderSize"] = promRenderSize
+
+	if workerStats != nil {
+		stats := (*C.prometheus_status_stats)(workerStats)
+		for reason, counter := range map[string]*C.uint64_t{"error": &stats.send_failures, "timeout": &stats.send_timeouts} {
+			registry.MustRegister(prometheus.NewCounterFunc(
+				prometheus.CounterOpts{
+					Namespace:   "apache",
+					Name:        "exporter_send_failures_total",
+					Help:        "number of sends from apache children to the metrics collector which failed or timed out",
+					ConstLabels: prometheus.Labels{"reason": reason},
+				},
+				func() float64 { return float64(atomic.LoadUint64((*uint64)(unsafe.Pointer(counter)))) }))
+		}
+		registry.MustRegister(prometheus.NewCounterFunc(
+			prometheus.CounterOpts{
+				Namespace: "apache",
+				Name:      "exporter_updates_dropped_total",
+				Help:      "number of request metric updates the apache children dropped because the metrics collector was busy or gone",
+			},
+			func() float64 { return float64(atomic.LoadUint64((*uint64)(unsafe.Pointer(&stats.send_drops)))) }))
+		registry.MustRegister(prometheus.NewCounterFunc(
+			prometheus.CounterOpts{
+				Namespace: "apache",
+				Name:      "exporter_read_failures_total",
+				Help:      "number of replies from the metrics collector the apache children failed to read",
+			},
+			func() float64 { return float64(atomic.LoadUint64((*uint64)(unsafe.Pointer(&stats.read_failures)))) }))
+	}
+
+	// cpu, memory and file descriptors of the collector process itself
+	registry.MustRegister(promcollectors.NewProcessCollector(promcollectors.ProcessCollectorOpts{Namespace: "apache_exporter"}))
+	registry.MustRegister(prometheus.NewGaugeFunc(
+		prometheus.GaugeOpts{
+			Namespace: "apache",
+			Name:      "exporter_heap_bytes",
+			Help:      "heap memory occupied by live and not yet freed objects of the metrics collector",
+		},
+		func() float64 {
+			sample := []runtimemetrics.Sample{{Name: "/memory/classes/heap/objects:bytes"}}
+			runtimemetrics.Read(sample)
+			return float64(sample[0].Value.Uint64())
+		}))
+
 	/* request related metrics */
+	if shm != nil {
+		// request metrics are read from the shared memory worker slots on scrapes
+		shmCol, shmErr := newShmCollector(shm, requestLabels)
+		if shmErr != nil {
+			return shmErr
+		}
+		registry.MustRegister(shmCol)
+		return
+	}
+	if aggregate {
+		// request metrics are summed up by the apache children and arrive as deltas
+		var timeBucketList, sizeBucketList []float64
+		timeBucketList, err = expandBuckets(timeBuckets)
+		if err != nil {
+			return
+		}
+		sizeBucketList, err = expandBuckets(sizeBuckets)
+		if err != nil {
+			return
+		}
+		aggregates = newAggregateCollector(requestLabels, timeBucketList, sizeBucketList)
+		registry.MustRegister(aggregates)
+		registerQuantiles(requestLabels)
+		return
+	}
+	registerQuantiles(requestLabels)
+
 	promRequests := prometheus.NewCounterVec(
 		prometheus.CounterOpts{
 			Namespace: "apache",
@@ -216,12 +567,7 @@ func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, s
 		return
 	}
 	promResponseTime := prometheus.NewHistogramVec(
-		prometheus.HistogramOpts{
-			Namespace: "apache",
-			Name:      "response_time_seconds",
-			Help:      "response time histogram",
-			Buckets:   timeBucketList,
-		},
+		requestHistogramOpts("response_time_seconds", "response time histogram", timeBucketList),
 		requestLabels)
 	registry.MustRegister(promResponseTime)
 	collectors["promResponseTime"] = promResponseTime
@@ -231,122 +577,242 @@ func registerMetrics(serverDesc, serverName, labelNames, mpmName, timeBuckets, s
 		return
 	}
 	promResponseSize := prometheus.NewHistogramVec(
-		prometheus.HistogramOpts{
-			Namespace: "apache",
-			Name:      "response_size_bytes",
-			Help:      "response size histogram",
-			Buckets:   sizeBucketList,
-		},
+		requestHistogramOpts("response_size_bytes", "response size histogram", sizeBucketList),
 		requestLabels)
 	registry.MustRegister(promResponseSize)
 	collectors["promResponseSize"] = promResponseSize
 	return
 }
 
-func metricsGet() []byte {
-	now := time.Now().Unix()
-	if now-lastProcUpdate > ProcUpdateInterval {
-		lastProcUpdate = now
-		updateProcMetrics()
+// registerQuantiles registers the response time quantile summary if quantiles are configured
+func registerQuantiles(requestLabels []string) {
+	if len(quantileList) == 0 {
+		return
 	}
-	var buf bytes.Buffer
-	gathering, err := registry.Gather()
-	if err != nil {
-		logErrorf("internal prometheus error: %s", err.Error())
-		return (buf.Bytes())
+	quantiles = newQuantileCollector(requestLabels, quantileList, quantileWindow)
+	registry.MustRegister(quantiles)
+}
+
+// requestHistogramOpts returns the options for request histograms, native histograms replace the classic buckets
+func requestHistogramOpts(name, help string, buckets []float64) prometheus.HistogramOpts {
+	opts := prometheus.HistogramOpts{
+		Namespace: "apache",
+		Name:      name,
+		Help:      help,
+		Buckets:   buckets,
 	}
-	for _, m := range gathering {
-		expfmt.MetricFamilyToText(&buf, m)
+	if nativeHistogram.factor > 1 {
+		opts.Buckets = nil
+		opts.NativeHistogramBucketFactor = nativeHistogram.factor
+		opts.NativeHistogramMaxBucketNumber = nativeHistogram.maxBuckets
+		opts.NativeHistogramMinResetDuration = nativeHistogram.minReset
 	}
-	buf.WriteString("\n\n")
-	return (buf.Bytes())
+	return opts
 }
 
-// updateProcMetrics updates memory statistics for all children with match httpd/apache in its cmdline
-func updateProcMetrics() {
-	stats := &procUpdate{}
+// metricsGet returns the rendered metrics in text format
+func metricsGet() []byte {
+	_, body := metricsGetEncoded("", EncodingIdentity)
+	return body
+}
+
+// metricsGetEncoded returns the format and the rendered metrics for the given accept header and content encoding.
+// Metrics are gathered once per scrape cache ttl, each format and encoding is rendered at most once per gather.
+// The returned slice is shared and must not be modified.
+func metricsGetEncoded(accept, encoding string) (expfmt.Format, []byte) {
+	format, body, _ := metricsGetShared(accept, encoding, false)
+	return format, body
+}
 
-	pid := os.Getppid()
-	if pid == 1 {
-		pid = os.Getpid()
+// metricsGetShared works like metricsGetEncoded. If share is set, it additionally returns a duplicated
+// descriptor of a sealed memfd containing the body, which must be closed by the caller. The descriptor
+// is -1 if no memfd is available.
+func metricsGetShared(accept, encoding string, share bool) (expfmt.Format, []byte, int) {
+	format := expfmt.NegotiateIncludingOpenMetrics(http.Header{"Accept": []string{accept}})
+	key := scrapeCacheKey{format: format, encoding: encoding}
+	arrived := time.Now()
+	scrapeCache.lock.Lock()
+	defer scrapeCache.lock.Unlock()
+	// reuse gathers which are fresh enough or started while waiting for the lock
+	if scrapeCache.families == nil || (arrived.Sub(scrapeCache.started) >= scrapeCache.ttl && scrapeCache.started.Before(arrived)) {
+		scrapeCache.started = time.Now()
+		scrapeCache.families = metricsGather()
+		clear(scrapeCache.rendered)
+		for _, fd := range scrapeCache.memfds {
+			if fd >= 0 {
+				unix.Close(fd)
+			}
+		}
+		clear(scrapeCache.memfds)
 	}
-	if pid >= math.MaxInt32 || pid <= math.MinInt32 {
-		return
+	body, ok := scrapeCache.rendered[key]
+	if !ok {
+		body = metricsRender(scrapeCache.families, format, encoding)
+		scrapeCache.rendered[key] = body
+	}
+	if !share {
+		return format, body, -1
 	}
-	mainProcess, _ := process.NewProcess(int32(pid))
-	countProcStats(mainProcess, stats)
-
-	collectors["promProcCounter"].(prometheus.Gauge).Set(float64(stats.Total))
-	collectors["promThreads"].(prometheus.Gauge).Set(float64(stats.Threads))
-	collectors["promOpenFD"].(prometheus.Gauge).Set(float64(stats.OpenFD))
-	collectors["promMemoryReal"].(prometheus.Gauge).Set(float64(stats.RSS))
-	collectors["promMemoryVirt"].(prometheus.Gauge).Set(float64(stats.VMS))
-	collectors["promReadBytes"].(prometheus.Gauge).Set(float64(stats.ReadBytes))
-	collectors["promWriteBytes"].(prometheus.Gauge).Set(float64(stats.WriteBytes))
-}
 
-func countProcStats(proc *process.Process, stats *procUpdate) {
-	cmdLine, err := proc.Cmdline()
+	memfd, ok := scrapeCache.memfds[key]
+	if !ok {
+		memfd = createMemfd(body)
+		scrapeCache.memfds[key] = memfd
+	}
+	if memfd < 0 {
+		return format, body, -1
+	}
+	// the cached memfd might be closed by the next gather while it is being sent
+	fd, err := unix.FcntlInt(uintptr(memfd), unix.F_DUPFD_CLOEXEC, 0)
 	if err != nil {
-		return
+		logErrorf("failed to duplicate memfd: %s", err.Error())
+		return format, body, -1
 	}
+	return format, body, fd
+}
 
-	// only count apache processes
-	if !strings.Contains(cmdLine, "apache") && !strings.Contains(cmdLine, "httpd") {
-		return
+// metricsRender encodes and compresses the metric families
+func metricsRender(families []*dto.MetricFamily, format expfmt.Format, encoding string) []byte {
+	start := time.Now()
+	body := metricsEncode(families, format)
+	collectors["promRenderDuration"].(prometheus.Gauge).Set(time.Since(start).Seconds())
+	collectors["promRenderSize"].(prometheus.Gauge).Set(float64(len(body)))
+	if encoding == EncodingGzip {
+		plain := len(body)
+		body = compressMetrics(body)
+		collectors["promCompressionRatio"].(prometheus.Gauge).Set(float64(plain) / float64(len(body)))
 	}
+	return body
+}
 
-	memInfo, err := proc.MemoryInfo()
+// createMemfd returns a sealed memfd containing data or -1 if memfds are not supported
+func createMemfd(data []byte) int {
+	fd, err := unix.MemfdCreate("mod_prometheus_status", unix.MFD_CLOEXEC|unix.MFD_ALLOW_SEALING)
 	if err != nil {
-		return
+		logDebugf("cannot create memfd: %s", err.Error())
+		return -1
 	}
-	ioInfo, err := proc.IOCounters()
-	if err != nil {
-		return
+	for written := 0; written < len(data); {
+		n, err := unix.Write(fd, data[written:])
+		if err != nil {
+			logErrorf("failed to write memfd: %s", err.Error())
+			unix.Close(fd)
+			return -1
+		}
+		written += n
 	}
-	openFD, err := proc.NumFDs()
+	// workers may mmap or sendfile the memfd, so its content must never change
+	_, err = unix.FcntlInt(uintptr(fd), unix.F_ADD_SEALS, unix.F_SEAL_SHRINK|unix.F_SEAL_GROW|unix.F_SEAL_WRITE|unix.F_SEAL_SEAL)
 	if err != nil {
-		return
+		logErrorf("failed to seal memfd: %s", err.Error())
+		unix.Close(fd)
+		return -1
 	}
-	numThreads, err := proc.NumThreads()
-	if err != nil {
-		return
+	return fd
+}
+
+// compressMetrics returns the gzip compressed metrics
+func compressMetrics(rendered []byte) []byte {
+	var buf bytes.Buffer
+	zw := gzip.NewWriter(&buf)
+	zw.Write(rendered)
+	zw.Close()
+	return buf.Bytes()
+}
+
+// metricsGather collects all metrics from the registry
+func metricsGather() []*dto.MetricFamily {
+	updateScoreboardMetrics()
+	now := time.Now().Unix()
+	if now-lastProcUpdate > ProcUpdateInterval {
+		lastProcUpdate = now
+		updateProcMetrics()
 	}
-	stats.Total++
-	stats.Threads += int(numThreads)
-	stats.OpenFD += int(openFD)
-	stats.RSS += memInfo.RSS
-	stats.VMS += memInfo.VMS
-	stats.ReadBytes += ioInfo.ReadBytes
-	stats.WriteBytes += ioInfo.WriteBytes
-	children, err := proc.Children()
+	gathering, err := registry.Gather()
 	if err != nil {
-		return
+		logErrorf("internal prometheus error: %s", err.Error())
 	}
-	for _, child := range children {
-		countProcStats(child, stats)
+	return appendSeriesFamily(mergeBaseline(gathering))
+}
+
+// appendSeriesFamily adds the number of series per metric family, the families stay sorted by name
+func appendSeriesFamily(families []*dto.MetricFamily) []*dto.MetricFamily {
+	name := "apache_exporter_series"
+	help := "number of series per metric on the last uncached scrape"
+	labelName := "metric"
+	family := &dto.MetricFamily{Name: &name, Help: &help, Type: dto.MetricType_GAUGE.Enum()}
+	for _, f := range families {
+		count := float64(countSeries(f))
+		family.Metric = append(family.Metric, &dto.Metric{
+			Label: []*dto.LabelPair{{Name: &labelName, Value: f.Name}},
+			Gauge: &dto.Gauge{Value: &count},
+		})
 	}
+	pos, _ := slices.BinarySearchFunc(families, name, func(f *dto.MetricFamily, name string) int {
+		return strings.Compare(f.GetName(), name)
+	})
+	return slices.Insert(families, pos, family)
+}
+
+// countSeries returns the number of series a metric family is exposed with in the text format
+func countSeries(family *dto.MetricFamily) int {
+	count := 0
+	for _, m := range family.GetMetric() {
+		switch family.GetType() {
+		case dto.MetricType_HISTOGRAM, dto.MetricType_GAUGE_HISTOGRAM:
+			// buckets plus +Inf, sum and count
+			count += len(m.GetHistogram().GetBucket()) + 3
+		case dto.MetricType_SUMMARY:
+			count += len(m.GetSummary().GetQuantile()) + 2
+		default:
+			count++
+		}
+	}
+	return count
+}
+
+// metricsEncode renders the metric families in the given exposition format
+func metricsEncode(families []*dto.MetricFamily, format expfmt.Format) []byte {
+	var buf bytes.Buffer
+	enc := expfmt.NewEncoder(&buf, format)
+	for _, m := range families {
+		err := enc.Encode(m)
+		if err != nil {
+			logErrorf("failed to encode metric %s: %s", m.GetName(), err.Error())
+		}
+	}
+	// openmetrics needs a final EOF marker
+	if closer, ok := enc.(expfmt.Closer); ok {
+		closer.Close()
+	}
+	return buf.Bytes()
 }
 
 func metricsUpdate(metricsType int, data string) {
 	args := strings.Split(data, ";")
+	if len(args) < 2 {
+		logErrorf("malformed metrics update: %s", data)
+		countParseError()
+		return
+	}
 	name := args[0]
-	val, _ := strconv.ParseFloat(args[1], 64)
+	val, err := strconv.ParseFloat(args[1], 64)
+	if err != nil {
+		logErrorf("malformed metrics update value: %s", data)
+		countParseError()
+		return
+	}
 	label := args[2:]
 
-	// trim / expand labels to expected size
 	if metricsType == RequestMetrics {
-		switch {
-		case len(label) > labelCount:
-			label = label[0:labelCount]
-		case len(label) < labelCount:
-			label = append(label, make([]string, labelCount-len(label))...)
-		}
+		applyRequestUpdate(name, val, normalizeLabels(label))
+		return
 	}
 
 	collector, ok := collectors[name]
 	if !ok {
 		logErrorf("unknown metric: %s", name)
+		countParseError()
 		return
 	}
 	switch col := collector.(type) {
@@ -365,6 +831,43 @@ func metricsUpdate(metricsType int, data string) {
 	}
 }
 
+// applyRequestUpdate updates a request metric through the series cache, so text updates are limited and evicted as well
+func applyRequestUpdate(name string, val float64, label []string) {
+	if _, ok := collectors[name]; !ok {
+		logErrorf("unknown metric: %s", name)
+		countParseError()
+		return
+	}
+	metrics := lookupSeriesByLabels(label).get()
+	switch name {
+	case "promRequests":
+		metrics.requests.Add(val)
+	case "promResponseTime":
+		metrics.observeTime(val)
+	case "promResponseSize":
+		metrics.size.Observe(val)
+	default:
+		logErrorf("unknown request metric: %s", name)
+		countParseError()
+	}
+}
+
+// countParseError counts a metrics update which could not be parsed or applied
+func countParseError() {
+	collectors["promParseErrors"].(prometheus.Counter).Inc()
+}
+
+// normalizeLabels trims / expands request labels to the expected size
+func normalizeLabels(label []string) []string {
+	switch {
+	case len(label) > labelCount:
+		label = label[0:labelCount]
+	case len(label) < labelCount:
+		label = append(label, make([]string, labelCount-len(label))...)
+	}
+	return label
+}
+
 func expandBuckets(input string) (list []float64, err error) {
 	for _, s := range strings.Split(input, ";") {
 		s = strings.TrimSpace(s)
@@ -1,8 +1,18 @@
 package main
 
 import (
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"fmt"
+	"io"
 	"testing"
+	"time"
 
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	dto "github.com/prometheus/client_model/go"
+	"github.com/prometheus/common/expfmt"
 	"github.com/stretchr/testify/assert"
 	"github.com/stretchr/testify/require"
 )
@@ -14,3 +24,194 @@ func TestExpandBuckets(t *testing.T) {
 	require.NoError(t, err)
 	assert.Equal(t, list, res)
 }
+
+func TestCumulativeBuckets(t *testing.T) {
+	t.Parallel()
+	res := cumulativeBuckets([]float64{0.1, 1, 10}, []uint64{1, 2, 0, 5})
+	assert.Equal(t, map[float64]uint64{0.1: 1, 1: 3, 10: 3}, res)
+}
+
+func TestScrapeCache(t *testing.T) {
+	initTestMetrics(t)
+	scrapeCache.ttl = time.Hour
+	defer func() { scrapeCache.ttl = 0 }()
+
+	metricsUpdate(RequestMetrics, "promRequests;1;cached;GET;200")
+	first := metricsGet()
+	assert.Contains(t, string(first), `apache_requests_total{method="GET",status="200",vhost="cached"} 1`)
+	metricsUpdate(RequestMetrics, "promRequests;1;cached;GET;200")
+	assert.Equal(t, first, metricsGet())
+
+	scrapeCache.ttl = 0
+	assert.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="200",vhost="cached"} 2`)
+}
+
+func TestScrapeCacheGzip(t *testing.T) {
+	initTestMetrics(t)
+	scrapeCache.ttl = time.Hour
+	defer func() { scrapeCache.ttl = 0 }()
+
+	plain := metricsGet()
+	_, compressed := metricsGetEncoded("", EncodingGzip)
+	_, again := metricsGetEncoded("", EncodingGzip)
+	assert.Same(t, &compressed[0], &again[0])
+
+	zr, err := gzip.NewReader(bytes.NewReader(compressed))
+	require.NoError(t, err)
+	uncompressed, err := io.ReadAll(zr)
+	require.NoError(t, err)
+	assert.Equal(t, string(plain), string(uncompressed))
+}
+
+func TestMetricsFormatNegotiation(t *testing.T) {
+	initTestMetrics(t)
+	format, body := metricsGetEncoded("", EncodingIdentity)
+	assert.Equal(t, expfmt.TypeTextPlain, format.FormatType())
+	assert.Contains(t, string(body), "# TYPE apache_server_uptime_seconds gauge")
+
+	format, body = metricsGetEncoded("application/openmetrics-text;version=1.0.0,text/plain;q=0.5", EncodingIdentity)
+	assert.Equal(t, expfmt.TypeOpenMetrics, format.FormatType())
+	assert.True(t, bytes.HasSuffix(body, []byte("# EOF\n")))
+
+	format, body = metricsGetEncoded("application/vnd.google.protobuf;proto=io.prometheus.client.MetricFamily;encoding=delimited", EncodingIdentity)
+	assert.Equal(t, expfmt.TypeProtoDelim, format.FormatType())
+	names := []string{}
+	dec := expfmt.NewDecoder(bytes.NewReader(body), format)
+	for {
+		var mf dto.MetricFamily
+		if dec.Decode(&mf) != nil {
+			break
+		}
+		names = append(names, mf.GetName())
+	}
+	assert.Contains(t, names, "apache_server_uptime_seconds")
+}
+
+func TestNativeHistogramOpts(t *testing.T) {
+	assert.Equal(t, []float64{0.1, 1}, requestHistogramOpts("test", "test", []float64{0.1, 1}).Buckets)
+
+	nativeHistogram.factor = 1.1
+	nativeHistogram.maxBuckets = 100
+	defer func() { nativeHistogram.factor = 0 }()
+	hist := prometheus.NewHistogram(requestHistogramOpts("test_seconds", "test", []float64{0.1, 1}))
+	for i := range 1000 {
+		hist.Observe(float64(i) / 1000)
+	}
+	var metric dto.Metric
+	require.NoError(t, hist.Write(&metric))
+	assert.Equal(t, uint64(1000), metric.GetHistogram().GetSampleCount())
+	assert.Empty(t, metric.GetHistogram().GetBucket())
+	assert.NotZero(t, metric.GetHistogram().GetSchema())
+	assert.LessOrEqual(t, len(metric.GetHistogram().GetPositiveDelta()), 100)
+}
+
+func TestExporterMetrics(t *testing.T) {
+	initTestMetrics(t)
+	parseErrors := testutil.ToFloat64(collectors["promParseErrors"].(prometheus.Counter))
+	updates := updatesReceived.Load()
+
+	var payload bytes.Buffer
+	payload.Write(encodeTestRecord(metricRequests, 1, nil, "exporter", "GET", "200"))
+	payload.WriteString("request:promRequests;1;exporter;GET;200\n")
+	payload.WriteString("request:promRequests;invalid;exporter;GET;200\n")
+	_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+
+	assert.Equal(t, updates+3, updatesReceived.Load())
+	assert.InDelta(t, parseErrors+1, testutil.ToFloat64(collectors["promParseErrors"].(prometheus.Counter)), 0)
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_exporter_series{metric="apache_server_uptime_seconds"} 1`)
+	assert.Regexp(t, `apache_exporter_render_size_bytes [1-9]`, metrics)
+	assert.Contains(t, metrics, "apache_exporter_heap_bytes")
+}
+
+// newBenchmarkFamilies returns a gathered registry with 10k request series
+func newBenchmarkFamilies(b *testing.B) []*dto.MetricFamily {
+	b.Helper()
+	reg := prometheus.NewRegistry()
+	requests := prometheus.NewCounterVec(prometheus.CounterOpts{Name: "apache_requests_total", Help: "requests"}, []string{"vhost", "method", "status"})
+	times := prometheus.NewHistogramVec(prometheus.HistogramOpts{Name: "apache_response_time_seconds", Help: "response time", Buckets: []float64{0.01, 0.1, 1, 10, 30}}, []string{"vhost", "method", "status"})
+	reg.MustRegister(requests, times)
+	// 5000 counters plus 5000 histograms
+	for i := range 5000 {
+		labels := []string{fmt.Sprintf("vhost%d.example.com", i/50), []string{"GET", "POST"}[i%2], fmt.Sprintf("%d", 200+i%50)}
+		requests.WithLabelValues(labels...).Add(float64(i))
+		times.WithLabelValues(labels...).Observe(float64(i%100) / 10)
+	}
+	families, err := reg.Gather()
+	require.NoError(b, err)
+	return families
+}
+
+func BenchmarkMetricsEncode(b *testing.B) {
+	families := newBenchmarkFamilies(b)
+	formats := map[string]expfmt.Format{
+		"text":        expfmt.NewFormat(expfmt.TypeTextPlain),
+		"openmetrics": expfmt.NewFormat(expfmt.TypeOpenMetrics),
+		"protobuf":    expfmt.NewFormat(expfmt.TypeProtoDelim),
+	}
+	for name, format := range formats {
+		b.Run(name, func(b *testing.B) {
+			var size int
+			b.ReportAllocs()
+			for range b.N {
+				size = len(metricsEncode(families, format))
+			}
+			b.ReportMetric(float64(size), "payload-bytes")
+		})
+		b.Run(name+"-gzip", func(b *testing.B) {
+			var size int
+			b.ReportAllocs()
+			for range b.N {
+				size = len(compressMetrics(metricsEncode(families, format)))
+			}
+			b.ReportMetric(float64(size), "payload-bytes")
+		})
+	}
+}
+
+// benchmarkSeriesCounts are the numbers of request label sets the update and render benchmarks run with
+var benchmarkSeriesCounts = []int{100, 10000, 100000}
+
+// prepareBenchmarkSeries replaces all request series with count fresh label sets and returns their text updates
+func prepareBenchmarkSeries(b *testing.B, count int) []string {
+	b.Helper()
+	initTestMetrics(b)
+	// evict the series of previous benchmarks, so each run only renders its own label sets
+	seriesClock.Add(1)
+	evictSeries(seriesClock.Load())
+	updates := make([]string, count)
+	for i := range updates {
+		updates[i] = fmt.Sprintf("promResponseTime;0.0123;vhost%d.example.com;%s;%d", i/50, []string{"GET", "POST"}[i%2], 200+i%50)
+		metricsUpdate(RequestMetrics, updates[i])
+	}
+	return updates
+}
+
+func BenchmarkMetricsUpdate(b *testing.B) {
+	for _, count := range benchmarkSeriesCounts {
+		b.Run(fmt.Sprintf("series-%d", count), func(b *testing.B) {
+			updates := prepareBenchmarkSeries(b, count)
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := range b.N {
+				metricsUpdate(RequestMetrics, updates[i%count])
+			}
+		})
+	}
+}
+
+func BenchmarkMetricsGet(b *testing.B) {
+	for _, count := range benchmarkSeriesCounts {
+		b.Run(fmt.Sprintf("series-%d", count), func(b *testing.B) {
+			prepareBenchmarkSeries(b, count)
+			var size int
+			b.ReportAllocs()
+			b.ResetTimer()
+			for range b.N {
+				size = len(metricsGet())
+			}
+			b.ReportMetric(float64(size), "payload-bytes")
+		})
+	}
+}
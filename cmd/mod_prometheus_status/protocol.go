@@ -0,0 +1,206 @@
+package main
+
+/*
+#cgo CFLAGS: -I${SRCDIR}/../../src
+
+#include "mod_prometheus_status_proto.h"
+
+*/
+import "C"
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"io"
+	"math"
+)
+
+const (
+	protoMagic      = C.PROMETHEUS_STATUS_PROTO_MAGIC
+	protoVersion    = C.PROMETHEUS_STATUS_PROTO_VERSION
+	protoHeaderSize = C.PROMETHEUS_STATUS_PROTO_HEADER_SIZE
+	protoMaxLabels  = C.PROMETHEUS_STATUS_PROTO_MAX_LABELS
+	protoInterned   = C.PROMETHEUS_STATUS_PROTO_INTERNED
+
+	metricRequests     = C.PROMETHEUS_STATUS_METRIC_REQUESTS
+	metricResponseTime = C.PROMETHEUS_STATUS_METRIC_RESPONSE_TIME
+	metricResponseSize = C.PROMETHEUS_STATUS_METRIC_RESPONSE_SIZE
+	metricRequest      = C.PROMETHEUS_STATUS_METRIC_REQUEST
+	metricAggregate    = C.PROMETHEUS_STATUS_METRIC_AGGREGATE
+	metricIntern       = C.PROMETHEUS_STATUS_METRIC_INTERN
+
+	fieldResponseSize = C.PROMETHEUS_STATUS_FIELD_RESPONSE_SIZE
+	protoNumFields    = C.PROMETHEUS_STATUS_NUM_FIELDS
+
+	backendAggregate = C.PROMETHEUS_STATUS_BACKEND_AGGREGATE
+
+	socketTypeDatagram = C.PROMETHEUS_STATUS_SOCKET_DATAGRAM
+	maxDatagramSize    = C.PROMETHEUS_STATUS_MAX_DATAGRAM
+
+	// datagramSuffix must match PROMETHEUS_STATUS_DATAGRAM_SUFFIX
+	datagramSuffix = ".dgram"
+)
+
+var (
+	errRecordShort   = errors.New("binary record too short")
+	errRecordVersion = errors.New("unsupported binary record version")
+	errRecordLabels  = errors.New("binary record has too many labels")
+	errRecordLength  = errors.New("binary record length mismatch")
+)
+
+// record is a decoded binary metrics update.
+// The label values reference the read buffer and are only valid until the next read.
+type record struct {
+	metric    byte
+	value     uint64
+	interned  bool   // labels are referenced by id
+	id        uint32 // interned label set id
+	fields    [protoNumFields]uint64
+	rawFields []byte // all encoded fields, aggregate records have a variable number of fields
+	labels    [][]byte
+	labelKey  []byte // encoded label values, used as cache key
+	labelBuf  [protoMaxLabels][]byte
+}
+
+// readRecord reads the next binary record from buf, the buffer must be large enough to hold a full record
+func readRecord(buf *bufio.Reader, rec *record) error {
+	header, err := buf.Peek(protoHeaderSize)
+	if err != nil {
+		return err
+	}
+	length := int(binary.NativeEndian.Uint16(header[2:]))
+	data, err := buf.Peek(length)
+	if err != nil {
+		return err
+	}
+	err = decodeRecord(data, rec)
+	if err != nil {
+		countParseError()
+		return err
+	}
+	_, err = buf.Discard(length)
+	return err
+}
+
+// decodeRecord decodes a single binary record without allocating memory
+func decodeRecord(data []byte, rec *record) error {
+	if len(data) < protoHeaderSize {
+		return errRecordShort
+	}
+	if data[1] != protoVersion {
+		return errRecordVersion
+	}
+	length := int(binary.NativeEndian.Uint16(data[2:]))
+	if length < protoHeaderSize || length > len(data) {
+		return errRecordLength
+	}
+	data = data[:length]
+	numLabels := int(data[5])
+
+	rec.metric = data[4]
+	rec.value = binary.NativeEndian.Uint64(data[6:])
+	rec.labels = rec.labelBuf[:0]
+	rec.interned = false
+	rec.fields = [protoNumFields]uint64{}
+	rec.rawFields = nil
+	pos := protoHeaderSize
+	if rec.metric == metricRequest || rec.metric == metricAggregate {
+		if pos >= length {
+			return errRecordLength
+		}
+		numFields := int(data[pos])
+		pos++
+		if pos+numFields*8 > length {
+			return errRecordLength
+		}
+		// fields unknown to this version are skipped
+		for i := range min(numFields, protoNumFields) {
+			rec.fields[i] = binary.NativeEndian.Uint64(data[pos+i*8:])
+		}
+		rec.rawFields = data[pos : pos+numFields*8]
+		pos += numFields * 8
+	}
+	rec.labelKey = data[pos:]
+	if data[5] == protoInterned {
+		if length != pos+4 {
+			return errRecordLength
+		}
+		rec.interned = true
+		rec.id = binary.NativeEndian.Uint32(data[pos:])
+		return nil
+	}
+	if numLabels > protoMaxLabels {
+		return errRecordLabels
+	}
+	for range numLabels {
+		if pos+2 > length {
+			return errRecordLength
+		}
+		size := int(binary.NativeEndian.Uint16(data[pos:]))
+		pos += 2
+		if pos+size > length {
+			return errRecordLength
+		}
+		rec.labels = append(rec.labels, data[pos:pos+size])
+		pos += size
+	}
+	if pos != length {
+		return errRecordLength
+	}
+	return nil
+}
+
+// applyRecord updates the metric from a decoded binary record, intern requests are answered on w
+func applyRecord(rec *record, w io.Writer) error {
+	// aggregated deltas are kept apart from the per request series
+	if rec.metric == metricAggregate {
+		if aggregates == nil {
+			logErrorf("got aggregated request metrics but the aggregate backend is not enabled")
+			return nil
+		}
+		err := aggregates.add(rec)
+		if err != nil {
+			logErrorf("dropped aggregated request metrics: %s", err.Error())
+			countParseError()
+		}
+		return nil
+	}
+
+	var series *requestSeries
+	if rec.interned {
+		series = lookupSeriesByID(rec.id)
+		if series == nil {
+			// ids of evicted label sets are released, children request new ones once they notice
+			logDebugf("unknown label set id: %d", rec.id)
+			return nil
+		}
+	} else {
+		series = lookupSeries(rec)
+	}
+
+	if rec.metric == metricIntern {
+		var reply [4]byte
+		binary.NativeEndian.PutUint32(reply[:], internSeries(series))
+		_, err := w.Write(reply[:])
+		return err
+	}
+
+	metrics := series.get()
+	switch rec.metric {
+	case metricRequest:
+		metrics.requests.Inc()
+		metrics.observeTime(math.Float64frombits(rec.value))
+		metrics.size.Observe(float64(rec.fields[fieldResponseSize]))
+	case metricRequests:
+		metrics.requests.Add(float64(rec.value))
+	case metricResponseTime:
+		metrics.observeTime(math.Float64frombits(rec.value))
+	case metricResponseSize:
+		metrics.size.Observe(float64(rec.value))
+	default:
+		logErrorf("unknown metric id: %d", rec.metric)
+		countParseError()
+	}
+	return nil
+}
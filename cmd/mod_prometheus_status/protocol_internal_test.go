@@ -0,0 +1,244 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math"
+	"strings"
+	"sync"
+	"testing"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/common/expfmt"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+var testMetricsOnce sync.Once
+
+func initTestMetrics(tb testing.TB) {
+	tb.Helper()
+	testMetricsOnce.Do(func() {
+		initLogging(0)
+		scoreboardSampleRate = 100
+		err := registerMetrics("Apache/2.4", "localhost", "vhost;method;status", "event", "0.01;0.1;1;10", "1000;10000;100000", nil, false)
+		require.NoError(tb, err)
+	})
+}
+
+func encodeTestInternedRecord(metric byte, value uint64, id uint32, fields ...uint64) []byte {
+	buf := make([]byte, protoHeaderSize)
+	buf[0] = protoMagic
+	buf[1] = protoVersion
+	buf[4] = metric
+	buf[5] = protoInterned
+	binary.NativeEndian.PutUint64(buf[6:], value)
+	buf = appendTestFields(buf, metric, fields)
+	buf = binary.NativeEndian.AppendUint32(buf, id)
+	binary.NativeEndian.PutUint16(buf[2:], uint16(len(buf)))
+	return buf
+}
+
+func appendTestFields(buf []byte, metric byte, fields []uint64) []byte {
+	if metric != metricRequest && metric != metricAggregate {
+		return buf
+	}
+	buf = append(buf, byte(len(fields)))
+	for _, f := range fields {
+		buf = binary.NativeEndian.AppendUint64(buf, f)
+	}
+	return buf
+}
+
+func internTestLabels(tb testing.TB, labels ...string) uint32 {
+	tb.Helper()
+	var reply bytes.Buffer
+	_, err := processUpdates(bufio.NewReader(bytes.NewReader(encodeTestRecord(metricIntern, 0, nil, labels...))), &reply)
+	require.ErrorIs(tb, err, io.EOF)
+	require.Equal(tb, 4, reply.Len())
+	return binary.NativeEndian.Uint32(reply.Bytes())
+}
+
+func encodeTestRecord(metric byte, value uint64, fields []uint64, labels ...string) []byte {
+	buf := make([]byte, protoHeaderSize)
+	buf[0] = protoMagic
+	buf[1] = protoVersion
+	buf[4] = metric
+	buf[5] = byte(len(labels))
+	binary.NativeEndian.PutUint64(buf[6:], value)
+	buf = appendTestFields(buf, metric, fields)
+	for _, l := range labels {
+		buf = binary.NativeEndian.AppendUint16(buf, uint16(len(l)))
+		buf = append(buf, l...)
+	}
+	binary.NativeEndian.PutUint16(buf[2:], uint16(len(buf)))
+	return buf
+}
+
+func TestDecodeRecord(t *testing.T) {
+	t.Parallel()
+	data := encodeTestRecord(metricResponseTime, math.Float64bits(0.25), nil, "a;b", "GET\n", "")
+	rec := &record{}
+	require.NoError(t, decodeRecord(data, rec))
+	assert.Equal(t, byte(metricResponseTime), rec.metric)
+	assert.InDelta(t, 0.25, math.Float64frombits(rec.value), 0)
+	require.Len(t, rec.labels, 3)
+	assert.Equal(t, "a;b", string(rec.labels[0]))
+	assert.Equal(t, "GET\n", string(rec.labels[1]))
+	assert.Empty(t, rec.labels[2])
+
+	require.Error(t, decodeRecord(data[:len(data)-1], rec))
+	require.Error(t, decodeRecord(data[:protoHeaderSize-1], rec))
+
+	allocs := testing.AllocsPerRun(100, func() {
+		_ = decodeRecord(data, rec)
+	})
+	assert.Zero(t, allocs)
+}
+
+func TestProcessUpdatesMixed(t *testing.T) {
+	initTestMetrics(t)
+	var payload bytes.Buffer
+	payload.WriteString("request:promRequests;1;mixed;GET;200\n")
+	payload.Write(encodeTestRecord(metricRequests, 2, nil, "mixed", "GET", "200"))
+	payload.WriteString("metrics\n")
+
+	cmd, err := processUpdates(bufio.NewReaderSize(&payload, ReadBufferSize), io.Discard)
+	require.NoError(t, err)
+	assert.Equal(t, "metrics", cmd)
+	assert.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="200",vhost="mixed"} 3`)
+}
+
+func TestInternedRecords(t *testing.T) {
+	initTestMetrics(t)
+	id := internTestLabels(t, "interned", "POST", "201")
+	assert.Equal(t, id, internTestLabels(t, "interned", "POST", "201"))
+
+	var payload bytes.Buffer
+	payload.Write(encodeTestInternedRecord(metricRequests, 5, id))
+	payload.Write(encodeTestInternedRecord(metricRequests, 1, id+1000))
+	_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+	assert.Contains(t, string(metricsGet()), `apache_requests_total{method="POST",status="201",vhost="interned"} 5`)
+}
+
+func TestCombinedRecord(t *testing.T) {
+	initTestMetrics(t)
+	var payload bytes.Buffer
+	payload.Write(encodeTestRecord(metricRequest, math.Float64bits(0.5), []uint64{2048}, "combined", "GET", "200"))
+	// unknown additional fields are ignored
+	payload.Write(encodeTestRecord(metricRequest, math.Float64bits(0.5), []uint64{2048, 99}, "combined", "GET", "200"))
+	id := internTestLabels(t, "combined", "GET", "200")
+	payload.Write(encodeTestInternedRecord(metricRequest, math.Float64bits(0.5), id, 2048))
+	_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_requests_total{method="GET",status="200",vhost="combined"} 3`)
+	assert.Contains(t, metrics, `apache_response_time_seconds_sum{method="GET",status="200",vhost="combined"} 1.5`)
+	assert.Contains(t, metrics, `apache_response_size_bytes_sum{method="GET",status="200",vhost="combined"} 6144`)
+}
+
+func TestAggregateRecords(t *testing.T) {
+	col := newAggregateCollector([]string{"vhost", "method", "status"}, []float64{0.1, 1}, []float64{1000})
+	// requests, time sum (usec), size sum, time buckets, size buckets
+	fields := []uint64{3, 1_500_000, 4096, 1, 2, 0, 2, 1}
+	var payload bytes.Buffer
+	payload.Write(encodeTestRecord(metricAggregate, 0, fields, "aggregate", "GET", "200"))
+	payload.Write(encodeTestRecord(metricAggregate, 0, fields, "aggregate", "GET", "200"))
+	// records not matching the bucket layout are dropped
+	payload.Write(encodeTestRecord(metricAggregate, 0, fields[:4], "aggregate", "GET", "200"))
+
+	rec := &record{}
+	reader := bufio.NewReader(&payload)
+	for range 3 {
+		require.NoError(t, readRecord(reader, rec))
+		err := col.add(rec)
+		if len(rec.rawFields) != len(fields)*8 {
+			require.ErrorIs(t, err, errAggregateFields)
+		} else {
+			require.NoError(t, err)
+		}
+	}
+
+	reg := prometheus.NewRegistry()
+	reg.MustRegister(col)
+	families, err := reg.Gather()
+	require.NoError(t, err)
+	var text bytes.Buffer
+	for _, mf := range families {
+		_, err = expfmt.MetricFamilyToText(&text, mf)
+		require.NoError(t, err)
+	}
+	assert.Contains(t, text.String(), `apache_requests_total{method="GET",status="200",vhost="aggregate"} 6`)
+	assert.Contains(t, text.String(), `apache_response_time_seconds_bucket{method="GET",status="200",vhost="aggregate",le="1"} 6`)
+	assert.Contains(t, text.String(), `apache_response_time_seconds_sum{method="GET",status="200",vhost="aggregate"} 3`)
+	assert.Contains(t, text.String(), `apache_response_size_bytes_bucket{method="GET",status="200",vhost="aggregate",le="1000"} 4`)
+}
+
+func benchmarkIngest(b *testing.B, payload []byte, updates int) {
+	b.Helper()
+	initTestMetrics(b)
+	reader := bytes.NewReader(payload)
+	buf := bufio.NewReaderSize(reader, ReadBufferSize)
+	b.SetBytes(int64(len(payload)))
+	b.ReportAllocs()
+	b.ResetTimer()
+	for range b.N {
+		reader.Reset(payload)
+		buf.Reset(reader)
+		_, err := processUpdates(buf, io.Discard)
+		if !errors.Is(err, io.EOF) {
+			b.Fatal(err)
+		}
+	}
+	b.ReportMetric(float64(b.N*updates)/b.Elapsed().Seconds(), "updates/s")
+}
+
+func BenchmarkIngestText(b *testing.B) {
+	var payload strings.Builder
+	for i := range 100 {
+		label := fmt.Sprintf("vhost%d;GET;200", i%10)
+		fmt.Fprintf(&payload, "request:promRequests;1;%s\n", label)
+		fmt.Fprintf(&payload, "request:promResponseTime;%f;%s\n", 0.0123, label)
+		fmt.Fprintf(&payload, "request:promResponseSize;%d;%s\n", 4711, label)
+	}
+	benchmarkIngest(b, []byte(payload.String()), 300)
+}
+
+func BenchmarkIngestBinary(b *testing.B) {
+	var payload bytes.Buffer
+	for i := range 100 {
+		vhost := fmt.Sprintf("vhost%d", i%10)
+		payload.Write(encodeTestRecord(metricRequests, 1, nil, vhost, "GET", "200"))
+		payload.Write(encodeTestRecord(metricResponseTime, math.Float64bits(0.0123), nil, vhost, "GET", "200"))
+		payload.Write(encodeTestRecord(metricResponseSize, 4711, nil, vhost, "GET", "200"))
+	}
+	benchmarkIngest(b, payload.Bytes(), 300)
+}
+
+func BenchmarkIngestInterned(b *testing.B) {
+	initTestMetrics(b)
+	var payload bytes.Buffer
+	for i := range 100 {
+		id := internTestLabels(b, fmt.Sprintf("vhost%d", i%10), "GET", "200")
+		payload.Write(encodeTestInternedRecord(metricRequests, 1, id))
+		payload.Write(encodeTestInternedRecord(metricResponseTime, math.Float64bits(0.0123), id))
+		payload.Write(encodeTestInternedRecord(metricResponseSize, 4711, id))
+	}
+	benchmarkIngest(b, payload.Bytes(), 300)
+}
+
+func BenchmarkIngestCombined(b *testing.B) {
+	initTestMetrics(b)
+	var payload bytes.Buffer
+	for i := range 100 {
+		id := internTestLabels(b, fmt.Sprintf("vhost%d", i%10), "GET", "200")
+		payload.Write(encodeTestInternedRecord(metricRequest, math.Float64bits(0.0123), id, 4711))
+	}
+	benchmarkIngest(b, payload.Bytes(), 300)
+}
@@ -0,0 +1,106 @@
+package main
+
+import (
+	"sync"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+var (
+	// scoreboardSampleRate sets the scoreboard samples per second, 0 disables the sampler
+	scoreboardSampleRate int
+
+	// sampler integrates the worker states between scrapes, nil if disabled
+	sampler *scoreboardSampler
+)
+
+// scoreboardSampler reads the worker states in the background, so bursts between two scrapes are not missed
+type scoreboardSampler struct {
+	lock        sync.Mutex
+	last        time.Time                      // time of the last sample
+	counts      [len(scoreboardStates)]uint32  // worker states of the last sample
+	seconds     [len(scoreboardStates)]float64 // worker seconds per state since start
+	exported    [len(scoreboardStates)]float64 // worker seconds already added to the counters
+	window      [len(scoreboardStates)]float64 // worker seconds per state since the last scrape
+	max         [len(scoreboardStates)]uint32  // maximum workers per state since the last scrape
+	windowStart time.Time
+	samples     uint64
+	duration    time.Duration // time spent sampling since the last scrape
+}
+
+func newScoreboardSampler(now time.Time) *scoreboardSampler {
+	return &scoreboardSampler{last: now, windowStart: now}
+}
+
+// run samples the scoreboard at the given rate until the collector exits
+func (s *scoreboardSampler) run(sb *scoreboardReader, rate int) {
+	ticker := time.NewTicker(time.Second / time.Duration(rate))
+	defer ticker.Stop()
+	var counts [256]uint32
+	for range ticker.C {
+		start := time.Now()
+		clear(counts[:])
+		sb.countStates(&counts)
+		s.add(start, &counts, time.Since(start))
+	}
+}
+
+// add integrates the previous sample up to now and stores the new one
+func (s *scoreboardSampler) add(now time.Time, counts *[256]uint32, duration time.Duration) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	s.advance(now)
+	for status := range s.counts {
+		s.counts[status] = counts[status]
+		s.max[status] = max(s.max[status], counts[status])
+	}
+	s.samples++
+	s.duration += duration
+}
+
+// advance adds the worker seconds of the last sample up to now, states are assumed to last until the next sample
+func (s *scoreboardSampler) advance(now time.Time) {
+	elapsed := now.Sub(s.last).Seconds()
+	if elapsed <= 0 {
+		return
+	}
+	for status, count := range s.counts {
+		s.seconds[status] += float64(count) * elapsed
+		s.window[status] += float64(count) * elapsed
+	}
+	s.last = now
+}
+
+// export updates the sampler metrics and starts a new window for averages and maximums
+func (s *scoreboardSampler) export(now time.Time) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	s.advance(now)
+	windowLength := now.Sub(s.windowStart).Seconds()
+
+	promSeconds := collectors["promScoreboardSeconds"].(*prometheus.CounterVec)
+	promAverage := collectors["promScoreboardAverage"].(*prometheus.GaugeVec)
+	promMax := collectors["promScoreboardMax"].(*prometheus.GaugeVec)
+	for status, state := range scoreboardStates {
+		if state == "" {
+			continue
+		}
+		promSeconds.WithLabelValues(state).Add(s.seconds[status] - s.exported[status])
+		s.exported[status] = s.seconds[status]
+		if windowLength > 0 {
+			promAverage.WithLabelValues(state).Set(s.window[status] / windowLength)
+		}
+		promMax.WithLabelValues(state).Set(float64(s.max[status]))
+	}
+	collectors["promScoreboardSamples"].(prometheus.Counter).Add(float64(s.samples))
+	if s.samples > 0 {
+		collectors["promScoreboardSampleDuration"].(prometheus.Gauge).Set(s.duration.Seconds() / float64(s.samples))
+	}
+
+	s.windowStart = now
+	clear(s.window[:])
+	s.max = s.counts
+	s.samples = 0
+	s.duration = 0
+}
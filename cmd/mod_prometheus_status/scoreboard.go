@@ -0,0 +1,309 @@
+package main
+
+/*
+#include <httpd.h>
+#include <scoreboard.h>
+*/
+import "C"
+
+import (
+	"bytes"
+	"strconv"
+	"time"
+	"unsafe"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"golang.org/x/sys/unix"
+)
+
+// scoreboardStates contains the state label of each worker status, states without label are not exported
+var scoreboardStates = [C.SERVER_NUM_STATUS]string{
+	C.SERVER_READY:          "idle",
+	C.SERVER_STARTING:       "startup",
+	C.SERVER_BUSY_READ:      "read",
+	C.SERVER_BUSY_WRITE:     "reply",
+	C.SERVER_BUSY_KEEPALIVE: "keepalive",
+	C.SERVER_BUSY_LOG:       "logging",
+	C.SERVER_CLOSING:        "closing",
+	C.SERVER_GRACEFUL:       "graceful_stop",
+	C.SERVER_IDLE_KILL:      "idle_cleanup",
+}
+
+const (
+	connTotal = iota
+	connWriteCompletion
+	connKeepAlive
+	connLingeringClose
+	connSuspended
+)
+
+// connectionStates contains the state labels of the async connection counters of event mpm children
+var connectionStates = [...]string{
+	connTotal:           "total",
+	connWriteCompletion: "write_completion",
+	connKeepAlive:       "keep_alive",
+	connLingeringClose:  "lingering_close",
+	connSuspended:       "suspended",
+}
+
+const (
+	processAccepting = iota
+	processNotAccepting
+	processStopping
+)
+
+// processStates contains the state labels of the apache children
+var processStates = [...]string{
+	processAccepting:    "accepting",
+	processNotAccepting: "not_accepting",
+	processStopping:     "stopping",
+}
+
+var (
+	// workerScoreSize and workerStatusOffset describe the worker records of the scoreboard
+	workerScoreSize    = unsafe.Sizeof(C.worker_score{})
+	workerStatusOffset = unsafe.Offsetof(C.worker_score{}.status)
+
+	// scoreboard is the apache scoreboard shared with the parent, nil if not available
+	scoreboard *scoreboardReader
+
+	// configGeneration is the apache config generation this collector has been started for
+	configGeneration int
+)
+
+// scoreboardReader reads the worker and process records directly from the scoreboard shared memory.
+// The apache parent creates it before the collector is forked and keeps it mapped on restarts.
+type scoreboardReader struct {
+	image       *C.scoreboard
+	serverLimit int
+	threadLimit int
+}
+
+// scoreboardSample contains the result of a single pass over the scoreboard
+type scoreboardSample struct {
+	states      [C.SERVER_NUM_STATUS]int
+	ready       int
+	busy        int
+	processes   []scoreboardProcess
+	connections [len(connectionStates)]int
+	generations map[int]*[len(processStates)]int // children per generation and process state
+	vhosts      map[string]int                   // busy workers per vhost
+	ages        []uint64                         // requests in flight per age bucket, the last one is +Inf
+	oldest      []inflightRequest                // oldest requests in flight, the oldest first
+}
+
+func newScoreboardReader(image unsafe.Pointer) *scoreboardReader {
+	if image == nil {
+		return nil
+	}
+	sb := (*C.scoreboard)(image)
+	return &scoreboardReader{
+		image:       sb,
+		serverLimit: int(sb.global.server_limit),
+		threadLimit: int(sb.global.thread_limit),
+	}
+}
+
+// sample counts the worker states and collects the processes of the scoreboard
+func (sb *scoreboardReader) sample(s *scoreboardSample) {
+	clear(s.states[:])
+	s.ready = 0
+	s.busy = 0
+	s.processes = s.processes[:0]
+	clear(s.connections[:])
+	s.generations = make(map[int]*[len(processStates)]int)
+	s.vhosts = make(map[string]int)
+	s.ages = append(s.ages[:0], make([]uint64, len(inflightBuckets)+1)...)
+	s.oldest = s.oldest[:0]
+
+	now := time.Now()
+	var counts [256]uint32
+	generation := sb.image.global.running_generation
+	parents := unsafe.Slice(sb.image.parent, sb.serverLimit)
+	servers := unsafe.Slice(sb.image.servers, sb.serverLimit)
+	for i := range parents {
+		clear(counts[:])
+		countStatus(&counts, unsafe.Pointer(servers[i]), sb.threadLimit, workerScoreSize, workerStatusOffset)
+		for status := range s.states {
+			s.states[status] += int(counts[status])
+		}
+		ps := &parents[i]
+		active := ps.quiescing == 0 && ps.pid != 0
+		busy := 0
+		if active {
+			if ps.generation == generation {
+				s.ready += int(counts[C.SERVER_READY])
+			}
+			for status := range s.states {
+				if workerBusy(status) {
+					busy += int(counts[status])
+				}
+			}
+			s.busy += busy
+		}
+		if ps.pid == 0 {
+			continue
+		}
+		// the worker records are only read in detail if the counts show anything to find there
+		inflight := counts[C.SERVER_BUSY_WRITE] + counts[C.SERVER_BUSY_LOG] + counts[C.SERVER_BUSY_DNS]
+		if busy > 0 || inflight > 0 {
+			s.inspectWorkers(unsafe.Slice(servers[i], sb.threadLimit), i, int(ps.pid), active, now)
+		}
+		// the collector reads the process statistics of the children directly by pid
+		s.processes = append(s.processes, scoreboardProcess{pid: int(ps.pid), generation: int(ps.generation)})
+
+		// only async mpms update the connection counters, they are zero otherwise
+		s.connections[connTotal] += int(ps.connections)
+		s.connections[connWriteCompletion] += int(ps.write_completion)
+		s.connections[connKeepAlive] += int(ps.keep_alive)
+		s.connections[connLingeringClose] += int(ps.lingering_close)
+		s.connections[connSuspended] += int(ps.suspended)
+
+		gen, ok := s.generations[int(ps.generation)]
+		if !ok {
+			gen = &[len(processStates)]int{}
+			s.generations[int(ps.generation)] = gen
+		}
+		switch {
+		case ps.quiescing != 0:
+			gen[processStopping]++
+		case ps.not_accepting != 0:
+			gen[processNotAccepting]++
+		default:
+			gen[processAccepting]++
+		}
+	}
+}
+
+// inspectWorkers counts the busy workers per vhost and the ages of the requests in flight of a single process.
+// Vhost, request line and start time are only maintained with ExtendedStatus enabled.
+func (s *scoreboardSample) inspectWorkers(workers []C.worker_score, slot, pid int, active bool, now time.Time) {
+	for thread := range workers {
+		ws := &workers[thread]
+		status := int(ws.status)
+		if active && workerBusy(status) {
+			s.vhosts[cString(ws.vhost[:])]++
+		}
+		switch status {
+		case C.SERVER_BUSY_WRITE, C.SERVER_BUSY_LOG, C.SERVER_BUSY_DNS:
+		default:
+			continue
+		}
+		started := ws.start_time
+		if started <= 0 {
+			started = ws.last_used
+		}
+		if started <= 0 {
+			continue
+		}
+		age := max(now.Sub(time.UnixMicro(int64(started))).Seconds(), 0)
+		s.ages[inflightBucket(age)]++
+		if len(s.oldest) < InflightTopK || age > s.oldest[len(s.oldest)-1].age {
+			s.oldest = addOldest(s.oldest, inflightRequest{
+				age:     age,
+				pid:     pid,
+				slot:    slot,
+				thread:  thread,
+				vhost:   cString(ws.vhost[:]),
+				request: cString(ws.request[:]),
+			})
+		}
+	}
+}
+
+// workerBusy returns true for worker states counted as busy, the same as mod_status does
+func workerBusy(status int) bool {
+	switch status {
+	case C.SERVER_DEAD, C.SERVER_STARTING, C.SERVER_READY, C.SERVER_IDLE_KILL:
+		return false
+	}
+	return status < C.SERVER_NUM_STATUS
+}
+
+// cString returns the NUL terminated string of a fixed size scoreboard field, which is not terminated if filled up
+func cString(chars []C.char) string {
+	b := unsafe.Slice((*byte)(unsafe.Pointer(unsafe.SliceData(chars))), len(chars))
+	if end := bytes.IndexByte(b, 0); end >= 0 {
+		b = b[:end]
+	}
+	return string(b)
+}
+
+// countStates adds the number of workers per status of the whole scoreboard to counts
+func (sb *scoreboardReader) countStates(counts *[256]uint32) {
+	servers := unsafe.Slice(sb.image.servers, sb.serverLimit)
+	for _, workers := range servers {
+		countStatus(counts, unsafe.Pointer(workers), sb.threadLimit, workerScoreSize, workerStatusOffset)
+	}
+}
+
+// countStatus adds the status byte of num records of size stride starting at base to counts.
+// Indexing a 256 entries array with a byte needs neither bounds checks nor branches.
+func countStatus(counts *[256]uint32, base unsafe.Pointer, num int, stride, offset uintptr) {
+	for i := range uintptr(num) {
+		counts[*(*uint8)(unsafe.Add(base, offset+i*stride))]++
+	}
+}
+
+// updateScoreboardMetrics updates the server and worker metrics from the scoreboard
+func updateScoreboardMetrics() {
+	if scoreboard == nil {
+		return
+	}
+	var s scoreboardSample
+	scoreboard.sample(&s)
+
+	global := scoreboard.image.global
+	uptime := time.Since(time.UnixMicro(int64(global.restart_time)))
+	collectors["promServerUptime"].(prometheus.Gauge).Set(float64(uptime / time.Second))
+	collectors["promMPMGeneration"].(prometheus.Gauge).Set(float64(global.running_generation))
+	collectors["promConfigGeneration"].(prometheus.Gauge).Set(float64(configGeneration))
+
+	// same as getloadavg(), the kernel reports the load as fixed point number with 16 bits fraction
+	var info unix.Sysinfo_t
+	if unix.Sysinfo(&info) == nil {
+		collectors["promCPULoad"].(prometheus.Gauge).Set(float64(info.Loads[0]) / 65536)
+	}
+
+	promScoreboard := collectors["promScoreboard"].(*prometheus.GaugeVec)
+	for status, state := range scoreboardStates {
+		if state != "" {
+			promScoreboard.WithLabelValues(state).Set(float64(s.states[status]))
+		}
+	}
+	promWorkers := collectors["promWorkers"].(*prometheus.GaugeVec)
+	promWorkers.WithLabelValues("ready").Set(float64(s.ready))
+	promWorkers.WithLabelValues("busy").Set(float64(s.busy))
+
+	scoreboardProcesses.set(s.processes)
+
+	// generations without children disappear
+	promProcesses := collectors["promProcesses"].(*prometheus.GaugeVec)
+	promProcesses.Reset()
+	for generation, gen := range s.generations {
+		for i, state := range processStates {
+			promProcesses.WithLabelValues(strconv.Itoa(generation), state).Set(float64(gen[i]))
+		}
+	}
+	if promAsyncConnections, ok := collectors["promAsyncConnections"].(*prometheus.GaugeVec); ok {
+		for i, state := range connectionStates {
+			promAsyncConnections.WithLabelValues(state).Set(float64(s.connections[i]))
+		}
+	}
+
+	// vhosts without busy workers disappear
+	promVhostBusy := collectors["promVhostBusy"].(*prometheus.GaugeVec)
+	promVhostBusy.Reset()
+	for vhost, busy := range s.vhosts {
+		promVhostBusy.WithLabelValues(vhost).Set(float64(busy))
+	}
+	oldest := 0.0
+	if len(s.oldest) > 0 {
+		oldest = s.oldest[0].age
+	}
+	setInflightRequests(s.ages, oldest)
+
+	if sampler != nil {
+		sampler.export(time.Now())
+	}
+}
@@ -0,0 +1,89 @@
+//go:build scoreboardfake
+
+package main
+
+/*
+#include <httpd.h>
+#include <scoreboard.h>
+*/
+import "C"
+
+import (
+	"time"
+	"unsafe"
+)
+
+// fakeScoreboard is a scoreboard in go memory for the internal tests, which cannot use cgo themselves.
+// It is only built with the scoreboardfake tag, so it does not end up in the module.
+type fakeScoreboard struct {
+	image   C.scoreboard
+	global  C.global_score
+	parents []C.process_score
+	servers []*C.worker_score
+	workers [][]C.worker_score
+}
+
+// newFakeScoreboard returns an empty scoreboard running the given mpm generation
+func newFakeScoreboard(serverLimit, threadLimit, generation int) *fakeScoreboard {
+	f := &fakeScoreboard{
+		parents: make([]C.process_score, serverLimit),
+		servers: make([]*C.worker_score, serverLimit),
+		workers: make([][]C.worker_score, serverLimit),
+	}
+	f.global.server_limit = C.int(serverLimit)
+	f.global.thread_limit = C.int(threadLimit)
+	f.global.running_generation = C.ap_generation_t(generation)
+	f.global.restart_time = C.apr_time_t(time.Now().UnixMicro())
+	for i := range f.workers {
+		f.workers[i] = make([]C.worker_score, threadLimit)
+		f.servers[i] = &f.workers[i][0]
+	}
+	f.image.global = &f.global
+	f.image.parent = &f.parents[0]
+	f.image.servers = &f.servers[0]
+	return f
+}
+
+// reader returns a scoreboard reader for the fake scoreboard
+func (f *fakeScoreboard) reader() *scoreboardReader {
+	return newScoreboardReader(unsafe.Pointer(&f.image))
+}
+
+// setProcess sets the child of a slot, state is one of processStates
+func (f *fakeScoreboard) setProcess(slot, pid, generation, state int) {
+	ps := &f.parents[slot]
+	ps.pid = C.pid_t(pid)
+	ps.generation = C.ap_generation_t(generation)
+	ps.quiescing = 0
+	ps.not_accepting = 0
+	switch state {
+	case processStopping:
+		ps.quiescing = 1
+	case processNotAccepting:
+		ps.not_accepting = 1
+	}
+}
+
+// setConnections sets the async connection counters of the child of a slot
+func (f *fakeScoreboard) setConnections(slot int, total, writeCompletion, keepAlive, lingeringClose, suspended uint32) {
+	ps := &f.parents[slot]
+	ps.connections = C.apr_uint32_t(total)
+	ps.write_completion = C.apr_uint32_t(writeCompletion)
+	ps.keep_alive = C.apr_uint32_t(keepAlive)
+	ps.lingering_close = C.apr_uint32_t(lingeringClose)
+	ps.suspended = C.apr_uint32_t(suspended)
+}
+
+// setWorker sets the status of a worker and the vhost and age of its request, requests without age have no start time
+func (f *fakeScoreboard) setWorker(slot, thread, status int, vhost string, age time.Duration) {
+	ws := &f.workers[slot][thread]
+	ws.status = C.uchar(status)
+	clear(ws.vhost[:])
+	for i := 0; i < len(vhost) && i < len(ws.vhost)-1; i++ {
+		ws.vhost[i] = C.char(vhost[i])
+	}
+	ws.start_time = 0
+	if age > 0 {
+		ws.start_time = C.apr_time_t(time.Now().Add(-age).UnixMicro())
+	}
+}
@@ -0,0 +1,84 @@
+//go:build scoreboardfake
+
+package main
+
+import (
+	"testing"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/stretchr/testify/assert"
+)
+
+// further scoreboard status values of the workers
+const (
+	statusBusyWrite     = 4
+	statusBusyKeepalive = 5
+	statusGraceful      = 9
+)
+
+func TestScoreboardMetrics(t *testing.T) {
+	initTestMetrics(t)
+	fake := newFakeScoreboard(5, 4, 2)
+	// current generation, accepting
+	fake.setProcess(0, 100, 2, processAccepting)
+	fake.setConnections(0, 5, 1, 2, 1, 0)
+	fake.setWorker(0, 0, statusReady, "", 0)
+	fake.setWorker(0, 1, statusReady, "", 0)
+	fake.setWorker(0, 2, statusBusyRead, "a.example", 0)
+	fake.setWorker(0, 3, statusBusyWrite, "a.example", 2*time.Second)
+	// current generation, not accepting
+	fake.setProcess(1, 101, 2, processNotAccepting)
+	fake.setConnections(1, 3, 0, 3, 0, 0)
+	fake.setWorker(1, 0, statusBusyKeepalive, "b.example", 0)
+	fake.setWorker(1, 1, statusReady, "", 0)
+	// previous generation still accepting, its idle workers are not ready for the current one
+	fake.setProcess(2, 90, 1, processAccepting)
+	fake.setWorker(2, 0, statusReady, "", 0)
+	fake.setWorker(2, 1, statusBusyRead, "a.example", 0)
+	// previous generation stopping, its workers are neither ready nor busy
+	fake.setProcess(3, 91, 1, processStopping)
+	fake.setWorker(3, 0, statusReady, "", 0)
+	fake.setWorker(3, 1, statusBusyRead, "a.example", 0)
+	fake.setWorker(3, 2, statusGraceful, "", 0)
+	// slot without child
+	fake.setWorker(4, 0, statusReady, "", 0)
+
+	scoreboard = fake.reader()
+	defer func() { scoreboard = nil }()
+	updateScoreboardMetrics()
+
+	workers := collectors["promWorkers"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 3, testutil.ToFloat64(workers.WithLabelValues("ready")), 0)
+	assert.InDelta(t, 4, testutil.ToFloat64(workers.WithLabelValues("busy")), 0)
+
+	states := collectors["promScoreboard"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 6, testutil.ToFloat64(states.WithLabelValues("idle")), 0)
+	assert.InDelta(t, 3, testutil.ToFloat64(states.WithLabelValues("read")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(states.WithLabelValues("graceful_stop")), 0)
+
+	processes := collectors["promProcesses"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 1, testutil.ToFloat64(processes.WithLabelValues("2", "accepting")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(processes.WithLabelValues("2", "not_accepting")), 0)
+	assert.InDelta(t, 0, testutil.ToFloat64(processes.WithLabelValues("2", "stopping")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(processes.WithLabelValues("1", "accepting")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(processes.WithLabelValues("1", "stopping")), 0)
+
+	connections := collectors["promAsyncConnections"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 8, testutil.ToFloat64(connections.WithLabelValues("total")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(connections.WithLabelValues("write_completion")), 0)
+	assert.InDelta(t, 5, testutil.ToFloat64(connections.WithLabelValues("keep_alive")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(connections.WithLabelValues("lingering_close")), 0)
+	assert.InDelta(t, 0, testutil.ToFloat64(connections.WithLabelValues("suspended")), 0)
+
+	// busy workers of stopping children do not count for their vhost
+	vhosts := collectors["promVhostBusy"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 3, testutil.ToFloat64(vhosts.WithLabelValues("a.example")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(vhosts.WithLabelValues("b.example")), 0)
+
+	inflight := collectors["promInflightRequests"].(*prometheus.GaugeVec)
+	assert.InDelta(t, 0, testutil.ToFloat64(inflight.WithLabelValues("1")), 0)
+	assert.InDelta(t, 1, testutil.ToFloat64(inflight.WithLabelValues("+Inf")), 0)
+	assert.InDelta(t, 2, testutil.ToFloat64(collectors["promInflightOldest"].(prometheus.Gauge)), 0.5)
+}
@@ -0,0 +1,80 @@
+package main
+
+import (
+	"fmt"
+	"testing"
+	"time"
+	"unsafe"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/stretchr/testify/assert"
+)
+
+// statusReady and statusBusyRead are the scoreboard status values of ready and reading workers
+const (
+	statusReady    = 2
+	statusBusyRead = 3
+)
+
+func TestCountStatus(t *testing.T) {
+	t.Parallel()
+	const stride, offset = 16, 3
+	records := make([]byte, 10*stride)
+	for i, status := range []byte{2, 2, 3, 0, 5, 2, 10, 3, 2, 0} {
+		records[i*stride+offset] = status
+	}
+	var counts [256]uint32
+	countStatus(&counts, unsafe.Pointer(&records[0]), 10, stride, offset)
+	assert.Equal(t, uint32(4), counts[statusReady])
+	assert.Equal(t, uint32(2), counts[statusBusyRead])
+	assert.Equal(t, uint32(2), counts[0])
+	assert.Equal(t, uint32(1), counts[10])
+}
+
+func TestScoreboardSampler(t *testing.T) {
+	initTestMetrics(t)
+	idleSeconds := collectors["promScoreboardSeconds"].(*prometheus.CounterVec).WithLabelValues("idle")
+	before := testutil.ToFloat64(idleSeconds)
+
+	start := time.Now()
+	s := newScoreboardSampler(start)
+	var counts [256]uint32
+	counts[statusReady] = 4
+	counts[statusBusyRead] = 2
+	s.add(start.Add(time.Second), &counts, time.Microsecond)
+	counts[statusReady] = 1
+	counts[statusBusyRead] = 6
+	s.add(start.Add(2*time.Second), &counts, time.Microsecond)
+	s.export(start.Add(3 * time.Second))
+
+	// 4 idle workers for one second and one for another second within three seconds
+	assert.InDelta(t, 5, testutil.ToFloat64(idleSeconds)-before, 1e-9)
+	assert.InDelta(t, 5.0/3, testutil.ToFloat64(collectors["promScoreboardAverage"].(*prometheus.GaugeVec).WithLabelValues("idle")), 1e-9)
+	assert.InDelta(t, 8.0/3, testutil.ToFloat64(collectors["promScoreboardAverage"].(*prometheus.GaugeVec).WithLabelValues("read")), 1e-9)
+	assert.InDelta(t, 6, testutil.ToFloat64(collectors["promScoreboardMax"].(*prometheus.GaugeVec).WithLabelValues("read")), 0)
+
+	// the next window starts with the current states
+	s.export(start.Add(4 * time.Second))
+	assert.InDelta(t, 1, testutil.ToFloat64(collectors["promScoreboardAverage"].(*prometheus.GaugeVec).WithLabelValues("idle")), 1e-9)
+	assert.InDelta(t, 6, testutil.ToFloat64(collectors["promScoreboardMax"].(*prometheus.GaugeVec).WithLabelValues("read")), 0)
+}
+
+// BenchmarkCountStatus measures a single sample of event mpm sized scoreboards
+func BenchmarkCountStatus(b *testing.B) {
+	for _, slots := range []int{1024, 16384, 65536} {
+		b.Run(fmt.Sprintf("slots-%d", slots), func(b *testing.B) {
+			records := make([]byte, slots*int(workerScoreSize))
+			for i := range slots {
+				records[i*int(workerScoreSize)+int(workerStatusOffset)] = byte(i % 11)
+			}
+			var counts [256]uint32
+			b.ResetTimer()
+			for range b.N {
+				clear(counts[:])
+				countStatus(&counts, unsafe.Pointer(&records[0]), slots, workerScoreSize, workerStatusOffset)
+			}
+			b.ReportMetric(float64(b.Elapsed().Nanoseconds())/float64(b.N)/float64(slots), "ns/slot")
+		})
+	}
+}
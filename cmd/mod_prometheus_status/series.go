@@ -0,0 +1,368 @@
+package main
+
+import (
+	"encoding/binary"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+const (
+	// overflowLabel replaces all label values of new label sets once the series limit is reached
+	overflowLabel = "__overflow__"
+
+	// minFoldedSeries is the minimum number of label sets remembered as folded into the overflow series
+	minFoldedSeries = 1000
+
+	// internedSlotBits is the number of low bits of an interned label set id which index seriesList,
+	// the remaining bits count how often the slot has been reused
+	internedSlotBits = 24
+	internedSlotMask = 1<<internedSlotBits - 1
+)
+
+var (
+	// seriesLimit is the maximum number of request label sets, 0 disables the limit
+	seriesLimit int
+
+	// seriesTTL is the time after which request label sets without updates are removed, 0 disables eviction
+	seriesTTL time.Duration
+
+	// seriesClock is a coarse unix timestamp maintained by the evictor, so updates do not have to read the clock
+	seriesClock atomic.Int64
+)
+
+// requestSeries contains the label bound request metrics for one label set
+type requestSeries struct {
+	id         uint32
+	interned   bool     // id has been assigned and not released yet, protected by seriesCacheLock
+	labels     []string // normalized label values
+	keys       []string // cache keys referencing this series, protected by seriesCacheLock
+	lastUpdate atomic.Int64
+	metrics    atomic.Pointer[seriesMetrics] // nil once the series has been evicted
+}
+
+type seriesMetrics struct {
+	requests prometheus.Counter
+	time     prometheus.Observer
+	size     prometheus.Observer
+	sketch   *windowedSketch // response time quantiles, nil unless enabled
+}
+
+// observeTime records a response time in the histogram and the quantile sketch
+func (m *seriesMetrics) observeTime(seconds float64) {
+	m.time.Observe(seconds)
+	if m.sketch != nil {
+		quantiles.observe(m.sketch, seconds)
+	}
+}
+
+var (
+	seriesCache     = make(map[string]*requestSeries)
+	seriesCacheLock sync.RWMutex
+	seriesLive      int            // number of series in seriesCache, without the overflow series
+	seriesOverflow  *requestSeries // created once the series limit is reached
+
+	// label sets folded into the overflow series, so further updates neither take the write lock nor count as drop again
+	seriesFoldedKeys   []string         // cache keys mapped to the overflow series
+	seriesFoldedSeries []*requestSeries // evicted interned series using the overflow metrics
+
+	// seriesList contains the interned series indexed by the slot of their id. It is
+	// replaced on inserts, so readers do not need any locks. The ids of evicted
+	// series are released and their slots reused with the next generation, so
+	// stale ids of the children do not resolve anymore.
+	seriesList atomic.Pointer[[]*atomic.Pointer[internedID]]
+
+	// seriesFreeIDs contains released ids whose slots can be reused, protected by seriesCacheLock
+	seriesFreeIDs []uint32
+)
+
+// internedID binds an interned label set id to its series, the slot is cleared once the id is released
+type internedID struct {
+	id     uint32
+	series *requestSeries
+}
+
+// get returns the metrics of the series, evicted series are restored on updates
+func (s *requestSeries) get() *seriesMetrics {
+	now := seriesClock.Load()
+	// avoid writing the shared cache line on every update
+	if s.lastUpdate.Load() != now {
+		s.lastUpdate.Store(now)
+	}
+	if metrics := s.metrics.Load(); metrics != nil {
+		return metrics
+	}
+	return restoreSeries(s)
+}
+
+// lookupSeriesByID returns the series for an interned label set id or nil if the id is unknown or has been released
+func lookupSeriesByID(id uint32) *requestSeries {
+	list := seriesList.Load()
+	slot := int(id & internedSlotMask)
+	if list == nil || slot >= len(*list) {
+		return nil
+	}
+	entry := (*list)[slot].Load()
+	if entry == nil || entry.id != id {
+		return nil
+	}
+	return entry.series
+}
+
+// lookupSeries returns the cached request metrics for the records label set
+func lookupSeries(rec *record) *requestSeries {
+	// map lookups with converted byte slices do not allocate
+	seriesCacheLock.RLock()
+	series, ok := seriesCache[string(rec.labelKey)]
+	seriesCacheLock.RUnlock()
+	if ok {
+		return series
+	}
+
+	labels := make([]string, len(rec.labels))
+	for i, l := range rec.labels {
+		labels[i] = string(l)
+	}
+	return addSeries(string(rec.labelKey), normalizeLabels(labels))
+}
+
+// lookupSeriesByLabels returns the request metrics for normalized label values
+func lookupSeriesByLabels(labels []string) *requestSeries {
+	key := encodeLabelKey(labels)
+	seriesCacheLock.RLock()
+	series, ok := seriesCache[key]
+	seriesCacheLock.RUnlock()
+	if ok {
+		return series
+	}
+	return addSeries(key, labels)
+}
+
+// addSeries creates the series for a new cache key. Label sets beyond the series limit are folded into the overflow series.
+func addSeries(key string, labels []string) *requestSeries {
+	labelKey := encodeLabelKey(labels)
+
+	seriesCacheLock.Lock()
+	defer seriesCacheLock.Unlock()
+	if existing, ok := seriesCache[key]; ok {
+		return existing
+	}
+	// the same label set might be sent with a different number of labels
+	if existing, ok := seriesCache[labelKey]; ok {
+		existing.keys = append(existing.keys, key)
+		seriesCache[key] = existing
+		return existing
+	}
+	if seriesLimit > 0 && seriesLive >= seriesLimit {
+		foldSeries()
+		seriesCache[key] = seriesOverflow
+		seriesFoldedKeys = append(seriesFoldedKeys, key)
+		if labelKey != key {
+			seriesCache[labelKey] = seriesOverflow
+			seriesFoldedKeys = append(seriesFoldedKeys, labelKey)
+		}
+		return seriesOverflow
+	}
+
+	series := &requestSeries{labels: labels, keys: []string{key}}
+	if labelKey != key {
+		series.keys = append(series.keys, labelKey)
+	}
+	series.lastUpdate.Store(seriesClock.Load())
+	series.metrics.Store(newSeriesMetrics(labels))
+	for _, k := range series.keys {
+		seriesCache[k] = series
+	}
+	seriesLive++
+	return series
+}
+
+// foldSeries counts a label set folded into the overflow series and creates the overflow series on first use.
+// Folded label sets are forgotten once there are as many as the series limit, so they cannot grow without bounds either.
+// Caller must hold seriesCacheLock.
+func foldSeries() {
+	if seriesOverflow == nil {
+		labels := make([]string, labelCount)
+		for i := range labels {
+			labels[i] = overflowLabel
+		}
+		seriesOverflow = &requestSeries{labels: labels}
+		seriesOverflow.metrics.Store(newSeriesMetrics(labels))
+	}
+	if len(seriesFoldedKeys)+len(seriesFoldedSeries) >= max(seriesLimit, minFoldedSeries) {
+		unfoldSeries()
+	}
+	collectors["promSeriesDropped"].(prometheus.Counter).Inc()
+}
+
+// unfoldSeries forgets all folded label sets, so they get their own series again if there is room. Caller must hold seriesCacheLock.
+func unfoldSeries() {
+	for _, k := range seriesFoldedKeys {
+		delete(seriesCache, k)
+	}
+	for _, series := range seriesFoldedSeries {
+		series.metrics.Store(nil)
+	}
+	seriesFoldedKeys = nil
+	seriesFoldedSeries = nil
+}
+
+// restoreSeries recreates the metrics of an evicted series which is still updated by a lookup racing with the eviction
+func restoreSeries(series *requestSeries) *seriesMetrics {
+	seriesCacheLock.Lock()
+	defer seriesCacheLock.Unlock()
+	if metrics := series.metrics.Load(); metrics != nil {
+		return metrics
+	}
+	// the label set might have been added again meanwhile. The evicted series is neither cached nor interned anymore,
+	// so it is only updated until the racing lookups are done, but those must not take the lock again.
+	for _, k := range series.keys {
+		if existing, ok := seriesCache[k]; ok {
+			metrics := existing.metrics.Load()
+			series.metrics.Store(metrics)
+			if existing == seriesOverflow {
+				seriesFoldedSeries = append(seriesFoldedSeries, series)
+			}
+			return metrics
+		}
+	}
+	if seriesLimit > 0 && seriesLive >= seriesLimit {
+		foldSeries()
+		metrics := seriesOverflow.metrics.Load()
+		series.metrics.Store(metrics)
+		seriesFoldedSeries = append(seriesFoldedSeries, series)
+		return metrics
+	}
+	metrics := newSeriesMetrics(series.labels)
+	series.metrics.Store(metrics)
+	for _, k := range series.keys {
+		seriesCache[k] = series
+	}
+	seriesLive++
+	return metrics
+}
+
+// internSeries returns the id of the series, the id is assigned on first use. Released ids are reused first.
+func internSeries(series *requestSeries) uint32 {
+	seriesCacheLock.Lock()
+	defer seriesCacheLock.Unlock()
+	if series.interned {
+		return series.id
+	}
+	var list []*atomic.Pointer[internedID]
+	if current := seriesList.Load(); current != nil {
+		list = *current
+	}
+	var id uint32
+	if n := len(seriesFreeIDs); n > 0 {
+		// the next generation of the slot, so the released id does not match anymore
+		id = seriesFreeIDs[n-1] + 1<<internedSlotBits
+		seriesFreeIDs = seriesFreeIDs[:n-1]
+	} else {
+		id = uint32(len(list))
+		list = append(list, &atomic.Pointer[internedID]{})
+		seriesList.Store(&list)
+	}
+	list[id&internedSlotMask].Store(&internedID{id: id, series: series})
+	series.id = id
+	series.interned = true
+	return id
+}
+
+// releaseSeriesID releases the interned id of an evicted series, so its slot can be reused. Caller must hold seriesCacheLock.
+func releaseSeriesID(series *requestSeries) {
+	(*seriesList.Load())[series.id&internedSlotMask].Store(nil)
+	seriesFreeIDs = append(seriesFreeIDs, series.id)
+	series.interned = false
+}
+
+// evictSeries removes all series which have not been updated since cutoff, returns the number of evicted series
+func evictSeries(cutoff int64) int {
+	seriesCacheLock.Lock()
+	defer seriesCacheLock.Unlock()
+	evicted := 0
+	released := false
+	for _, series := range seriesCache {
+		if series == seriesOverflow || series.lastUpdate.Load() >= cutoff || series.metrics.Load() == nil {
+			continue
+		}
+		// updates racing with the eviction might get lost, but the series has been idle for a whole ttl
+		collectors["promRequests"].(*prometheus.CounterVec).DeleteLabelValues(series.labels...)
+		collectors["promResponseTime"].(*prometheus.HistogramVec).DeleteLabelValues(series.labels...)
+		collectors["promResponseSize"].(*prometheus.HistogramVec).DeleteLabelValues(series.labels...)
+		if quantiles != nil {
+			quantiles.remove(series.labels)
+		}
+		series.metrics.Store(nil)
+		for _, k := range series.keys {
+			delete(seriesCache, k)
+		}
+		if series.interned {
+			releaseSeriesID(series)
+			released = true
+		}
+		seriesLive--
+		evicted++
+	}
+	// folded label sets may get their own series now
+	if evicted > 0 {
+		unfoldSeries()
+	}
+	// updates by released ids are dropped until the children requested new ones
+	if released {
+		invalidateInternedIDs()
+	}
+	return evicted
+}
+
+// seriesEvictor maintains the series clock and removes idle request label sets
+func seriesEvictor(ttl time.Duration) {
+	interval := min(max(ttl/4, time.Second), time.Minute)
+	lastEvict := time.Now()
+	for now := range time.Tick(time.Second) {
+		seriesClock.Store(now.Unix())
+		if now.Sub(lastEvict) < interval {
+			continue
+		}
+		lastEvict = now
+		cutoff := now.Add(-ttl).Unix()
+		evicted := 0
+		if aggregates != nil {
+			evicted += aggregates.evict(cutoff)
+		} else if collectors["promRequests"] != nil {
+			evicted += evictSeries(cutoff)
+		}
+		if evicted > 0 {
+			collectors["promSeriesEvicted"].(prometheus.Counter).Add(float64(evicted))
+			logDebugf("evicted %d idle request label sets", evicted)
+		}
+	}
+}
+
+// encodeLabelKey encodes label values like binary records do
+func encodeLabelKey(labels []string) string {
+	size := 0
+	for _, l := range labels {
+		size += 2 + len(l)
+	}
+	buf := make([]byte, 0, size)
+	for _, l := range labels {
+		buf = binary.NativeEndian.AppendUint16(buf, uint16(len(l)))
+		buf = append(buf, l...)
+	}
+	return string(buf)
+}
+
+func newSeriesMetrics(labels []string) *seriesMetrics {
+	metrics := &seriesMetrics{
+		requests: collectors["promRequests"].(*prometheus.CounterVec).WithLabelValues(labels...),
+		time:     collectors["promResponseTime"].(*prometheus.HistogramVec).WithLabelValues(labels...),
+		size:     collectors["promResponseSize"].(*prometheus.HistogramVec).WithLabelValues(labels...),
+	}
+	if quantiles != nil {
+		metrics.sketch = quantiles.sketch(labels)
+	}
+	return metrics
+}
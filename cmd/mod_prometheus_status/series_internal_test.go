@@ -0,0 +1,119 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"io"
+	"testing"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/testutil"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestSeriesLimit(t *testing.T) {
+	initTestMetrics(t)
+	seriesCacheLock.RLock()
+	seriesLimit = seriesLive + 1
+	seriesCacheLock.RUnlock()
+	defer func() { seriesLimit = 0 }()
+
+	dropped := testutil.ToFloat64(collectors["promSeriesDropped"].(prometheus.Counter))
+
+	// each label set is sent twice, but only dropped once
+	var payload bytes.Buffer
+	for range 2 {
+		payload.Write(encodeTestRecord(metricRequests, 1, nil, "limited", "GET", "200"))
+		payload.Write(encodeTestRecord(metricRequests, 2, nil, "limited", "GET", "404"))
+		payload.WriteString("request:promRequests;3;limited;GET;500\n")
+	}
+	_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_requests_total{method="GET",status="200",vhost="limited"} 2`)
+	assert.NotContains(t, metrics, `status="404"`)
+	assert.Contains(t, metrics, `apache_requests_total{method="__overflow__",status="__overflow__",vhost="__overflow__"} 10`)
+	assert.InDelta(t, dropped+2, testutil.ToFloat64(collectors["promSeriesDropped"].(prometheus.Counter)), 0)
+
+	// folded label sets are served from the cache
+	seriesCacheLock.RLock()
+	assert.Same(t, seriesOverflow, seriesCache[encodeLabelKey([]string{"limited", "GET", "404"})])
+	seriesCacheLock.RUnlock()
+
+	// interned overflow label sets are folded as well
+	id := internTestLabels(t, "limited", "POST", "200")
+	assert.Equal(t, id, internTestLabels(t, "limited", "PUT", "200"))
+}
+
+func TestSeriesEviction(t *testing.T) {
+	initTestMetrics(t)
+	id := internTestLabels(t, "evicted", "GET", "200")
+	var payload bytes.Buffer
+	payload.Write(encodeTestInternedRecord(metricRequests, 7, id))
+	_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+	require.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="200",vhost="evicted"} 7`)
+
+	seriesClock.Add(10)
+	defer seriesClock.Add(-10)
+	assert.Positive(t, evictSeries(seriesClock.Load()))
+	assert.NotContains(t, string(metricsGet()), `vhost="evicted"`)
+
+	// the id has been released, updates by it are dropped until the children interned the label set again
+	assert.Nil(t, lookupSeriesByID(id))
+	payload.Write(encodeTestInternedRecord(metricRequests, 1, id))
+	_, err = processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+	assert.NotContains(t, string(metricsGet()), `vhost="evicted"`)
+
+	renewed := internTestLabels(t, "evicted", "GET", "200")
+	assert.NotEqual(t, id, renewed)
+	payload.Write(encodeTestInternedRecord(metricRequests, 1, renewed))
+	_, err = processUpdates(bufio.NewReader(&payload), io.Discard)
+	require.ErrorIs(t, err, io.EOF)
+	assert.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="200",vhost="evicted"} 1`)
+}
+
+func TestSeriesInternedIDsReused(t *testing.T) {
+	initTestMetrics(t)
+	// make sure the list has room for the churned label sets, so its length only depends on reuse
+	internTestLabels(t, "churn", "GET", "200")
+	internTestLabels(t, "churn", "GET", "404")
+	var payload bytes.Buffer
+	before := len(*seriesList.Load())
+	cycles := int64(0)
+	defer func() { seriesClock.Add(-10 * cycles) }()
+	for _, status := range []string{"200", "404", "200", "500", "200", "404", "503", "200"} {
+		id := internTestLabels(t, "churn", "GET", status)
+		payload.Write(encodeTestInternedRecord(metricRequests, 1, id))
+		_, err := processUpdates(bufio.NewReader(&payload), io.Discard)
+		require.ErrorIs(t, err, io.EOF)
+		require.Contains(t, string(metricsGet()), `apache_requests_total{method="GET",status="`+status+`",vhost="churn"} 1`)
+
+		seriesClock.Add(10)
+		cycles++
+		assert.Positive(t, evictSeries(seriesClock.Load()))
+		assert.Nil(t, lookupSeriesByID(id), "released id must not resolve")
+		assert.LessOrEqual(t, len(*seriesList.Load()), before, "released ids are reused")
+	}
+}
+
+func TestSeriesRestoreExisting(t *testing.T) {
+	initTestMetrics(t)
+	id := internTestLabels(t, "restored", "GET", "200")
+	evicted := lookupSeriesByID(id)
+	require.NotNil(t, evicted)
+	seriesClock.Add(10)
+	defer seriesClock.Add(-10)
+	assert.Positive(t, evictSeries(seriesClock.Load()))
+
+	// the label set is added again while a lookup still holds the evicted series
+	existing := lookupSeriesByID(internTestLabels(t, "restored", "GET", "200"))
+	require.NotNil(t, existing)
+	require.NotSame(t, evicted, existing)
+	metrics := evicted.get()
+	assert.Same(t, existing.metrics.Load(), metrics)
+	assert.Same(t, metrics, evicted.metrics.Load(), "further updates take the fast path")
+}
@@ -0,0 +1,159 @@
+package main
+
+/*
+#cgo CFLAGS: -I${SRCDIR}/../../src
+
+#include "mod_prometheus_status_shm.h"
+
+*/
+import "C"
+
+import (
+	"fmt"
+	"strings"
+	"sync/atomic"
+	"unsafe"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+// shmCollector exposes the request metrics from the shared memory worker slots
+type shmCollector struct {
+	base        unsafe.Pointer
+	header      *C.prometheus_status_shm_header
+	timeBuckets []float64
+	sizeBuckets []float64
+
+	requestsDesc *prometheus.Desc
+	timeDesc     *prometheus.Desc
+	sizeDesc     *prometheus.Desc
+	droppedDesc  *prometheus.Desc
+}
+
+// mergedSeries contains the summed up request metrics of a single label set
+type mergedSeries struct {
+	labels      []string
+	requests    uint64
+	timeSum     uint64
+	sizeSum     uint64
+	timeBuckets []uint64
+	sizeBuckets []uint64
+	lastUpdate  int64 // series clock of the last update, only used for aggregated series
+}
+
+func newMergedSeries(labels []string, numTime, numSize int) *mergedSeries {
+	return &mergedSeries{
+		labels:      labels,
+		timeBuckets: make([]uint64, numTime),
+		sizeBuckets: make([]uint64, numSize),
+	}
+}
+
+// collect sends the series as const metrics
+func (s *mergedSeries) collect(ch chan<- prometheus.Metric, requestsDesc, timeDesc, sizeDesc *prometheus.Desc, timeBounds, sizeBounds []float64) {
+	ch <- prometheus.MustNewConstMetric(requestsDesc, prometheus.CounterValue, float64(s.requests), s.labels...)
+	ch <- prometheus.MustNewConstHistogram(timeDesc, s.requests, float64(s.timeSum)/1e6,
+		cumulativeBuckets(timeBounds, s.timeBuckets), s.labels...)
+	ch <- prometheus.MustNewConstHistogram(sizeDesc, s.requests, float64(s.sizeSum),
+		cumulativeBuckets(sizeBounds, s.sizeBuckets), s.labels...)
+}
+
+func newShmCollector(base unsafe.Pointer, requestLabels []string) (*shmCollector, error) {
+	header := (*C.prometheus_status_shm_header)(base)
+	if header.magic != C.PROMETHEUS_STATUS_SHM_MAGIC {
+		return nil, fmt.Errorf("shared memory segment has wrong magic: %x", uint32(header.magic))
+	}
+
+	col := &shmCollector{
+		base:   base,
+		header: header,
+		requestsDesc: prometheus.NewDesc("apache_requests_total",
+			"is the total number of http requests", requestLabels, nil),
+		timeDesc: prometheus.NewDesc("apache_response_time_seconds",
+			"response time histogram", requestLabels, nil),
+		sizeDesc: prometheus.NewDesc("apache_response_size_bytes",
+			"response size histogram", requestLabels, nil),
+		droppedDesc: prometheus.NewDesc("apache_shm_dropped_updates_total",
+			"number of request updates dropped because the shared memory label table is full", nil, nil),
+	}
+	for i := range int(header.num_time_buckets) {
+		col.timeBuckets = append(col.timeBuckets, float64(header.time_buckets[i]))
+	}
+	for i := range int(header.num_size_buckets) {
+		col.sizeBuckets = append(col.sizeBuckets, float64(header.size_buckets[i]))
+	}
+	return col, nil
+}
+
+// Describe implements prometheus.Collector
+func (c *shmCollector) Describe(ch chan<- *prometheus.Desc) {
+	ch <- c.requestsDesc
+	ch <- c.timeDesc
+	ch <- c.sizeDesc
+	ch <- c.droppedDesc
+}
+
+// Collect implements prometheus.Collector
+func (c *shmCollector) Collect(ch chan<- prometheus.Metric) {
+	for _, s := range c.merge() {
+		s.collect(ch, c.requestsDesc, c.timeDesc, c.sizeDesc, c.timeBuckets, c.sizeBuckets)
+	}
+	dropped := atomic.LoadUint64((*uint64)(unsafe.Pointer(&c.header.labels_dropped)))
+	ch <- prometheus.MustNewConstMetric(c.droppedDesc, prometheus.CounterValue, float64(dropped))
+}
+
+// merge sums up all worker slots by label set
+func (c *shmCollector) merge() map[string]*mergedSeries {
+	header := c.header
+	numSlots := uintptr(header.num_slots)
+	numTime := len(c.timeBuckets) + 1
+	recordSize := uintptr(header.record_size)
+	slotSize := uintptr(header.slot_size)
+	labelSize := unsafe.Sizeof(C.prometheus_status_shm_label{})
+	labels := unsafe.Add(c.base, uintptr(header.labels_offset))
+	slots := unsafe.Add(c.base, uintptr(header.slots_offset))
+
+	result := make(map[string]*mergedSeries)
+	for idx := range uintptr(header.num_labels) {
+		entry := (*C.prometheus_status_shm_label)(unsafe.Add(labels, idx*labelSize))
+		if atomic.LoadUint32((*uint32)(unsafe.Pointer(&entry.state))) != C.PROMETHEUS_STATUS_SHM_LABEL_READY {
+			continue
+		}
+		// the same label set might have been inserted twice by concurrent workers
+		label := C.GoStringN(&entry.label[0], C.int(entry.len))
+		series, ok := result[label]
+		if !ok {
+			series = newMergedSeries(normalizeLabels(strings.Split(label, ";")), numTime, len(c.sizeBuckets)+1)
+			result[label] = series
+		}
+		for slot := range numSlots {
+			rec := unsafe.Add(slots, slot*slotSize+idx*recordSize)
+			series.requests += shmLoad(rec, C.PROMETHEUS_STATUS_SHM_REC_REQUESTS)
+			series.timeSum += shmLoad(rec, C.PROMETHEUS_STATUS_SHM_REC_TIME_SUM)
+			series.sizeSum += shmLoad(rec, C.PROMETHEUS_STATUS_SHM_REC_SIZE_SUM)
+			for i := range series.timeBuckets {
+				series.timeBuckets[i] += shmLoad(rec, C.PROMETHEUS_STATUS_SHM_REC_BUCKETS+i)
+			}
+			for i := range series.sizeBuckets {
+				series.sizeBuckets[i] += shmLoad(rec, C.PROMETHEUS_STATUS_SHM_REC_BUCKETS+numTime+i)
+			}
+		}
+	}
+	return result
+}
+
+// shmLoad atomically reads the n-th value of a record
+func shmLoad(rec unsafe.Pointer, n int) uint64 {
+	return atomic.LoadUint64((*uint64)(unsafe.Add(rec, n*8)))
+}
+
+// cumulativeBuckets converts per bucket counts into cumulative prometheus buckets, the last count is +Inf
+func cumulativeBuckets(bounds []float64, counts []uint64) map[float64]uint64 {
+	buckets := make(map[float64]uint64, len(bounds))
+	var total uint64
+	for i, bound := range bounds {
+		total += counts[i]
+		buckets[bound] = total
+	}
+	return buckets
+}
@@ -0,0 +1,247 @@
+package main
+
+/*
+#cgo CFLAGS: -I${SRCDIR}/../../src
+
+#include "mod_prometheus_status_proto.h"
+
+*/
+import "C"
+
+import (
+	"math"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+// SketchWindowSlices sets the number of sketches a quantile window is made of
+const SketchWindowSlices = 6
+
+var (
+	// sketchGamma is the ratio between sketch bin boundaries, given by the relative accuracy
+	sketchGamma = (1 + C.PROMETHEUS_STATUS_SKETCH_ACCURACY) / (1 - C.PROMETHEUS_STATUS_SKETCH_ACCURACY)
+
+	sketchLogGamma = math.Log(sketchGamma)
+)
+
+// quantiles is set when response time quantiles are enabled
+var quantiles *quantileCollector
+
+// sketchIndex returns the bin of a response time in microseconds, just like the apache module computes it
+func sketchIndex(usec float64) uint32 {
+	if usec <= 1 {
+		return 0
+	}
+	return uint32(math.Ceil(math.Log(usec) / sketchLogGamma))
+}
+
+// ddSketch is a mergeable quantile sketch with a relative accuracy. Response times are
+// recorded in microseconds, bin i contains all values between gamma^(i-1) and gamma^i.
+type ddSketch struct {
+	bins  map[uint32]uint64
+	count uint64
+	sum   float64 // seconds
+}
+
+func (s *ddSketch) reset() {
+	clear(s.bins)
+	s.count = 0
+	s.sum = 0
+}
+
+func (s *ddSketch) merge(o *ddSketch) {
+	for idx, n := range o.bins {
+		s.bins[idx] += n
+	}
+	s.count += o.count
+	s.sum += o.sum
+}
+
+// quantile returns the estimated value in seconds for quantile q
+func (s *ddSketch) quantile(q float64) float64 {
+	if s.count == 0 {
+		return math.NaN()
+	}
+	indexes := make([]uint32, 0, len(s.bins))
+	for idx := range s.bins {
+		indexes = append(indexes, idx)
+	}
+	sort.Slice(indexes, func(i, j int) bool { return indexes[i] < indexes[j] })
+
+	rank := uint64(q * float64(s.count-1))
+	var total uint64
+	for _, idx := range indexes {
+		total += s.bins[idx]
+		if total > rank {
+			return 2 * math.Pow(sketchGamma, float64(idx)) / (sketchGamma + 1) / 1e6
+		}
+	}
+	return 2 * math.Pow(sketchGamma, float64(indexes[len(indexes)-1])) / (sketchGamma + 1) / 1e6
+}
+
+// windowedSketch keeps sketches for the slices of a sliding time window. Like client_golang summaries,
+// only the quantiles are windowed, count and sum are cumulative so they never go down.
+type windowedSketch struct {
+	lock   sync.Mutex
+	slices [SketchWindowSlices]ddSketch
+	epochs [SketchWindowSlices]int64
+	count  uint64
+	sum    float64 // seconds
+}
+
+// slice returns the sketch of the current time slice, caller must hold the lock
+func (w *windowedSketch) slice(now time.Time, sliceLen time.Duration) *ddSketch {
+	epoch := now.UnixNano() / int64(sliceLen)
+	n := epoch % SketchWindowSlices
+	sketch := &w.slices[n]
+	if sketch.bins == nil {
+		sketch.bins = make(map[uint32]uint64)
+	}
+	if w.epochs[n] != epoch {
+		sketch.reset()
+		w.epochs[n] = epoch
+	}
+	return sketch
+}
+
+// merged returns all slices within the window merged into one sketch
+func (w *windowedSketch) merged(now time.Time, sliceLen time.Duration) *ddSketch {
+	epoch := now.UnixNano() / int64(sliceLen)
+	result := &ddSketch{bins: make(map[uint32]uint64)}
+	w.lock.Lock()
+	defer w.lock.Unlock()
+	for n := range w.slices {
+		if w.slices[n].bins != nil && w.epochs[n] > epoch-SketchWindowSlices {
+			result.merge(&w.slices[n])
+		}
+	}
+	return result
+}
+
+// totals returns the cumulative count and sum in seconds of all observations
+func (w *windowedSketch) totals() (uint64, float64) {
+	w.lock.Lock()
+	defer w.lock.Unlock()
+	return w.count, w.sum
+}
+
+// quantileCollector exposes response time quantiles per label set over a sliding window
+type quantileCollector struct {
+	lock      sync.RWMutex
+	sketches  map[string]*windowedSketch
+	labels    map[string][]string
+	quantiles []float64
+	sliceLen  time.Duration
+	desc      *prometheus.Desc
+}
+
+func newQuantileCollector(requestLabels []string, quantileList []float64, window time.Duration) *quantileCollector {
+	return &quantileCollector{
+		sketches:  make(map[string]*windowedSketch),
+		labels:    make(map[string][]string),
+		quantiles: quantileList,
+		sliceLen:  max(window/SketchWindowSlices, time.Millisecond),
+		desc: prometheus.NewDesc("apache_response_time_quantiles_seconds",
+			"response time quantiles over a sliding window", requestLabels, nil),
+	}
+}
+
+// sketch returns the windowed sketch for the normalized label values
+func (c *quantileCollector) sketch(labels []string) *windowedSketch {
+	key := strings.Join(labels, "\x00")
+	c.lock.RLock()
+	sketch, ok := c.sketches[key]
+	c.lock.RUnlock()
+	if ok {
+		return sketch
+	}
+	c.lock.Lock()
+	defer c.lock.Unlock()
+	if sketch, ok = c.sketches[key]; !ok {
+		sketch = &windowedSketch{}
+		c.sketches[key] = sketch
+		c.labels[key] = labels
+	}
+	return sketch
+}
+
+// remove deletes the sketch of evicted label values
+func (c *quantileCollector) remove(labels []string) {
+	key := strings.Join(labels, "\x00")
+	c.lock.Lock()
+	delete(c.sketches, key)
+	delete(c.labels, key)
+	c.lock.Unlock()
+}
+
+// observe adds a single response time in seconds
+func (c *quantileCollector) observe(sketch *windowedSketch, seconds float64) {
+	sketch.lock.Lock()
+	slice := sketch.slice(time.Now(), c.sliceLen)
+	slice.bins[sketchIndex(seconds*1e6)]++
+	slice.count++
+	slice.sum += seconds
+	sketch.count++
+	sketch.sum += seconds
+	sketch.lock.Unlock()
+}
+
+// addBins merges sketch bins sent by an apache child, each bin is encoded as index << 32 | count
+func (c *quantileCollector) addBins(sketch *windowedSketch, bins []uint64, sumSeconds float64) {
+	sketch.lock.Lock()
+	slice := sketch.slice(time.Now(), c.sliceLen)
+	for _, bin := range bins {
+		count := bin & 0xffffffff
+		slice.bins[uint32(bin>>32)] += count
+		slice.count += count
+		sketch.count += count
+	}
+	slice.sum += sumSeconds
+	sketch.sum += sumSeconds
+	sketch.lock.Unlock()
+}
+
+// Describe implements prometheus.Collector
+func (c *quantileCollector) Describe(ch chan<- *prometheus.Desc) {
+	ch <- c.desc
+}
+
+// Collect implements prometheus.Collector
+func (c *quantileCollector) Collect(ch chan<- prometheus.Metric) {
+	now := time.Now()
+	c.lock.RLock()
+	defer c.lock.RUnlock()
+	for key, sketch := range c.sketches {
+		merged := sketch.merged(now, c.sliceLen)
+		values := make(map[float64]float64, len(c.quantiles))
+		for _, q := range c.quantiles {
+			values[q] = merged.quantile(q)
+		}
+		count, sum := sketch.totals()
+		ch <- prometheus.MustNewConstSummary(c.desc, count, sum, values, c.labels[key]...)
+	}
+}
+
+// expandQuantiles parses a semicolon separated list of quantiles
+func expandQuantiles(input string) (list []float64, err error) {
+	for _, s := range strings.Split(input, ";") {
+		s = strings.TrimSpace(s)
+		if s == "" {
+			continue
+		}
+		q, pErr := strconv.ParseFloat(s, 64)
+		if pErr != nil {
+			return nil, pErr
+		}
+		if q < 0 || q > 1 {
+			return nil, strconv.ErrRange
+		}
+		list = append(list, q)
+	}
+	return
+}
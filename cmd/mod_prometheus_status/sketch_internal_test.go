@@ -0,0 +1,82 @@
+package main
+
+import (
+	"math"
+	"testing"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+	dto "github.com/prometheus/client_model/go"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestExpandQuantiles(t *testing.T) {
+	t.Parallel()
+	list, err := expandQuantiles("0.5; 0.9;0.99;0.999")
+	require.NoError(t, err)
+	assert.Equal(t, []float64{0.5, 0.9, 0.99, 0.999}, list)
+
+	list, err = expandQuantiles("")
+	require.NoError(t, err)
+	assert.Empty(t, list)
+
+	_, err = expandQuantiles("0.5;1.5")
+	require.Error(t, err)
+}
+
+func TestQuantileCollector(t *testing.T) {
+	t.Parallel()
+	col := newQuantileCollector([]string{"vhost"}, []float64{0.5, 0.99}, time.Minute)
+	sketch := col.sketch([]string{"sketch"})
+	for i := 1; i <= 1000; i++ {
+		col.observe(sketch, float64(i)/1000)
+	}
+	// bins sent by children are merged into the same window
+	col.addBins(sketch, []uint64{uint64(sketchIndex(2e6))<<32 | 10}, 20)
+
+	merged := sketch.merged(time.Now(), col.sliceLen)
+	assert.Equal(t, uint64(1010), merged.count)
+	assert.InEpsilon(t, 0.505, merged.quantile(0.5), 0.011)
+	assert.InEpsilon(t, 2, merged.quantile(0.999), 0.011)
+
+	reg := prometheus.NewRegistry()
+	reg.MustRegister(col)
+	families, err := reg.Gather()
+	require.NoError(t, err)
+	require.Len(t, families, 1)
+	summary := families[0].GetMetric()[0].GetSummary()
+	assert.Equal(t, uint64(1010), summary.GetSampleCount())
+	assert.InEpsilon(t, 1, summary.GetQuantile()[1].GetValue(), 0.011)
+
+	// slices older than the window are dropped
+	assert.Zero(t, sketch.merged(time.Now().Add(2*time.Minute), col.sliceLen).count)
+}
+
+func TestQuantileCollectorCumulative(t *testing.T) {
+	t.Parallel()
+	col := newQuantileCollector([]string{"vhost"}, []float64{0.5}, 6*time.Millisecond)
+	sketch := col.sketch([]string{"cumulative"})
+	reg := prometheus.NewRegistry()
+	reg.MustRegister(col)
+	summary := func() *dto.Summary {
+		families, err := reg.Gather()
+		require.NoError(t, err)
+		return families[0].GetMetric()[0].GetSummary()
+	}
+
+	for range 10 {
+		col.observe(sketch, 0.5)
+	}
+	assert.Equal(t, uint64(10), summary().GetSampleCount())
+
+	// count and sum keep their values once the observations leave the window
+	time.Sleep(20 * time.Millisecond)
+	expired := summary()
+	assert.Equal(t, uint64(10), expired.GetSampleCount())
+	assert.InDelta(t, 5, expired.GetSampleSum(), 1e-9)
+	assert.True(t, math.IsNaN(expired.GetQuantile()[0].GetValue()))
+
+	col.observe(sketch, 0.5)
+	assert.Equal(t, uint64(11), summary().GetSampleCount())
+}
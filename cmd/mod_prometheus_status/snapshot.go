@@ -0,0 +1,342 @@
+package main
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"io"
+	"maps"
+	"os"
+	"path/filepath"
+	"slices"
+	"strings"
+	"sync"
+	"time"
+
+	dto "github.com/prometheus/client_model/go"
+	"github.com/prometheus/common/expfmt"
+)
+
+// snapshotFamilies are handed over to the collector of the next generation on graceful reloads,
+// so request counters and histograms continue instead of starting from zero
+var snapshotFamilies = map[string]bool{
+	"apache_requests_total":        true,
+	"apache_response_time_seconds": true,
+	"apache_response_size_bytes":   true,
+}
+
+// snapshotFormat is the compact binary encoding used for snapshots
+var snapshotFormat = expfmt.NewFormat(expfmt.TypeProtoDelim)
+
+const (
+	// snapshotSuffix is appended to the socket path of a collector to get the file it leaves its final snapshot in on
+	// reloads. Apache waits for the collector to exit before it starts the next generation, which reads the file on startup.
+	snapshotSuffix = ".snapshot"
+
+	// snapshotPattern matches the snapshot files, including unfinished ones, next to the sockets
+	snapshotPattern = "mtr.*" + snapshotSuffix + "*"
+
+	// snapshotMaxAge is the age after which snapshot files nobody loaded are removed. Snapshots are loaded right after
+	// they have been written, other apache instances using the same folder must not lose theirs.
+	snapshotMaxAge = time.Minute
+)
+
+// baseline contains the request metrics of the previous collector, they are added to the own metrics on every scrape
+var baseline = &snapshotBaseline{}
+
+type snapshotBaseline struct {
+	lock     sync.Mutex
+	families map[string]*baselineFamily
+	restored time.Time
+}
+
+type baselineFamily struct {
+	family  *dto.MetricFamily // name, help and type, without metrics
+	metrics map[string]*dto.Metric
+	merged  map[string]bool // series which have been added to own metrics
+}
+
+// writeSnapshot encodes the current request metrics including the own baseline
+func writeSnapshot(w io.Writer) error {
+	enc := expfmt.NewEncoder(w, snapshotFormat)
+	for _, family := range metricsGather() {
+		if !snapshotFamilies[family.GetName()] {
+			continue
+		}
+		err := enc.Encode(family)
+		if err != nil {
+			return fmt.Errorf("encoding snapshot of %s failed: %w", family.GetName(), err)
+		}
+	}
+	return nil
+}
+
+// readSnapshot decodes a snapshot, metrics with different request labels are skipped
+func readSnapshot(r io.Reader) (families map[string]*baselineFamily, series int, err error) {
+	labels := slices.Sorted(slices.Values(requestLabelNames))
+	families = make(map[string]*baselineFamily)
+	dec := expfmt.NewDecoder(r, snapshotFormat)
+	for {
+		family := &dto.MetricFamily{}
+		err = dec.Decode(family)
+		if errors.Is(err, io.EOF) {
+			return families, series, nil
+		}
+		if err != nil {
+			return nil, 0, fmt.Errorf("decoding snapshot failed: %w", err)
+		}
+		if !snapshotFamilies[family.GetName()] {
+			continue
+		}
+		base := &baselineFamily{metrics: make(map[string]*dto.Metric, len(family.Metric)), merged: make(map[string]bool)}
+		for _, m := range family.Metric {
+			if !slices.EqualFunc(m.GetLabel(), labels, func(l *dto.LabelPair, name string) bool { return l.GetName() == name }) {
+				continue
+			}
+			base.metrics[snapshotKey(m)] = m
+		}
+		family.Metric = nil
+		base.family = family
+		families[family.GetName()] = base
+		series += len(base.metrics)
+	}
+}
+
+// setBaseline replaces the baseline, the latest snapshot of the previous collector always contains all of its metrics
+func setBaseline(families map[string]*baselineFamily) {
+	baseline.lock.Lock()
+	defer baseline.lock.Unlock()
+	baseline.families = families
+	baseline.restored = time.Now()
+}
+
+// saveSnapshot writes the final request metrics to path, the collector of the next generation loads them on startup
+func saveSnapshot(path string) {
+	file, err := os.CreateTemp(filepath.Dir(path), filepath.Base(path)+".*")
+	if err != nil {
+		logErrorf("saving snapshot failed: %s", err.Error())
+		return
+	}
+	w := bufio.NewWriterSize(file, ReadBufferSize)
+	err = writeSnapshot(w)
+	if err == nil {
+		err = w.Flush()
+	}
+	if err == nil {
+		err = file.Close()
+	} else {
+		file.Close()
+	}
+	// the next collector must not see a partial snapshot
+	if err == nil {
+		err = os.Rename(file.Name(), path)
+	}
+	if err != nil {
+		os.Remove(file.Name())
+		logErrorf("saving snapshot failed: %s", err.Error())
+	}
+}
+
+// loadSnapshot restores the request metrics the previous collector left in path and removes the file
+func loadSnapshot(path string) {
+	start := time.Now()
+	file, err := os.Open(path)
+	if err != nil {
+		// no snapshot, for example if the previous collector handed it over by socket
+		logDebugf("no snapshot file from previous collector: %s", err.Error())
+		return
+	}
+	defer os.Remove(path)
+	defer file.Close()
+	families, series, err := readSnapshot(bufio.NewReaderSize(file, ReadBufferSize))
+	if err != nil {
+		logErrorf("reading snapshot file failed: %s", err.Error())
+		return
+	}
+	setBaseline(families)
+	logInfof("restored %d request series from previous collector file in %s", series, time.Since(start))
+}
+
+// removeStaleSnapshots removes snapshot files in dir which have not been loaded, for example after a failed reload
+func removeStaleSnapshots(dir string) {
+	files, err := filepath.Glob(filepath.Join(dir, snapshotPattern))
+	if err != nil {
+		return
+	}
+	for _, file := range files {
+		info, err := os.Stat(file)
+		if err != nil || time.Since(info.ModTime()) < snapshotMaxAge {
+			continue
+		}
+		err = os.Remove(file)
+		if err != nil {
+			logDebugf("removing stale snapshot failed: %s", err.Error())
+			continue
+		}
+		logDebugf("removed stale snapshot %s", file)
+	}
+}
+
+// mergeBaseline adds the baseline to the gathered request metrics. Baseline series without own updates
+// are exposed as they are, until they expire like idle series.
+func mergeBaseline(families []*dto.MetricFamily) []*dto.MetricFamily {
+	baseline.lock.Lock()
+	defer baseline.lock.Unlock()
+	if len(baseline.families) == 0 {
+		return families
+	}
+	expired := seriesTTL > 0 && time.Since(baseline.restored) > seriesTTL
+	for name, base := range baseline.families {
+		pos, found := slices.BinarySearchFunc(families, name, func(f *dto.MetricFamily, name string) int {
+			return strings.Compare(f.GetName(), name)
+		})
+		if !found {
+			family := &dto.MetricFamily{Name: base.family.Name, Help: base.family.Help, Type: base.family.Type}
+			families = slices.Insert(families, pos, family)
+		}
+		family := families[pos]
+		matched := make(map[string]bool, len(family.Metric))
+		for _, m := range family.Metric {
+			key := snapshotKey(m)
+			b, ok := base.metrics[key]
+			switch {
+			case !ok:
+			case addMetric(m, b):
+				matched[key] = true
+				base.merged[key] = true
+			default:
+				// for example native histograms which reduced their resolution, these series start over
+				delete(base.metrics, key)
+			}
+		}
+		for key, m := range base.metrics {
+			switch {
+			case matched[key]:
+			case expired, base.merged[key]:
+				// evicted series must not fall back to the baseline values
+				delete(base.metrics, key)
+				delete(base.merged, key)
+			default:
+				family.Metric = append(family.Metric, m)
+			}
+		}
+		if len(base.metrics) == 0 {
+			delete(baseline.families, name)
+		}
+	}
+	return families
+}
+
+// snapshotKey identifies a metric within its family by its label pairs, which are sorted by name
+func snapshotKey(m *dto.Metric) string {
+	var key strings.Builder
+	for _, l := range m.GetLabel() {
+		key.WriteString(l.GetName())
+		key.WriteByte(0)
+		key.WriteString(l.GetValue())
+		key.WriteByte(0)
+	}
+	return key.String()
+}
+
+// addMetric adds the baseline to a gathered metric, returns false if they do not match
+func addMetric(m, base *dto.Metric) bool {
+	switch {
+	case m.Counter != nil && base.Counter != nil:
+		value := m.Counter.GetValue() + base.Counter.GetValue()
+		m.Counter.Value = &value
+		// the series continues, so it has been created by the previous collector
+		if base.Counter.CreatedTimestamp != nil {
+			m.Counter.CreatedTimestamp = base.Counter.CreatedTimestamp
+		}
+		return true
+	case m.Histogram != nil && base.Histogram != nil:
+		if !addHistogram(m.Histogram, base.Histogram) {
+			return false
+		}
+		if base.Histogram.CreatedTimestamp != nil {
+			m.Histogram.CreatedTimestamp = base.Histogram.CreatedTimestamp
+		}
+		return true
+	}
+	return false
+}
+
+// addHistogram adds base to h, both must use the same buckets or the same native histogram schema
+func addHistogram(h, base *dto.Histogram) bool {
+	if len(h.Bucket) != len(base.Bucket) || h.GetSchema() != base.GetSchema() || h.GetZeroThreshold() != base.GetZeroThreshold() {
+		return false
+	}
+	for i, b := range h.Bucket {
+		if b.GetUpperBound() != base.Bucket[i].GetUpperBound() {
+			return false
+		}
+	}
+	for i, b := range h.Bucket {
+		count := b.GetCumulativeCount() + base.Bucket[i].GetCumulativeCount()
+		b.CumulativeCount = &count
+	}
+	count := h.GetSampleCount() + base.GetSampleCount()
+	sum := h.GetSampleSum() + base.GetSampleSum()
+	h.SampleCount = &count
+	h.SampleSum = &sum
+	if h.Schema != nil {
+		zero := h.GetZeroCount() + base.GetZeroCount()
+		h.ZeroCount = &zero
+		h.PositiveSpan, h.PositiveDelta = addNativeBuckets(h.PositiveSpan, h.PositiveDelta, base.PositiveSpan, base.PositiveDelta)
+		h.NegativeSpan, h.NegativeDelta = addNativeBuckets(h.NegativeSpan, h.NegativeDelta, base.NegativeSpan, base.NegativeDelta)
+	}
+	return true
+}
+
+// addNativeBuckets adds two sparse native histogram bucket lists with the same schema
+func addNativeBuckets(spans []*dto.BucketSpan, deltas []int64, baseSpans []*dto.BucketSpan, baseDeltas []int64) ([]*dto.BucketSpan, []int64) {
+	counts := make(map[int32]int64)
+	decodeNativeBuckets(spans, deltas, counts)
+	decodeNativeBuckets(baseSpans, baseDeltas, counts)
+	if len(counts) == 0 {
+		return spans, deltas
+	}
+
+	indexes := slices.Sorted(maps.Keys(counts))
+	spans = spans[:0]
+	deltas = deltas[:0]
+	var last, prevCount int64
+	for i, idx := range indexes {
+		if i == 0 || int64(idx) != last+1 {
+			offset := idx
+			if i > 0 {
+				offset = idx - int32(last) - 1
+			}
+			spans = append(spans, &dto.BucketSpan{Offset: &offset, Length: new(uint32)})
+		}
+		*spans[len(spans)-1].Length++
+		deltas = append(deltas, counts[idx]-prevCount)
+		prevCount = counts[idx]
+		last = int64(idx)
+	}
+	return spans, deltas
+}
+
+// decodeNativeBuckets adds the absolute bucket counts by bucket index to counts
+func decodeNativeBuckets(spans []*dto.BucketSpan, deltas []int64, counts map[int32]int64) {
+	var idx int32
+	var count int64
+	pos := 0
+	for i, span := range spans {
+		if i == 0 {
+			idx = span.GetOffset()
+		} else {
+			idx += span.GetOffset()
+		}
+		for range span.GetLength() {
+			if pos >= len(deltas) {
+				return
+			}
+			count += deltas[pos]
+			counts[idx] += count
+			pos++
+			idx++
+		}
+	}
+}
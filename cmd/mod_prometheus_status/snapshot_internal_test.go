@@ -0,0 +1,170 @@
+package main
+
+import (
+	"bytes"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+
+	dto "github.com/prometheus/client_model/go"
+	"github.com/prometheus/common/expfmt"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+	"google.golang.org/protobuf/proto"
+)
+
+func TestSnapshot(t *testing.T) {
+	initTestMetrics(t)
+	defer setBaseline(nil)
+
+	metricsUpdate(RequestMetrics, "promRequests;3;snapshot;GET;200")
+	metricsUpdate(RequestMetrics, "promResponseTime;0.5;snapshot;GET;200")
+	var buf bytes.Buffer
+	require.NoError(t, writeSnapshot(&buf))
+
+	families, series, err := readSnapshot(bytes.NewReader(buf.Bytes()))
+	require.NoError(t, err)
+	assert.Positive(t, series)
+	require.Contains(t, families, "apache_requests_total")
+	require.Contains(t, families, "apache_response_time_seconds")
+	assert.NotContains(t, families, "apache_server_uptime_seconds")
+
+	// the own metrics continue from the values of the previous collector
+	setBaseline(families)
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_requests_total{method="GET",status="200",vhost="snapshot"} 6`)
+	assert.Contains(t, metrics, `apache_response_time_seconds_count{method="GET",status="200",vhost="snapshot"} 2`)
+	assert.Contains(t, metrics, `apache_response_time_seconds_bucket{method="GET",status="200",vhost="snapshot",le="1"} 2`)
+}
+
+func TestSnapshotFile(t *testing.T) {
+	initTestMetrics(t)
+	defer setBaseline(nil)
+
+	metricsUpdate(RequestMetrics, "promRequests;2;snapshotfile;GET;200")
+	path := filepath.Join(t.TempDir(), "mtr.test"+snapshotSuffix)
+	saveSnapshot(path)
+	require.FileExists(t, path)
+
+	// the file is removed once it has been loaded, so it is not added again by the next generation
+	loadSnapshot(path)
+	assert.NoFileExists(t, path)
+	metricsUpdate(RequestMetrics, "promRequests;1;snapshotfile;GET;200")
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_requests_total{method="GET",status="200",vhost="snapshotfile"} 5`)
+}
+
+func TestRemoveStaleSnapshots(t *testing.T) {
+	t.Parallel()
+	dir := t.TempDir()
+	stale := filepath.Join(dir, "mtr.stale"+snapshotSuffix)
+	unfinished := filepath.Join(dir, "mtr.stale"+snapshotSuffix+".123")
+	fresh := filepath.Join(dir, "mtr.fresh"+snapshotSuffix)
+	socket := filepath.Join(dir, "mtr.socket")
+	old := time.Now().Add(-2 * snapshotMaxAge)
+	for _, file := range []string{stale, unfinished, fresh, socket} {
+		require.NoError(t, os.WriteFile(file, nil, 0o600))
+	}
+	for _, file := range []string{stale, unfinished, socket} {
+		require.NoError(t, os.Chtimes(file, old, old))
+	}
+
+	removeStaleSnapshots(dir)
+	assert.NoFileExists(t, stale)
+	assert.NoFileExists(t, unfinished)
+	// snapshots of other instances might not have been loaded yet
+	assert.FileExists(t, fresh)
+	assert.FileExists(t, socket)
+}
+
+func TestSnapshotBaselineOnly(t *testing.T) {
+	initTestMetrics(t)
+	defer setBaseline(nil)
+
+	family := &dto.MetricFamily{
+		Name: proto.String("apache_requests_total"),
+		Help: proto.String("is the total number of http requests"),
+		Type: dto.MetricType_COUNTER.Enum(),
+		Metric: []*dto.Metric{
+			testSnapshotCounter(5, "method", "GET", "status", "200", "vhost", "previous"),
+			// label names of a different configuration are skipped
+			testSnapshotCounter(7, "vhost", "other"),
+		},
+	}
+	var buf bytes.Buffer
+	_, err := expfmt.NewEncoder(&buf, snapshotFormat).Encode(family)
+	require.NoError(t, err)
+	families, series, err := readSnapshot(&buf)
+	require.NoError(t, err)
+	assert.Equal(t, 1, series)
+
+	// series without own updates are exposed as they are
+	setBaseline(families)
+	metrics := string(metricsGet())
+	assert.Contains(t, metrics, `apache_requests_total{method="GET",status="200",vhost="previous"} 5`)
+	assert.NotContains(t, metrics, `vhost="other"`)
+}
+
+func TestAddNativeBuckets(t *testing.T) {
+	t.Parallel()
+	// absolute counts: index 0 => 1, index 1 => 2
+	spans := []*dto.BucketSpan{{Offset: proto.Int32(0), Length: proto.Uint32(2)}}
+	deltas := []int64{1, 1}
+	// absolute counts: index 1 => 3, index 3 => 4
+	baseSpans := []*dto.BucketSpan{{Offset: proto.Int32(1), Length: proto.Uint32(1)}, {Offset: proto.Int32(1), Length: proto.Uint32(1)}}
+	baseDeltas := []int64{3, 1}
+
+	spans, deltas = addNativeBuckets(spans, deltas, baseSpans, baseDeltas)
+	assert.Equal(t, []int64{1, 4, -1}, deltas)
+	require.Len(t, spans, 2)
+	assert.Equal(t, int32(0), spans[0].GetOffset())
+	assert.Equal(t, uint32(2), spans[0].GetLength())
+	assert.Equal(t, int32(1), spans[1].GetOffset())
+	assert.Equal(t, uint32(1), spans[1].GetLength())
+
+	counts := map[int32]int64{}
+	decodeNativeBuckets(spans, deltas, counts)
+	assert.Equal(t, map[int32]int64{0: 1, 1: 5, 3: 4}, counts)
+}
+
+func testSnapshotCounter(value float64, labels ...string) *dto.Metric {
+	m := &dto.Metric{Counter: &dto.Counter{Value: proto.Float64(value)}}
+	for i := 0; i+1 < len(labels); i += 2 {
+		m.Label = append(m.Label, &dto.LabelPair{Name: proto.String(labels[i]), Value: proto.String(labels[i+1])})
+	}
+	return m
+}
+
+// BenchmarkSnapshotRestore measures loading the snapshot of 100k request series and the added scrape time until they expire
+func BenchmarkSnapshotRestore(b *testing.B) {
+	prepareBenchmarkSeries(b, 100000)
+	var buf bytes.Buffer
+	require.NoError(b, writeSnapshot(&buf))
+	snapshot := buf.Bytes()
+	b.Cleanup(func() { setBaseline(nil) })
+
+	b.Run("restore", func(b *testing.B) {
+		b.ReportAllocs()
+		b.ResetTimer()
+		for range b.N {
+			families, _, err := readSnapshot(bytes.NewReader(snapshot))
+			if err != nil {
+				b.Fatal(err)
+			}
+			setBaseline(families)
+		}
+		b.ReportMetric(float64(len(snapshot)), "snapshot-bytes")
+	})
+
+	b.Run("merge", func(b *testing.B) {
+		families, _, err := readSnapshot(bytes.NewReader(snapshot))
+		require.NoError(b, err)
+		setBaseline(families)
+		b.ReportAllocs()
+		b.ResetTimer()
+		for range b.N {
+			metricsGather()
+		}
+	})
+}
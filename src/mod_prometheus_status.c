@@ -4,16 +4,15 @@
 
 #include "mod_prometheus_status.h"
 #include "mod_prometheus_status_go.h"
+#include "mod_prometheus_status_shm.h"
 
 extern apr_hash_t *log_hash;
 extern unixd_config_rec ap_unixd_config;
 
-#define SERVER_DISABLED SERVER_NUM_STATUS
-#define MOD_STATUS_NUM_STATUS (SERVER_NUM_STATUS+1)
-static int status_flags[MOD_STATUS_NUM_STATUS];
-static int server_limit, thread_limit, threads_per_child, max_servers;
+static int server_limit, thread_limit;
 static apr_proc_t *g_metric_manager = NULL;
 static int g_metric_manager_keep_running = TRUE;
+static apr_pool_t *g_metric_manager_pool = NULL; /* set while the start waits for the scoreboard */
 
 typedef struct {
     char                context[4096];
@@ -23,11 +22,30 @@ typedef struct {
     const char         *time_buckets;       /* raw response time buckets */
     const char         *size_buckets;       /* raw response size buckets */
     const char         *tmp_folder;         /* tmp folder for the socket */
+    int                 backend;            /* request metrics backend, socket, shm or aggregate */
+    int                 shm_label_sets;     /* max number of label sets in shared memory */
+    int                 batch_bytes;        /* flush request metrics once buffer reaches this size */
+    int                 flush_interval;     /* flush request metrics at least every x milliseconds */
+    int                 protocol;           /* wire protocol for request metrics, text or binary */
+    int                 socket_type;        /* socket type for request metrics, stream or datagram */
+    int                 scrape_cache_ttl;   /* reuse rendered metrics for x milliseconds */
+    int                 max_staleness;      /* scrapes force a flush of aggregated metrics older than x milliseconds */
+    int                 max_series;         /* maximum number of request label sets in the collector */
+    int                 series_ttl;         /* remove request label sets without updates for x seconds */
+    double              native_factor;      /* bucket growth factor of native request histograms, 0 disables them */
+    int                 native_max_buckets; /* maximum number of buckets per native histogram */
+    int                 native_reset;       /* reset native histograms exceeding the buckets after x seconds */
+    const char         *quantiles;          /* response time quantiles, empty disables them */
+    int                 quantile_window;    /* sliding window of the quantiles in seconds */
+    int                 process_details;    /* export process statistics per generation */
+    int                 send_mode;          /* wait for the collector or drop request metrics instead */
+    const char         *listen;             /* address the collector serves scrapes on directly */
+    int                 sample_rate;        /* scoreboard samples per second, 0 disables the sampler */
 
     /* directory level options */
     int                 enabled;            /* Enable or disable our module */
     char                label_values[4096]; /* Add custom label values */
-    apr_array_header_t *label_format;       /* parsed label format */
+    prometheus_status_label_format *label_format; /* compiled label format */
 } prometheus_status_config;
 static prometheus_status_config config;
 
@@ -46,12 +64,87 @@ typedef int (*prometheus_status_init_fn_t)(
     char *mpmName,
     int socketTimeout,
     char *timeBuckets,
-    char *sizeBuckets
+    char *sizeBuckets,
+    void *shm,
+    int socketType,
+    int scrapeCacheTTL,
+    int backend,
+    int maxSeries,
+    int seriesTTL,
+    double nativeFactor,
+    int nativeMaxBuckets,
+    int nativeReset,
+    char *quantiles,
+    int quantileWindow,
+    void *stats,
+    int processDetails,
+    long long loadStart,
+    int readyFD,
+    char *previousSocket,
+    char *listen,
+    void *scoreboard,
+    int configGeneration,
+    int sampleRate
 );
 
 static prometheus_status_init_fn_t prometheusStatusInitFn = NULL;
 char *metric_socket = NULL;
 int metric_socket_fd = 0;
+/* socket of the collector of the previous generation, it hands over its request metrics */
+static char previous_metric_socket[PATH_MAX] = "";
+
+/* per thread buffer and persistent connection for request metrics */
+typedef struct {
+    int                 fd;
+    int                 dgram_fd;   /* unconnected datagram socket, only used with socket type datagram */
+    apr_size_t          len;
+    apr_size_t          size;       /* buffer capacity */
+    apr_size_t          pending;    /* number of buffered updates */
+    apr_size_t          partial;    /* remaining bytes of a partially sent update at the start of the buffer, non-blocking mode only */
+    apr_time_t          oldest;     /* time the first buffered update has been added */
+    apr_thread_mutex_t *mutex;
+    char               *buf;
+    apr_pool_t         *aggregate_pool;
+    apr_hash_t         *aggregates; /* aggregated request metrics by encoded label values, only used with the aggregate backend */
+} prometheus_status_batch;
+
+/* request metrics of a single label set aggregated since the last flush */
+typedef struct {
+    const char         *key;        /* encoded label values */
+    apr_size_t          key_len;
+    int                 num_labels;
+    int                 dirty;      /* updated since the last flush */
+    apr_array_header_t *sketch;     /* response time sketch bins in wire encoding, only used with quantiles */
+    apr_uint64_t        values[1];  /* same layout as shared memory records */
+} prometheus_status_aggregate;
+
+static __thread prometheus_status_batch *thread_batch = NULL;
+static apr_pool_t *child_pool = NULL;
+static apr_array_header_t *child_batches = NULL;
+static apr_thread_mutex_t *child_batches_mutex = NULL;
+static apr_thread_cond_t *child_flusher_cond = NULL;
+static apr_thread_t *child_flusher = NULL;
+static int child_flusher_running = FALSE;
+
+/* label set ids assigned by the collector, keyed by the encoded label values */
+static apr_pool_t *child_interned_pool = NULL;
+static apr_hash_t *child_interned = NULL;
+static apr_thread_rwlock_t *child_interned_lock = NULL;
+static apr_uint64_t child_interned_generation = 0;
+
+/* aggregate backend: bucket boundaries, forced flushes and the flusher connection */
+static double aggregate_time_buckets[PROMETHEUS_STATUS_SHM_MAX_BUCKETS];
+static double aggregate_size_buckets[PROMETHEUS_STATUS_SHM_MAX_BUCKETS];
+static uint32_t aggregate_num_time_buckets = 0;
+static uint32_t aggregate_num_size_buckets = 0;
+static int aggregate_num_values = 0;
+static double sketch_log_gamma = 0; /* sketches are disabled unless set */
+static apr_shm_t *flush_control_shm = NULL;
+static prometheus_status_flush_control *flush_control = NULL;
+static int child_aggregate_fd = 0;
+static int child_slot = -1;
+static apr_shm_t *stats_shm = NULL;
+static prometheus_status_stats *stats = NULL;
 
 void *prometheus_status_create_dir_conf(apr_pool_t *pool, char *context);
 void *prometheus_status_merge_dir_conf(apr_pool_t *pool, void *BASE, void *ADD);
@@ -62,6 +155,25 @@ static const char *prometheus_status_set_label_names(cmd_parms *cmd, void *cfg,
 static const char *prometheus_status_set_tmp_folder(cmd_parms *cmd, void *cfg, const char *arg);
 static const char *prometheus_status_set_time_buckets(cmd_parms *cmd, void *cfg, const char *arg);
 static const char *prometheus_status_set_size_buckets(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_backend(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_shm_label_sets(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_batch_bytes(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_flush_interval(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_protocol(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_socket_type(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_scrape_cache_ttl(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_max_staleness(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_max_series(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_series_ttl(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_native_factor(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_native_max_buckets(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_native_reset(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_quantiles(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_quantile_window(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_process_details(cmd_parms *cmd, void *cfg, int val);
+static const char *prometheus_status_set_send_mode(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_listen(cmd_parms *cmd, void *cfg, const char *arg);
+static const char *prometheus_status_set_sample_rate(cmd_parms *cmd, void *cfg, const char *arg);
 const char *prometheus_status_set_enabled(cmd_parms *cmd, void *cfg, int val);
 const char *prometheus_status_set_label_values(cmd_parms *cmd, void *cfg, const char *arg);
 
@@ -73,6 +185,25 @@ static const command_rec prometheus_status_directives[] = {
     AP_INIT_RAW_ARGS("PrometheusStatusTmpFolder",           prometheus_status_set_tmp_folder,    NULL, RSRC_CONF, "Set folder for communication socket."),
     AP_INIT_RAW_ARGS("PrometheusStatusResponseTimeBuckets", prometheus_status_set_time_buckets,  NULL, RSRC_CONF, "Set response time histogram buckets."),
     AP_INIT_RAW_ARGS("PrometheusStatusResponseSizeBuckets", prometheus_status_set_size_buckets,  NULL, RSRC_CONF, "Set response size histogram buckets."),
+    AP_INIT_TAKE1("PrometheusStatusBackend",                prometheus_status_set_backend,       NULL, RSRC_CONF, "Set request metrics backend, either 'socket', 'shm' or 'aggregate'."),
+    AP_INIT_TAKE1("PrometheusStatusShmLabelSets",           prometheus_status_set_shm_label_sets, NULL, RSRC_CONF, "Set maximum number of label sets kept in shared memory."),
+    AP_INIT_TAKE1("PrometheusStatusBatchBytes",             prometheus_status_set_batch_bytes,   NULL, RSRC_CONF, "Set buffer size in bytes after which request metrics are sent, 0 disables batching."),
+    AP_INIT_TAKE1("PrometheusStatusFlushInterval",          prometheus_status_set_flush_interval, NULL, RSRC_CONF, "Set maximum time in milliseconds request metrics are buffered."),
+    AP_INIT_TAKE1("PrometheusStatusProtocol",               prometheus_status_set_protocol,      NULL, RSRC_CONF, "Set wire protocol for request metrics, either 'binary' or 'text'."),
+    AP_INIT_TAKE1("PrometheusStatusSocketType",             prometheus_status_set_socket_type,   NULL, RSRC_CONF, "Set socket type for request metrics, either 'stream' or 'datagram'."),
+    AP_INIT_TAKE1("PrometheusStatusScrapeCacheTTL",         prometheus_status_set_scrape_cache_ttl, NULL, RSRC_CONF, "Set time in milliseconds rendered metrics are reused for further scrapes, 0 disables caching."),
+    AP_INIT_TAKE1("PrometheusStatusMaxStaleness",           prometheus_status_set_max_staleness, NULL, RSRC_CONF, "Set maximum age in milliseconds of aggregated request metrics on scrapes, 0 disables forced flushes."),
+    AP_INIT_TAKE1("PrometheusStatusMaxSeries",              prometheus_status_set_max_series,    NULL, RSRC_CONF, "Set maximum number of request label sets, further label sets are folded into an overflow series, 0 disables the limit."),
+    AP_INIT_TAKE1("PrometheusStatusSeriesTTL",              prometheus_status_set_series_ttl,    NULL, RSRC_CONF, "Set time in seconds after which idle request label sets are removed, 0 disables eviction."),
+    AP_INIT_TAKE1("PrometheusStatusNativeHistogramFactor",  prometheus_status_set_native_factor, NULL, RSRC_CONF, "Set bucket growth factor of native response time and size histograms, 0 uses classic buckets."),
+    AP_INIT_TAKE1("PrometheusStatusNativeHistogramMaxBuckets", prometheus_status_set_native_max_buckets, NULL, RSRC_CONF, "Set maximum number of buckets per native histogram, 0 disables the limit."),
+    AP_INIT_TAKE1("PrometheusStatusNativeHistogramResetInterval", prometheus_status_set_native_reset, NULL, RSRC_CONF, "Set time in seconds after which native histograms exceeding the bucket limit are reset, 0 reduces the resolution instead."),
+    AP_INIT_RAW_ARGS("PrometheusStatusQuantiles",           prometheus_status_set_quantiles,     NULL, RSRC_CONF, "Set response time quantiles computed from mergeable sketches, for example 0.5;0.9;0.99;0.999."),
+    AP_INIT_TAKE1("PrometheusStatusQuantileWindow",         prometheus_status_set_quantile_window, NULL, RSRC_CONF, "Set sliding time window in seconds response time quantiles are computed over."),
+    AP_INIT_FLAG("PrometheusStatusProcessDetails",          prometheus_status_set_process_details, NULL, RSRC_CONF, "Set to On to export memory and cpu usage of the apache children per generation."),
+    AP_INIT_TAKE1("PrometheusStatusSendMode",               prometheus_status_set_send_mode,     NULL, RSRC_CONF, "Set to 'nonblocking' to drop request metrics instead of waiting for a busy collector, default is 'blocking'."),
+    AP_INIT_TAKE1("PrometheusStatusListen",                 prometheus_status_set_listen,        NULL, RSRC_CONF, "Set address the metrics collector serves scrapes on without apache workers, either host:port or unix:/path."),
+    AP_INIT_TAKE1("PrometheusStatusScoreboardSampleRate",   prometheus_status_set_sample_rate,   NULL, RSRC_CONF, "Set scoreboard samples per second for time averaged worker states, 0 disables sampling."),
 
     /* directory level */
     AP_INIT_FLAG("PrometheusStatusEnabled",                 prometheus_status_set_enabled,       NULL, OR_ALL,    "Set to Off to disable collecting metrics (for this directory/location)."),
@@ -128,17 +259,225 @@ static const char *prometheus_status_set_size_buckets(cmd_parms *cmd, void *cfg,
     return NULL;
 }
 
+/* Handler for the "PrometheusStatusBackend" directive */
+static const char *prometheus_status_set_backend(cmd_parms *cmd, void *cfg, const char *arg) {
+    if(!strcasecmp(arg, "socket")) {
+        config.backend = PROMETHEUS_STATUS_BACKEND_SOCKET;
+    } else if(!strcasecmp(arg, "shm")) {
+        config.backend = PROMETHEUS_STATUS_BACKEND_SHM;
+    } else if(!strcasecmp(arg, "aggregate")) {
+        config.backend = PROMETHEUS_STATUS_BACKEND_AGGREGATE;
+    } else {
+        return("PrometheusStatusBackend must be either 'socket', 'shm' or 'aggregate'");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusShmLabelSets" directive */
+static const char *prometheus_status_set_shm_label_sets(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.shm_label_sets = atoi(arg);
+    if(config.shm_label_sets <= 0) {
+        return("PrometheusStatusShmLabelSets must be a positive number");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusBatchBytes" directive */
+static const char *prometheus_status_set_batch_bytes(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.batch_bytes = atoi(arg);
+    if(config.batch_bytes < 0) {
+        return("PrometheusStatusBatchBytes must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusFlushInterval" directive */
+static const char *prometheus_status_set_flush_interval(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.flush_interval = atoi(arg);
+    if(config.flush_interval <= 0) {
+        return("PrometheusStatusFlushInterval must be a positive number");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusProtocol" directive */
+static const char *prometheus_status_set_protocol(cmd_parms *cmd, void *cfg, const char *arg) {
+    if(!strcasecmp(arg, "binary")) {
+        config.protocol = PROMETHEUS_STATUS_PROTOCOL_BINARY;
+    } else if(!strcasecmp(arg, "text")) {
+        config.protocol = PROMETHEUS_STATUS_PROTOCOL_TEXT;
+    } else {
+        return("PrometheusStatusProtocol must be either 'binary' or 'text'");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusSocketType" directive */
+static const char *prometheus_status_set_socket_type(cmd_parms *cmd, void *cfg, const char *arg) {
+    if(!strcasecmp(arg, "stream")) {
+        config.socket_type = PROMETHEUS_STATUS_SOCKET_STREAM;
+    } else if(!strcasecmp(arg, "datagram")) {
+        config.socket_type = PROMETHEUS_STATUS_SOCKET_DATAGRAM;
+    } else {
+        return("PrometheusStatusSocketType must be either 'stream' or 'datagram'");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusScrapeCacheTTL" directive */
+static const char *prometheus_status_set_scrape_cache_ttl(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.scrape_cache_ttl = atoi(arg);
+    if(config.scrape_cache_ttl < 0) {
+        return("PrometheusStatusScrapeCacheTTL must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusMaxStaleness" directive */
+static const char *prometheus_status_set_max_staleness(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.max_staleness = atoi(arg);
+    if(config.max_staleness < 0) {
+        return("PrometheusStatusMaxStaleness must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusMaxSeries" directive */
+static const char *prometheus_status_set_max_series(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.max_series = atoi(arg);
+    if(config.max_series < 0) {
+        return("PrometheusStatusMaxSeries must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusSeriesTTL" directive */
+static const char *prometheus_status_set_series_ttl(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.series_ttl = atoi(arg);
+    if(config.series_ttl < 0) {
+        return("PrometheusStatusSeriesTTL must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusNativeHistogramFactor" directive */
+static const char *prometheus_status_set_native_factor(cmd_parms *cmd, void *cfg, const char *arg) {
+    char *end;
+    config.native_factor = strtod(arg, &end);
+    if(end == arg || *end != '\0' || (config.native_factor != 0 && config.native_factor <= 1)) {
+        return("PrometheusStatusNativeHistogramFactor must be 0 or greater than 1");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusNativeHistogramMaxBuckets" directive */
+static const char *prometheus_status_set_native_max_buckets(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.native_max_buckets = atoi(arg);
+    if(config.native_max_buckets < 0) {
+        return("PrometheusStatusNativeHistogramMaxBuckets must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusNativeHistogramResetInterval" directive */
+static const char *prometheus_status_set_native_reset(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.native_reset = atoi(arg);
+    if(config.native_reset < 0) {
+        return("PrometheusStatusNativeHistogramResetInterval must not be negative");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusQuantiles" directive */
+static const char *prometheus_status_set_quantiles(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.quantiles = arg;
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusQuantileWindow" directive */
+static const char *prometheus_status_set_quantile_window(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.quantile_window = atoi(arg);
+    if(config.quantile_window <= 0) {
+        return("PrometheusStatusQuantileWindow must be a positive number");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusProcessDetails" directive */
+static const char *prometheus_status_set_process_details(cmd_parms *cmd, void *cfg, int val) {
+    config.process_details = val;
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusSendMode" directive */
+static const char *prometheus_status_set_send_mode(cmd_parms *cmd, void *cfg, const char *arg) {
+    if(!strcasecmp(arg, "blocking")) {
+        config.send_mode = PROMETHEUS_STATUS_SEND_BLOCKING;
+    } else if(!strcasecmp(arg, "nonblocking")) {
+        config.send_mode = PROMETHEUS_STATUS_SEND_NONBLOCKING;
+    } else {
+        return("PrometheusStatusSendMode must be either 'blocking' or 'nonblocking'");
+    }
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusListen" directive */
+static const char *prometheus_status_set_listen(cmd_parms *cmd, void *cfg, const char *arg) {
+    if(!strncmp(arg, "unix:", 5) ? arg[5] != '/' : strrchr(arg, ':') == NULL) {
+        return("PrometheusStatusListen must be either host:port or unix:/path");
+    }
+    config.listen = arg;
+    return NULL;
+}
+
+/* Handler for the "PrometheusStatusScoreboardSampleRate" directive */
+static const char *prometheus_status_set_sample_rate(cmd_parms *cmd, void *cfg, const char *arg) {
+    config.sample_rate = atoi(arg);
+    if(config.sample_rate < 0 || config.sample_rate > MAXSAMPLERATE) {
+        return("PrometheusStatusScoreboardSampleRate must be a number between 0 and 1000");
+    }
+    return NULL;
+}
+
 /* Handler for the "PrometheusStatusLabelValues" directive */
 const char *prometheus_status_set_label_values(cmd_parms *cmd, void *cfg, const char *arg) {
     const char *err_string = NULL;
     prometheus_status_config *conf = (prometheus_status_config *) cfg;
     strcpy(conf->label_values, arg);
-    conf->label_format = parse_log_string(cmd->pool, conf->label_values, &err_string);
+    conf->label_format = prometheus_status_compile_label_format(cmd->pool, conf->label_values, &err_string);
     return err_string;
 }
 
-/* open the communication socket */
-static int prometheus_status_open_communication_socket(int *fd) {
+/* count a failed send to the metrics collector, errno tells timeouts from other errors */
+static void prometheus_status_count_send_failure(int err) {
+    if(stats == NULL) {
+        return;
+    }
+    if(err == EAGAIN || err == EWOULDBLOCK) {
+        __atomic_fetch_add(&stats->send_timeouts, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&stats->send_failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* count a reply of the metrics collector which could not be read, including connections closed before the reply */
+static void prometheus_status_count_read_failure(void) {
+    if(stats == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&stats->read_failures, 1, __ATOMIC_RELAXED);
+}
+
+/* count request metric updates which have been dropped instead of being sent to the collector */
+static void prometheus_status_count_drops(apr_size_t num) {
+    if(stats == NULL || num == 0) {
+        return;
+    }
+    __atomic_fetch_add(&stats->send_drops, num, __ATOMIC_RELAXED);
+}
+
+/* open a socket to the collector, a non-blocking connect fails right away if the collector does not accept connections */
+static int prometheus_status_open_socket(int *fd, int nonblocking) {
     struct sockaddr_un addr;
     addr.sun_family = AF_UNIX;
     // reuse if already open
@@ -150,11 +489,18 @@ static int prometheus_status_open_communication_socket(int *fd) {
         return(FALSE);
     }
     strcpy(addr.sun_path, metric_socket);
-    *fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    *fd = socket(PF_UNIX, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), 0);
     if(connect(*fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
         logDebugf("failed to open metrics socket: socket:%s fd:%d errno:%d (%s)", metric_socket, *fd, errno, strerror(errno));
+        prometheus_status_count_send_failure(errno);
+        close(*fd);
+        *fd = 0;
         return(FALSE);
     }
+    // unix sockets are connected right away, further sends only use MSG_DONTWAIT where needed
+    if(nonblocking) {
+        fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) & ~O_NONBLOCK);
+    }
 
     struct timeval timeout;
     timeout.tv_sec  = DEFAULTSOCKETTIMEOUT;
@@ -173,6 +519,11 @@ static int prometheus_status_open_communication_socket(int *fd) {
     return(TRUE);
 }
 
+/* open the communication socket */
+static int prometheus_status_open_communication_socket(int *fd) {
+    return(prometheus_status_open_socket(fd, FALSE));
+}
+
 /* close the communication socket */
 static int prometheus_status_close_communication_socket(int *fd) {
     if(*fd == 0) {
@@ -183,9 +534,105 @@ static int prometheus_status_close_communication_socket(int *fd) {
     return(TRUE);
 }
 
+/* write complete buffer to the communication socket, closes the socket on errors. sent is set to the number of bytes
+ * written, so callers know which records the collector got. Sends which would block do not count as failure with
+ * MSG_DONTWAIT, since the collector is just busy. */
+static int prometheus_status_write_socket(int *fd, const char *buffer, apr_size_t len, int flags, apr_size_t *sent) {
+    ssize_t nbytes;
+
+    *sent = 0;
+    while(len > 0) {
+        nbytes = send(*fd, buffer, len, flags);
+        if(nbytes < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            logDebugf("failed to send to metrics collector: socket:%s fd:%d errno:%d (%s)", metric_socket, *fd, errno, strerror(errno));
+            if(!(flags & MSG_DONTWAIT) || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                prometheus_status_count_send_failure(errno);
+            }
+            prometheus_status_close_communication_socket(fd);
+            return(FALSE);
+        }
+        buffer += nbytes;
+        len    -= nbytes;
+        *sent  += nbytes;
+    }
+    return(TRUE);
+}
+
+/* write complete buffer to the communication socket, closes the socket on errors */
+static int prometheus_status_write_communication_socket(int *fd, const char *buffer, apr_size_t len) {
+    apr_size_t sent;
+    return(prometheus_status_write_socket(fd, buffer, len, MSG_NOSIGNAL, &sent));
+}
+
+/* read exactly len bytes from the communication socket, closes the socket on errors */
+static int prometheus_status_read_communication_socket(int *fd, char *buffer, apr_size_t len) {
+    ssize_t nbytes;
+
+    while(len > 0) {
+        nbytes = recv(*fd, buffer, len, 0);
+        if(nbytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if(nbytes <= 0) {
+            logDebugf("failed to read from metrics collector: socket:%s fd:%d errno:%d (%s)", metric_socket, *fd, errno, strerror(errno));
+            prometheus_status_count_read_failure();
+            prometheus_status_close_communication_socket(fd);
+            return(FALSE);
+        }
+        buffer += nbytes;
+        len    -= nbytes;
+    }
+    return(TRUE);
+}
+
+/* send buffer as a single datagram, the socket is never connected so no collector restart can break it */
+static int prometheus_status_send_datagram(int *fd, const char *buffer, apr_size_t len) {
+    struct sockaddr_un addr;
+    struct timeval timeout;
+
+    // not yet initialized
+    if(metric_socket == NULL) {
+        return(FALSE);
+    }
+    if(*fd == 0) {
+        *fd = socket(PF_UNIX, SOCK_DGRAM, 0);
+        if(*fd == -1) {
+            logErrorf("failed to create datagram socket: errno:%d (%s)", errno, strerror(errno));
+            *fd = 0;
+            return(FALSE);
+        }
+        // sendto blocks while the collector queue is full, do not hang worker threads forever
+        timeout.tv_sec  = DEFAULTSOCKETTIMEOUT;
+        timeout.tv_usec = 0;
+        if(setsockopt(*fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout)) == -1) {
+            logErrorf("setsockopt failed: socket:%s fd:%d errno:%d (%s)", metric_socket, *fd, errno, strerror(errno));
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", metric_socket, PROMETHEUS_STATUS_DATAGRAM_SUFFIX);
+    while(sendto(*fd, buffer, len, MSG_NOSIGNAL | (config.send_mode == PROMETHEUS_STATUS_SEND_NONBLOCKING ? MSG_DONTWAIT : 0),
+                 (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        if(errno == EINTR) {
+            continue;
+        }
+        logDebugf("failed to send datagram to metrics collector: socket:%s%s fd:%d errno:%d (%s)", metric_socket, PROMETHEUS_STATUS_DATAGRAM_SUFFIX, *fd, errno, strerror(errno));
+        // a full collector queue is expected in non-blocking mode, the datagram is counted as dropped
+        if(config.send_mode == PROMETHEUS_STATUS_SEND_BLOCKING || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            prometheus_status_count_send_failure(errno);
+        }
+        return(FALSE);
+    }
+    return(TRUE);
+}
+
 /* send something over the communication socket */
 static int prometheus_status_send_communication_socket(int *fd, const char *fmt, ...) {
-    char buffer[4096];
+    char buffer[MAXRECORDSIZE];
     int nbytes;
     va_list ap;
 
@@ -195,101 +642,920 @@ static int prometheus_status_send_communication_socket(int *fd, const char *fmt,
     }
 
     va_start(ap, fmt);
-    nbytes = vsnprintf(buffer, 4096, fmt, ap);
+    nbytes = vsnprintf(buffer, MAXRECORDSIZE, fmt, ap);
+    va_end(ap);
+    if(nbytes >= MAXRECORDSIZE) {
+        logDebugf("metrics update too large: %d bytes", nbytes);
+        return(FALSE);
+    }
+
+    return(prometheus_status_write_communication_socket(fd, buffer, nbytes));
+}
+
+/* remove nbytes sent from the start of the buffer. Updates sent completely are not pending anymore, the remaining
+ * bytes of an update which has been sent partially are kept in batch->partial. Caller must hold the batch mutex */
+static void prometheus_status_batch_sent(prometheus_status_batch *batch, apr_size_t nbytes) {
+    apr_size_t offset = 0, record_len;
+    apr_uint16_t field;
+    const char *eol;
+
+    while(offset < nbytes) {
+        if(batch->partial > 0) {
+            record_len = batch->partial;
+        } else if((unsigned char)batch->buf[offset] == PROMETHEUS_STATUS_PROTO_MAGIC) {
+            memcpy(&field, batch->buf + offset + 2, 2);
+            record_len = field > 0 ? field : batch->len - offset;
+        } else {
+            eol = memchr(batch->buf + offset, '\n', batch->len - offset);
+            record_len = eol != NULL ? (apr_size_t)(eol + 1 - (batch->buf + offset)) : batch->len - offset;
+        }
+        if(offset + record_len > nbytes) {
+            batch->partial = offset + record_len - nbytes;
+            break;
+        }
+        offset += record_len;
+        batch->partial = 0;
+        if(batch->pending > 0) {
+            batch->pending--;
+        }
+    }
+    memmove(batch->buf, batch->buf + nbytes, batch->len - nbytes);
+    batch->len -= nbytes;
+}
+
+/* send as much of the buffered request metrics as the socket takes without blocking and keep the rest.
+ * The rest might start within a record, so it must be sent over the same connection. Caller must hold the batch mutex */
+static int prometheus_status_batch_send_nonblocking(prometheus_status_batch *batch) {
+    ssize_t nbytes;
+
+    // a new connection only starts with complete records, so they are kept until the collector accepts again
+    if(!prometheus_status_open_socket(&batch->fd, TRUE)) {
+        return(FALSE);
+    }
+    do {
+        nbytes = send(batch->fd, batch->buf, batch->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while(nbytes < 0 && errno == EINTR);
+    if(nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return(TRUE);
+    }
+    if(nbytes < 0) {
+        logDebugf("failed to send to metrics collector: socket:%s fd:%d errno:%d (%s)", metric_socket, batch->fd, errno, strerror(errno));
+        prometheus_status_count_send_failure(errno);
+        prometheus_status_close_communication_socket(&batch->fd);
+        // only the rest of a partially sent update is lost, complete updates are sent over the next connection
+        if(batch->partial > 0) {
+            memmove(batch->buf, batch->buf + batch->partial, batch->len - batch->partial);
+            batch->len    -= batch->partial;
+            batch->partial = 0;
+            if(batch->pending > 0) {
+                batch->pending--;
+            }
+            prometheus_status_count_drops(1);
+        }
+        return(FALSE);
+    }
+    prometheus_status_batch_sent(batch, nbytes);
+    return(TRUE);
+}
+
+/* send buffered request metrics, caller must hold the batch mutex */
+static int prometheus_status_batch_flush(prometheus_status_batch *batch) {
+    int rc = FALSE;
+
+    if(batch->len == 0) {
+        return(TRUE);
+    }
+    if(config.send_mode == PROMETHEUS_STATUS_SEND_NONBLOCKING && config.socket_type == PROMETHEUS_STATUS_SOCKET_STREAM) {
+        return(prometheus_status_batch_send_nonblocking(batch));
+    }
+    if(config.socket_type == PROMETHEUS_STATUS_SOCKET_DATAGRAM) {
+        rc = prometheus_status_send_datagram(&batch->dgram_fd, batch->buf, batch->len);
+    } else if(prometheus_status_open_communication_socket(&batch->fd)) {
+        rc = prometheus_status_write_communication_socket(&batch->fd, batch->buf, batch->len);
+    }
+    // drop buffered updates on errors, the collector might be gone
+    if(!rc) {
+        prometheus_status_count_drops(batch->pending);
+    }
+    batch->len     = 0;
+    batch->pending = 0;
+    return(rc);
+}
+
+/* returns TRUE if another update fits into the thread buffer, otherwise the update is counted as dropped.
+ * The buffer only fills up in non-blocking mode while the collector is busy. Caller must hold the batch mutex */
+static int prometheus_status_batch_reserve(prometheus_status_batch *batch) {
+    if(batch->len + MAXRECORDSIZE <= batch->size) {
+        return(TRUE);
+    }
+    prometheus_status_batch_flush(batch);
+    if(batch->len + MAXRECORDSIZE <= batch->size) {
+        return(TRUE);
+    }
+    prometheus_status_count_drops(1);
+    return(FALSE);
+}
+
+/* return the request metrics buffer of the current thread */
+static prometheus_status_batch *prometheus_status_batch_get(void) {
+    prometheus_status_batch *batch;
+
+    if(thread_batch != NULL) {
+        return(thread_batch);
+    }
+    // only available in child processes
+    if(child_pool == NULL) {
+        return(NULL);
+    }
+
+    apr_thread_mutex_lock(child_batches_mutex);
+    batch = apr_pcalloc(child_pool, sizeof(*batch));
+    batch->size = config.batch_bytes + MAXRECORDSIZE;
+    if(config.send_mode == PROMETHEUS_STATUS_SEND_NONBLOCKING) {
+        batch->size += SENDQUEUESIZE;
+    }
+    batch->buf = apr_palloc(child_pool, batch->size);
+    apr_thread_mutex_create(&batch->mutex, APR_THREAD_MUTEX_DEFAULT, child_pool);
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_AGGREGATE) {
+        apr_pool_create(&batch->aggregate_pool, child_pool);
+        batch->aggregates = apr_hash_make(batch->aggregate_pool);
+    }
+    APR_ARRAY_PUSH(child_batches, prometheus_status_batch *) = batch;
+    apr_thread_mutex_unlock(child_batches_mutex);
+
+    thread_batch = batch;
+    return(batch);
+}
+
+/* add nbytes written to the thread buffer and flush it when it is full or too old, caller must hold the batch mutex */
+static int prometheus_status_batch_commit(prometheus_status_batch *batch, int nbytes) {
+    apr_time_t now = apr_time_now();
+
+    if(batch->len == 0) {
+        batch->oldest = now;
+    }
+    batch->len += nbytes;
+    if(nbytes > 0) {
+        batch->pending++;
+    }
+
+    if(batch->len >= (apr_size_t)config.batch_bytes || now - batch->oldest >= apr_time_from_msec(config.flush_interval)) {
+        return(prometheus_status_batch_flush(batch));
+    }
+    return(TRUE);
+}
+
+/* append text protocol request metrics to the thread buffer */
+static int prometheus_status_send_request_metrics(const char *fmt, ...) {
+    prometheus_status_batch *batch = prometheus_status_batch_get();
+    int nbytes, rc;
+    va_list ap;
+
+    if(batch == NULL) {
+        return(FALSE);
+    }
+
+    apr_thread_mutex_lock(batch->mutex);
+    if(!prometheus_status_batch_reserve(batch)) {
+        apr_thread_mutex_unlock(batch->mutex);
+        return(FALSE);
+    }
+    va_start(ap, fmt);
+    nbytes = vsnprintf(batch->buf + batch->len, MAXRECORDSIZE, fmt, ap);
     va_end(ap);
+    if(nbytes >= MAXRECORDSIZE) {
+        logDebugf("metrics update too large: %d bytes", nbytes);
+        nbytes = 0;
+    }
+    rc = prometheus_status_batch_commit(batch, nbytes);
+    apr_thread_mutex_unlock(batch->mutex);
+    return(rc);
+}
+
+/* write the binary protocol record header for a record of len bytes */
+static void prometheus_status_encode_header(char *buf, apr_size_t len, unsigned char metric, int num_labels, apr_uint64_t value) {
+    apr_uint16_t field = (apr_uint16_t)len;
 
-    if(write(*fd, buffer, nbytes) < 0) {
-        logDebugf("failed to send to metrics collector: socket:%s fd:%d errno:%d (%s)", metric_socket, *fd, errno, strerror(errno));
-        prometheus_status_close_communication_socket(fd);
-    }
-    return *fd != 0;
-}
-
-/* gather non-request runtime metrics */
-static int prometheus_status_monitor() {
-    int busy = 0;
-    int ready = 0;
-    int i, j, res;
-    worker_score *ws_record;
-    process_score *ps_record;
-    ap_generation_t mpm_generation;
-    apr_interval_time_t uptime;
-    apr_time_t nowtime;
-    ap_loadavg_t cpu;
-
-    status_flags[SERVER_DEAD]           = 0;
-    status_flags[SERVER_READY]          = 0;
-    status_flags[SERVER_STARTING]       = 0;
-    status_flags[SERVER_BUSY_READ]      = 0;
-    status_flags[SERVER_BUSY_WRITE]     = 0;
-    status_flags[SERVER_BUSY_KEEPALIVE] = 0;
-    status_flags[SERVER_BUSY_LOG]       = 0;
-    status_flags[SERVER_BUSY_DNS]       = 0;
-    status_flags[SERVER_CLOSING]        = 0;
-    status_flags[SERVER_GRACEFUL]       = 0;
-    status_flags[SERVER_IDLE_KILL]      = 0;
-    status_flags[SERVER_DISABLED]       = 0;
-
-    ap_mpm_query(AP_MPMQ_GENERATION, &mpm_generation);
-
-    nowtime = apr_time_now();
-    uptime = (apr_uint32_t) apr_time_sec(nowtime - ap_scoreboard_image->global->restart_time);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promServerUptime;%ld\n", uptime);
-
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promMPMGeneration;%d\n", mpm_generation);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promConfigGeneration;%d\n", ap_state_query(AP_SQ_CONFIG_GEN));
-
-    ap_get_loadavg(&cpu);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promCPULoad;%f\n", cpu.loadavg);
-
-    for(i = 0; i < server_limit; ++i) {
-        ps_record = ap_get_scoreboard_process(i);
-        for(j = 0; j < thread_limit; ++j) {
-            ws_record = ap_get_scoreboard_worker_from_indexes(i, j);
-            res = ws_record->status;
-
-            if ((i >= max_servers || j >= threads_per_child)
-                && (res == SERVER_DEAD))
-                status_flags[SERVER_DISABLED]++;
-            else
-                status_flags[res]++;
-
-            if(!ps_record->quiescing && ps_record->pid) {
-                if(res == SERVER_READY) {
-                    if(ps_record->generation == mpm_generation)
-                        ready++;
+    buf[0] = (char)PROMETHEUS_STATUS_PROTO_MAGIC;
+    buf[1] = PROMETHEUS_STATUS_PROTO_VERSION;
+    memcpy(buf + 2, &field, 2);
+    buf[4] = metric;
+    buf[5] = (char)num_labels;
+    memcpy(buf + 6, &value, 8);
+}
+
+/* encode a binary protocol record, returns the record size or -1 if it does not fit into size.
+ * Fields are only used for PROMETHEUS_STATUS_METRIC_REQUEST records.
+ * Uses the interned label set id instead of the labels unless id is negative. */
+static int prometheus_status_encode_record(char *buf, apr_size_t size, unsigned char metric, apr_uint64_t value,
+                                           const apr_uint64_t *fields, int num_fields,
+                                           const char **labels, int num_labels, apr_int64_t id) {
+    apr_size_t len = PROMETHEUS_STATUS_PROTO_HEADER_SIZE;
+    apr_uint16_t field;
+    apr_uint32_t label_id;
+    apr_size_t label_len;
+    int i;
+
+    // the record length must fit into 16 bit
+    if(size > 65535) {
+        size = 65535;
+    }
+    if(num_labels > PROMETHEUS_STATUS_PROTO_MAX_LABELS || len + 1 + num_fields * 8 + sizeof(label_id) > size) {
+        return(-1);
+    }
+    if(metric == PROMETHEUS_STATUS_METRIC_REQUEST) {
+        buf[len] = (char)num_fields;
+        memcpy(buf + len + 1, fields, num_fields * 8);
+        len += 1 + num_fields * 8;
+    }
+    if(id >= 0) {
+        label_id   = (apr_uint32_t)id;
+        num_labels = PROMETHEUS_STATUS_PROTO_INTERNED;
+        memcpy(buf + len, &label_id, sizeof(label_id));
+        len += sizeof(label_id);
+    }
+    for(i = 0; id < 0 && i < num_labels; i++) {
+        label_len = strlen(labels[i]);
+        if(len + 2 + label_len > size) {
+            return(-1);
+        }
+        field = (apr_uint16_t)label_len;
+        memcpy(buf + len, &field, 2);
+        memcpy(buf + len + 2, labels[i], label_len);
+        len += 2 + label_len;
+    }
+
+    prometheus_status_encode_header(buf, len, metric, num_labels, value);
+    return((int)len);
+}
+
+/* append binary protocol request metrics to the thread buffer */
+static int prometheus_status_send_request_record(unsigned char metric, apr_uint64_t value, const apr_uint64_t *fields, int num_fields,
+                                                 const char **labels, int num_labels, apr_int64_t id) {
+    prometheus_status_batch *batch = prometheus_status_batch_get();
+    int nbytes, rc;
+
+    if(batch == NULL) {
+        return(FALSE);
+    }
+
+    apr_thread_mutex_lock(batch->mutex);
+    if(!prometheus_status_batch_reserve(batch)) {
+        apr_thread_mutex_unlock(batch->mutex);
+        return(FALSE);
+    }
+    nbytes = prometheus_status_encode_record(batch->buf + batch->len, MAXRECORDSIZE, metric, value, fields, num_fields, labels, num_labels, id);
+    if(nbytes < 0) {
+        logDebugf("metrics update too large");
+        nbytes = 0;
+    }
+    rc = prometheus_status_batch_commit(batch, nbytes);
+    apr_thread_mutex_unlock(batch->mutex);
+    return(rc);
+}
+
+/* return the collector label set id for the label values, interns them on first use. Returns -1 if the labels cannot be interned */
+static apr_int64_t prometheus_status_intern_labels(const char **labels, int num_labels) {
+    prometheus_status_batch *batch;
+    char buf[MAXRECORDSIZE];
+    const char *key;
+    apr_uint32_t *id;
+    apr_uint32_t reply;
+    apr_uint64_t generation;
+    apr_ssize_t key_len;
+    int len, full, stale, rc = FALSE;
+
+    // intern requests wait for the reply of the collector, so labels are always sent along in non-blocking mode.
+    // Without the stats shm, released ids could not be noticed
+    if(child_interned == NULL || stats == NULL || config.send_mode == PROMETHEUS_STATUS_SEND_NONBLOCKING) {
+        return(-1);
+    }
+    len = prometheus_status_encode_record(buf, MAXRECORDSIZE, PROMETHEUS_STATUS_METRIC_INTERN, 0, NULL, 0, labels, num_labels, -1);
+    if(len < 0) {
+        return(-1);
+    }
+    key     = buf + PROMETHEUS_STATUS_PROTO_HEADER_SIZE;
+    key_len = len - PROMETHEUS_STATUS_PROTO_HEADER_SIZE;
+
+    generation = __atomic_load_n(&stats->interned_generation, __ATOMIC_ACQUIRE);
+    apr_thread_rwlock_rdlock(child_interned_lock);
+    stale = generation != child_interned_generation;
+    id = apr_hash_get(child_interned, key, key_len);
+    full = apr_hash_count(child_interned) >= MAXINTERNED;
+    apr_thread_rwlock_unlock(child_interned_lock);
+    // the collector released ids of evicted label sets, so all of them are requested again
+    if(stale) {
+        apr_thread_rwlock_wrlock(child_interned_lock);
+        if(generation != child_interned_generation) {
+            apr_pool_clear(child_interned_pool);
+            child_interned = apr_hash_make(child_interned_pool);
+            child_interned_generation = generation;
+        }
+        apr_thread_rwlock_unlock(child_interned_lock);
+        id = NULL;
+        full = FALSE;
+    }
+    if(id != NULL) {
+        return(*id);
+    }
+    if(full) {
+        return(-1);
+    }
+
+    // intern requests need a reply, so they always use the stream connection
+    batch = prometheus_status_batch_get();
+    if(batch == NULL) {
+        return(-1);
+    }
+    apr_thread_mutex_lock(batch->mutex);
+    if(prometheus_status_open_communication_socket(&batch->fd)
+       && prometheus_status_write_communication_socket(&batch->fd, buf, len)) {
+        rc = prometheus_status_read_communication_socket(&batch->fd, (char *)&reply, sizeof(reply));
+    }
+    apr_thread_mutex_unlock(batch->mutex);
+    if(!rc) {
+        return(-1);
+    }
+
+    // the reply might be a released id already if the generation changed meanwhile
+    apr_thread_rwlock_wrlock(child_interned_lock);
+    if(generation == child_interned_generation && apr_hash_get(child_interned, key, key_len) == NULL) {
+        id  = apr_palloc(child_interned_pool, sizeof(*id));
+        *id = reply;
+        apr_hash_set(child_interned, apr_pmemdup(child_interned_pool, key, key_len), key_len, id);
+    }
+    apr_thread_rwlock_unlock(child_interned_lock);
+
+    return(reply);
+}
+
+/* copy the request metrics buffers of this child into snapshot, so the flusher can send them without holding the
+ * child batches mutex. Caller must hold the child batches mutex, buffers are only freed along with the child pool */
+static void prometheus_status_batch_snapshot(apr_array_header_t *snapshot) {
+    snapshot->nelts = 0;
+    apr_array_cat(snapshot, child_batches);
+}
+
+/* flush all request metrics buffers of the snapshot which are older than max_age */
+static void prometheus_status_batch_flush_all(apr_array_header_t *snapshot, apr_interval_time_t max_age) {
+    prometheus_status_batch **batches = (prometheus_status_batch **)snapshot->elts;
+    apr_time_t now = apr_time_now();
+    int i;
+
+    for(i = 0; i < snapshot->nelts; i++) {
+        // busy buffers are checked by their own thread anyway
+        if(apr_thread_mutex_trylock(batches[i]->mutex) != APR_SUCCESS) {
+            continue;
+        }
+        if(batches[i]->len > 0 && now - batches[i]->oldest >= max_age) {
+            prometheus_status_batch_flush(batches[i]);
+        }
+        apr_thread_mutex_unlock(batches[i]->mutex);
+    }
+}
+
+/* add the deltas of aggregate records the collector did not get back to the table, so the next flush sends them.
+ * The first skip bytes have been sent, a record cut off by an error counts as not sent. Caller must hold the batch mutex */
+static void prometheus_status_aggregate_remerge(prometheus_status_batch *batch, const char *buf, apr_size_t len, apr_size_t skip) {
+    prometheus_status_aggregate *agg;
+    apr_size_t offset = 0, record_len, fields_len;
+    apr_uint64_t value, *bins;
+    apr_uint16_t field;
+    int i, j, num_fields;
+
+    while(offset + PROMETHEUS_STATUS_PROTO_HEADER_SIZE < len) {
+        memcpy(&field, buf + offset + 2, 2);
+        record_len = field;
+        if(offset + record_len > skip) {
+            num_fields = (unsigned char)buf[offset + PROMETHEUS_STATUS_PROTO_HEADER_SIZE];
+            fields_len = num_fields * sizeof(apr_uint64_t);
+            agg = apr_hash_get(batch->aggregates, buf + offset + PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1 + fields_len,
+                               record_len - PROMETHEUS_STATUS_PROTO_HEADER_SIZE - 1 - fields_len);
+            if(agg == NULL) {
+                prometheus_status_count_drops(1);
+                offset += record_len;
+                continue;
+            }
+            for(i = 0; i < num_fields; i++) {
+                memcpy(&value, buf + offset + PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1 + i * sizeof(apr_uint64_t), sizeof(value));
+                if(i < aggregate_num_values) {
+                    agg->values[i] += value;
+                    continue;
+                }
+                // sketch bins are encoded as index << 32 | count
+                if(agg->sketch == NULL) {
+                    agg->sketch = apr_array_make(batch->aggregate_pool, 16, sizeof(apr_uint64_t));
                 }
-                else if (res != SERVER_DEAD &&
-                         res != SERVER_STARTING &&
-                         res != SERVER_IDLE_KILL) {
-                    busy++;
+                bins = (apr_uint64_t *)agg->sketch->elts;
+                for(j = 0; j < agg->sketch->nelts && (bins[j] >> 32) != (value >> 32); j++);
+                if(j < agg->sketch->nelts) {
+                    bins[j] += value & 0xffffffff;
+                } else {
+                    APR_ARRAY_PUSH(agg->sketch, apr_uint64_t) = value;
                 }
             }
+            agg->dirty = TRUE;
         }
+        offset += record_len;
     }
+}
 
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;idle\n",          status_flags[SERVER_READY]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;startup\n",       status_flags[SERVER_STARTING]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;read\n",          status_flags[SERVER_BUSY_READ]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;reply\n",         status_flags[SERVER_BUSY_WRITE]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;keepalive\n",     status_flags[SERVER_BUSY_KEEPALIVE]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;logging\n",       status_flags[SERVER_BUSY_LOG]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;closing\n",       status_flags[SERVER_CLOSING]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;graceful_stop\n", status_flags[SERVER_GRACEFUL]);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;idle_cleanup\n",  status_flags[SERVER_IDLE_KILL]);
-    // disabled slots are not actual worker
-    //prometheus_status_send_communication_socket(&metric_socket_fd, "server:promScoreboard;%d;disabled\n",      status_flags[SERVER_DISABLED]);
+/* send aggregate records, in non-blocking mode without waiting for the collector. sent is set to the number of bytes written */
+static int prometheus_status_aggregate_send(int *fd, const char *buf, apr_size_t len, apr_size_t *sent) {
+    *sent = 0;
+    if(config.send_mode == PROMETHEUS_STATUS_SEND_NONBLOCKING) {
+        return(prometheus_status_open_socket(fd, TRUE) && prometheus_status_write_socket(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT, sent));
+    }
+    return(prometheus_status_open_communication_socket(fd) && prometheus_status_write_socket(fd, buf, len, MSG_NOSIGNAL, sent));
+}
 
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promWorkers;%d;ready\n", ready);
-    prometheus_status_send_communication_socket(&metric_socket_fd, "server:promWorkers;%d;busy\n", busy);
+/* returns the number of label sets with deltas which have not been sent yet, caller must hold the batch mutex */
+static int prometheus_status_aggregate_pending(prometheus_status_batch *batch) {
+    apr_hash_index_t *hi;
+    int pending = 0;
 
-    return OK;
+    for(hi = apr_hash_first(NULL, batch->aggregates); hi != NULL; hi = apr_hash_next(hi)) {
+        if(((prometheus_status_aggregate *)apr_hash_this_val(hi))->dirty) {
+            pending++;
+        }
+    }
+    return(pending);
+}
+
+/* send the deltas of all label sets updated since the last flush and reset them. Deltas the collector does not
+ * take are kept for the next flush, also in non-blocking mode. Caller must hold the batch mutex */
+static int prometheus_status_aggregate_flush(prometheus_status_batch *batch, int *fd) {
+    char buf[AGGREGATEBUFSIZE];
+    prometheus_status_aggregate *agg;
+    apr_hash_index_t *hi;
+    apr_size_t len = 0, sent = 0, record_len, bins_len, values_len = aggregate_num_values * sizeof(apr_uint64_t);
+    apr_uint64_t *bins;
+    int num_bins, chunk, values_encoded, rc = TRUE;
+
+    for(hi = apr_hash_first(NULL, batch->aggregates); hi != NULL && rc; hi = apr_hash_next(hi)) {
+        agg = apr_hash_this_val(hi);
+        if(!agg->dirty) {
+            continue;
+        }
+        bins     = agg->sketch != NULL ? (apr_uint64_t *)agg->sketch->elts : NULL;
+        num_bins = agg->sketch != NULL ? agg->sketch->nelts : 0;
+        values_encoded = FALSE;
+        // the number of fields is limited, further sketch bins follow in records with zero values
+        do {
+            chunk      = num_bins < 255 - aggregate_num_values ? num_bins : 255 - aggregate_num_values;
+            bins_len   = chunk * sizeof(apr_uint64_t);
+            record_len = PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1 + values_len + bins_len + agg->key_len;
+            if(len + record_len > sizeof(buf)) {
+                rc = prometheus_status_aggregate_send(fd, buf, len, &sent);
+                if(!rc) {
+                    break;
+                }
+                len = 0;
+            }
+            // the key contains the encoded label values, so it is copied into the record as is
+            buf[len + PROMETHEUS_STATUS_PROTO_HEADER_SIZE] = (char)(aggregate_num_values + chunk);
+            memcpy(buf + len + PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1, agg->values, values_len);
+            if(chunk > 0) {
+                memcpy(buf + len + PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1 + values_len, bins, bins_len);
+            }
+            memcpy(buf + len + PROMETHEUS_STATUS_PROTO_HEADER_SIZE + 1 + values_len + bins_len, agg->key, agg->key_len);
+            prometheus_status_encode_header(buf + len, record_len, PROMETHEUS_STATUS_METRIC_AGGREGATE, agg->num_labels, 0);
+            len += record_len;
+
+            memset(agg->values, 0, values_len);
+            values_encoded = TRUE;
+            bins     += chunk;
+            num_bins -= chunk;
+        } while(num_bins > 0);
+        // bins which have not been encoded because the collector went away stay in the sketch
+        if(agg->sketch != NULL) {
+            if(num_bins > 0) {
+                memmove(agg->sketch->elts, bins, num_bins * sizeof(apr_uint64_t));
+            }
+            agg->sketch->nelts = num_bins;
+        }
+        agg->dirty = !values_encoded || num_bins > 0;
+    }
+    if(rc && len > 0) {
+        rc = prometheus_status_aggregate_send(fd, buf, len, &sent);
+    }
+    // records the collector did not get completely are added to the table again
+    if(!rc) {
+        prometheus_status_aggregate_remerge(batch, buf, len, sent);
+    }
+    return(rc);
+}
+
+/* count a response time in the sketch bins of the label set, see PROMETHEUS_STATUS_SKETCH_ACCURACY */
+static void prometheus_status_aggregate_sketch(apr_pool_t *pool, prometheus_status_aggregate *agg, apr_time_t duration) {
+    apr_uint64_t idx = duration > 1 ? (apr_uint64_t)ceil(log((double)duration) / sketch_log_gamma) : 0;
+    apr_uint64_t *bins;
+    int i;
+
+    if(agg->sketch == NULL) {
+        agg->sketch = apr_array_make(pool, 16, sizeof(apr_uint64_t));
+    }
+    // response times cluster in a few bins, so a linear search is fast enough
+    bins = (apr_uint64_t *)agg->sketch->elts;
+    for(i = 0; i < agg->sketch->nelts; i++) {
+        if((bins[i] >> 32) == idx) {
+            bins[i]++;
+            return;
+        }
+    }
+    APR_ARRAY_PUSH(agg->sketch, apr_uint64_t) = (idx << 32) | 1;
+}
+
+/* add a single request to the aggregated metrics of the current thread */
+static int prometheus_status_aggregate_request(const char **labels, int num_labels, apr_time_t duration, apr_off_t bytes) {
+    prometheus_status_batch *batch = prometheus_status_batch_get();
+    prometheus_status_aggregate *agg;
+    apr_uint64_t *buckets;
+    char buf[MAXRECORDSIZE];
+    const char *key;
+    apr_ssize_t key_len;
+    double seconds;
+    uint32_t i;
+    int len;
+
+    if(batch == NULL || batch->aggregates == NULL) {
+        return(FALSE);
+    }
+    // encode the label values like an intern request, the encoded labels are the table key
+    len = prometheus_status_encode_record(buf, MAXRECORDSIZE, PROMETHEUS_STATUS_METRIC_INTERN, 0, NULL, 0, labels, num_labels, -1);
+    if(len < 0) {
+        logDebugf("metrics update too large");
+        return(FALSE);
+    }
+    key     = buf + PROMETHEUS_STATUS_PROTO_HEADER_SIZE;
+    key_len = len - PROMETHEUS_STATUS_PROTO_HEADER_SIZE;
+
+    if(duration < 0) {
+        duration = 0;
+    }
+    if(bytes < 0) {
+        bytes = 0;
+    }
+
+    apr_thread_mutex_lock(batch->mutex);
+    agg = apr_hash_get(batch->aggregates, key, key_len);
+    if(agg == NULL) {
+        // keep the table bounded, this also drops label sets which are not used anymore.
+        // The table is kept while the collector does not take the deltas, new label sets are dropped meanwhile.
+        if(apr_hash_count(batch->aggregates) >= MAXAGGREGATES) {
+            if(!prometheus_status_aggregate_flush(batch, &batch->fd)) {
+                prometheus_status_count_drops(1);
+                apr_thread_mutex_unlock(batch->mutex);
+                return(FALSE);
+            }
+            apr_pool_clear(batch->aggregate_pool);
+            batch->aggregates = apr_hash_make(batch->aggregate_pool);
+        }
+        agg = apr_pcalloc(batch->aggregate_pool, sizeof(*agg) + (aggregate_num_values - 1) * sizeof(apr_uint64_t));
+        agg->key        = apr_pmemdup(batch->aggregate_pool, key, key_len);
+        agg->key_len    = key_len;
+        agg->num_labels = num_labels;
+        apr_hash_set(batch->aggregates, agg->key, key_len, agg);
+    }
+
+    agg->values[PROMETHEUS_STATUS_SHM_REC_REQUESTS]++;
+    agg->values[PROMETHEUS_STATUS_SHM_REC_TIME_SUM] += (apr_uint64_t)duration;
+    agg->values[PROMETHEUS_STATUS_SHM_REC_SIZE_SUM] += (apr_uint64_t)bytes;
+
+    buckets = &agg->values[PROMETHEUS_STATUS_SHM_REC_BUCKETS];
+    seconds = duration / (double)APR_USEC_PER_SEC;
+    for(i = 0; i < aggregate_num_time_buckets && seconds > aggregate_time_buckets[i]; i++);
+    buckets[i]++;
+
+    buckets += aggregate_num_time_buckets + 1;
+    for(i = 0; i < aggregate_num_size_buckets && (double)bytes > aggregate_size_buckets[i]; i++);
+    buckets[i]++;
+
+    if(sketch_log_gamma > 0) {
+        prometheus_status_aggregate_sketch(batch->aggregate_pool, agg, duration);
+    }
+    agg->dirty = TRUE;
+    apr_thread_mutex_unlock(batch->mutex);
+    return(TRUE);
+}
+
+/* send aggregated request metrics of all threads of the snapshot */
+static void prometheus_status_aggregate_flush_all(apr_array_header_t *snapshot) {
+    prometheus_status_batch **batches = (prometheus_status_batch **)snapshot->elts;
+    int i;
+
+    for(i = 0; i < snapshot->nelts; i++) {
+        // workers only hold the mutex for a table update, so this does not wait long
+        apr_thread_mutex_lock(batches[i]->mutex);
+        prometheus_status_aggregate_flush(batches[i], &child_aggregate_fd);
+        apr_thread_mutex_unlock(batches[i]->mutex);
+    }
+}
+
+/* wait until the futex word in shared memory differs from val, a wake up or timeout */
+static void prometheus_status_futex_wait(apr_uint32_t *word, apr_uint32_t val, apr_interval_time_t timeout) {
+    struct timespec ts;
+
+    ts.tv_sec  = apr_time_sec(timeout);
+    ts.tv_nsec = apr_time_usec(timeout) * 1000;
+    syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+/* wake up all processes waiting on the futex word in shared memory */
+static void prometheus_status_futex_wake(apr_uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* tell scrapes waiting for a forced flush that this child has sent everything up to epoch */
+static void prometheus_status_aggregate_ack(apr_uint64_t epoch) {
+    int i;
+
+    if(flush_control == NULL) {
+        return;
+    }
+    // the parent sets the pid after forking, so the process slot is looked up lazily
+    for(i = 0; child_slot < 0 && i < server_limit; i++) {
+        if(ap_get_scoreboard_process(i)->pid == getpid()) {
+            child_slot = i;
+        }
+    }
+    if(child_slot >= 0) {
+        __atomic_store_n(&flush_control->flushed[child_slot], epoch, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&flush_control->acks, 1, __ATOMIC_RELEASE);
+        prometheus_status_futex_wake(&flush_control->acks);
+    }
+}
+
+/* background thread which sends aggregated request metrics every flush interval and whenever a scrape asks for it */
+static void * APR_THREAD_FUNC prometheus_status_aggregate_flusher(apr_thread_t *thread, void *data) {
+    apr_interval_time_t interval = apr_time_from_msec(config.flush_interval);
+    apr_time_t now, last_flush = apr_time_now();
+    apr_uint64_t epoch, flushed = 0;
+    apr_array_header_t *snapshot = apr_array_make(apr_thread_pool_get(thread), 16, sizeof(prometheus_status_batch *));
+
+    apr_thread_mutex_lock(child_batches_mutex);
+    while(child_flusher_running) {
+        apr_thread_cond_timedwait(child_flusher_cond, child_batches_mutex, apr_time_from_msec(AGGREGATEPOLLINTERVAL));
+        epoch = flush_control != NULL ? __atomic_load_n(&flush_control->epoch, __ATOMIC_ACQUIRE) : 0;
+        now = apr_time_now();
+        if(epoch == flushed && now - last_flush < interval) {
+            continue;
+        }
+        // workers registering their first request must not wait for a slow collector
+        prometheus_status_batch_snapshot(snapshot);
+        apr_thread_mutex_unlock(child_batches_mutex);
+        prometheus_status_aggregate_flush_all(snapshot);
+        prometheus_status_aggregate_ack(epoch);
+        apr_thread_mutex_lock(child_batches_mutex);
+        last_flush = now;
+        flushed = epoch;
+    }
+    apr_thread_mutex_unlock(child_batches_mutex);
+
+    apr_thread_exit(thread, APR_SUCCESS);
+    return(NULL);
+}
+
+/* background thread which sends buffered request metrics of idle worker threads */
+static void * APR_THREAD_FUNC prometheus_status_flusher(apr_thread_t *thread, void *data) {
+    apr_interval_time_t interval = apr_time_from_msec(config.flush_interval) / 2;
+    apr_array_header_t *snapshot = apr_array_make(apr_thread_pool_get(thread), 16, sizeof(prometheus_status_batch *));
+
+    apr_thread_mutex_lock(child_batches_mutex);
+    while(child_flusher_running) {
+        apr_thread_cond_timedwait(child_flusher_cond, child_batches_mutex, interval);
+        prometheus_status_batch_snapshot(snapshot);
+        apr_thread_mutex_unlock(child_batches_mutex);
+        prometheus_status_batch_flush_all(snapshot, interval);
+        apr_thread_mutex_lock(child_batches_mutex);
+    }
+    apr_thread_mutex_unlock(child_batches_mutex);
+
+    apr_thread_exit(thread, APR_SUCCESS);
+    return(NULL);
+}
+
+/* stop the flusher thread and send all remaining request metrics on child exit */
+static apr_status_t prometheus_status_child_cleanup(void *data) {
+    apr_status_t rv;
+    prometheus_status_batch **batches;
+    int i;
+
+    if(child_flusher != NULL) {
+        apr_thread_mutex_lock(child_batches_mutex);
+        child_flusher_running = FALSE;
+        apr_thread_cond_signal(child_flusher_cond);
+        apr_thread_mutex_unlock(child_batches_mutex);
+        apr_thread_join(&rv, child_flusher);
+        child_flusher = NULL;
+    }
+
+    apr_thread_mutex_lock(child_batches_mutex);
+    batches = (prometheus_status_batch **)child_batches->elts;
+    for(i = 0; i < child_batches->nelts; i++) {
+        apr_thread_mutex_lock(batches[i]->mutex);
+        prometheus_status_batch_flush(batches[i]);
+        // only non-blocking mode keeps updates the collector did not take
+        prometheus_status_count_drops(batches[i]->pending);
+        // the child exits, deltas the collector did not take are lost
+        if(batches[i]->aggregates != NULL && !prometheus_status_aggregate_flush(batches[i], &child_aggregate_fd)) {
+            prometheus_status_count_drops(prometheus_status_aggregate_pending(batches[i]));
+        }
+        prometheus_status_close_communication_socket(&batches[i]->fd);
+        prometheus_status_close_communication_socket(&batches[i]->dgram_fd);
+        apr_thread_mutex_unlock(batches[i]->mutex);
+    }
+    prometheus_status_close_communication_socket(&child_aggregate_fd);
+    apr_thread_mutex_unlock(child_batches_mutex);
+    child_pool = NULL;
+    child_interned = NULL;
+    return(APR_SUCCESS);
+}
+
+/* prometheus_status_child_init sets up the request metrics buffers */
+static void prometheus_status_child_init(apr_pool_t *p, server_rec *s) {
+    apr_thread_start_t flusher = prometheus_status_flusher;
+    apr_status_t rv;
+
+    apr_pool_create(&child_pool, p);
+    child_batches = apr_array_make(child_pool, 16, sizeof(prometheus_status_batch *));
+    apr_thread_mutex_create(&child_batches_mutex, APR_THREAD_MUTEX_DEFAULT, child_pool);
+    apr_thread_cond_create(&child_flusher_cond, child_pool);
+    apr_pool_create(&child_interned_pool, child_pool);
+    child_interned = apr_hash_make(child_interned_pool);
+    child_interned_generation = stats != NULL ? __atomic_load_n(&stats->interned_generation, __ATOMIC_ACQUIRE) : 0;
+    apr_thread_rwlock_create(&child_interned_lock, child_pool);
+    // pre cleanups run before the child pool and its mutexes get destroyed
+    apr_pool_pre_cleanup_register(p, NULL, prometheus_status_child_cleanup);
+
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_AGGREGATE) {
+        flusher = prometheus_status_aggregate_flusher;
+    } else if(config.backend != PROMETHEUS_STATUS_BACKEND_SOCKET) {
+        return;
+    } else if(config.batch_bytes == 0 && config.send_mode == PROMETHEUS_STATUS_SEND_BLOCKING) {
+        // without batching the buffer is only kept in non-blocking mode, if the collector has been busy
+        return;
+    }
+
+    child_flusher_running = TRUE;
+    rv = apr_thread_create(&child_flusher, NULL, flusher, NULL, child_pool);
+    if(rv != APR_SUCCESS) {
+        logErrorf("failed to start request metrics flusher thread: %d", rv);
+        child_flusher_running = FALSE;
+        child_flusher = NULL;
+    }
+}
+
+/* force a flush of the aggregated request metrics of all children unless they are at most max_staleness old.
+ * Waits at most one flush interval, children which do not answer in time are flushed by their interval anyway. */
+static void prometheus_status_aggregate_force_flush(void) {
+    apr_time_t now = apr_time_now();
+    apr_time_t deadline;
+    apr_uint64_t epoch;
+    apr_uint32_t acks;
+    process_score *ps;
+    int i, pending;
+
+    // regular flushes already satisfy the bound
+    if(flush_control == NULL || config.max_staleness == 0 || config.max_staleness >= config.flush_interval) {
+        return;
+    }
+    // another scrape forced a flush recently enough
+    if(now - __atomic_load_n(&flush_control->requested, __ATOMIC_RELAXED) < apr_time_from_msec(config.max_staleness)) {
+        return;
+    }
+    __atomic_store_n(&flush_control->requested, now, __ATOMIC_RELAXED);
+    epoch = __atomic_add_fetch(&flush_control->epoch, 1, __ATOMIC_ACQ_REL);
+
+    deadline = now + apr_time_from_msec(config.flush_interval);
+    for(;;) {
+        // read before checking the children, so an ack in between ends the wait right away
+        acks = __atomic_load_n(&flush_control->acks, __ATOMIC_ACQUIRE);
+        pending = FALSE;
+        for(i = 0; i < server_limit && !pending; i++) {
+            ps = ap_get_scoreboard_process(i);
+            if(ps->pid == 0 || ps->quiescing) {
+                continue;
+            }
+            pending = __atomic_load_n(&flush_control->flushed[i], __ATOMIC_ACQUIRE) < epoch;
+        }
+        now = apr_time_now();
+        if(!pending || now >= deadline) {
+            return;
+        }
+        prometheus_status_futex_wait(&flush_control->acks, acks, deadline - now);
+    }
+}
+
+/* read the metrics reply header: content type and body length, each terminated by a newline.
+ * Returns the header length or 0 on errors. Data read beyond the header stays in buffer, len
+ * contains the total number of bytes read. A memfd containing the body might be attached. */
+static apr_size_t prometheus_status_read_metrics_header(int fd, char *buffer, apr_size_t size, apr_size_t *len, int *body_fd) {
+    union {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t nbytes;
+    char *eol;
+
+    *len     = 0;
+    *body_fd = -1;
+    while(*len < size) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base       = buffer + *len;
+        iov.iov_len        = size - *len;
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        nbytes = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if(nbytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if(nbytes <= 0) {
+            break;
+        }
+        for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && *body_fd == -1) {
+                memcpy(body_fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+        *len += nbytes;
+        eol = memchr(buffer, '\n', *len);
+        if(eol != NULL && (eol = memchr(eol + 1, '\n', *len - (eol + 1 - buffer))) != NULL) {
+            return(eol + 1 - buffer);
+        }
+    }
+    if(*body_fd != -1) {
+        close(*body_fd);
+        *body_fd = -1;
+    }
+    return(0);
 }
 
-/* prometheus_status_handler responds to /metrics requests */
+/* add the memfd containing the metrics to the brigade, so the core can use sendfile or mmap */
+static int prometheus_status_metrics_from_fd(request_rec *r, apr_bucket_brigade *bb, int body_fd, apr_off_t body_len) {
+    apr_file_t *file;
+    apr_status_t rv;
+
+    // reopening gives this worker its own file offset, the received descriptor shares it with the collector
+    rv = apr_file_open(&file, apr_psprintf(r->pool, "/proc/self/fd/%d", body_fd), APR_FOPEN_READ | APR_FOPEN_BINARY, APR_OS_DEFAULT, r->pool);
+    close(body_fd);
+    if(rv != APR_SUCCESS) {
+        logErrorf("failed to open metrics memfd: %d", rv);
+        return(FALSE);
+    }
+    apr_brigade_insert_file(bb, file, 0, body_len, r->pool);
+    return(TRUE);
+}
+
+/* stream the metrics following the header into the output filters without copying them again */
+static int prometheus_status_metrics_from_socket(request_rec *r, apr_bucket_brigade *bb, const char *data, apr_size_t len, apr_off_t body_len) {
+    apr_bucket_alloc_t *ba = r->connection->bucket_alloc;
+    apr_size_t chunk_size;
+    char *chunk;
+    ssize_t nbytes;
+
+    if(len > 0) {
+        apr_brigade_write(bb, NULL, NULL, data, len);
+        body_len -= len;
+    }
+    while(body_len > 0) {
+        chunk_size = body_len < METRICSCHUNKSIZE ? (apr_size_t)body_len : METRICSCHUNKSIZE;
+        chunk = apr_bucket_alloc(chunk_size, ba);
+        nbytes = read(metric_socket_fd, chunk, chunk_size);
+        if(nbytes < 0 && errno == EINTR) {
+            apr_bucket_free(chunk);
+            continue;
+        }
+        if(nbytes <= 0) {
+            apr_bucket_free(chunk);
+            logErrorf("reading metrics failed: socket:%s fd:%d errno:%d (%s)", metric_socket, metric_socket_fd, errno, strerror(errno));
+            prometheus_status_count_read_failure();
+            return(FALSE);
+        }
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_heap_create(chunk, nbytes, apr_bucket_free, ba));
+        body_len -= nbytes;
+        if(ap_pass_brigade(r->output_filters, bb) != APR_SUCCESS) {
+            return(FALSE);
+        }
+        apr_brigade_cleanup(bb);
+    }
+    return(TRUE);
+}
+
+/* prometheus_status_handler responds to /metrics requests and lists the oldest requests in flight */
 static int prometheus_status_handler(request_rec *r) {
-    int nbytes;
+    int gzip, inflight, body_fd, rc;
+    apr_size_t len, header_len;
+    apr_off_t body_len;
     char buffer[32768];
+    char *eol, *end;
+    const char *accept_encoding, *accept;
+    apr_bucket_brigade *bb;
 
     // is the module enabled at all?
     prometheus_status_config *config = (prometheus_status_config*) ap_get_module_config(r->server->module_config, &prometheus_status_module);
@@ -297,41 +1563,71 @@ static int prometheus_status_handler(request_rec *r) {
         return(OK);
     }
 
-    if(!r->handler || strcmp(r->handler, "prometheus-metrics")) return(DECLINED);
+    if(!r->handler) return(DECLINED);
+    inflight = !strcmp(r->handler, "prometheus-inflight");
+    if(!inflight && strcmp(r->handler, "prometheus-metrics")) return(DECLINED);
     if(r->header_only) {
         return(OK);
     }
 
-    // update runtime metrics
-    prometheus_status_monitor();
-
     ap_set_content_type(r, "text/plain");
 
-    if(!prometheus_status_send_communication_socket(&metric_socket_fd, "metrics\n")) {
+    // the report is small and rendered on demand, so it is neither cached nor compressed
+    if(inflight) {
+        gzip = 0;
+        rc = prometheus_status_send_communication_socket(&metric_socket_fd, "inflight:\n");
+    } else {
+        // the collector reads runtime metrics from the scoreboard itself
+        prometheus_status_aggregate_force_flush();
+
+        // the collector compresses each rendered result once, so workers just pass it through
+        accept_encoding = apr_table_get(r->headers_in, "Accept-Encoding");
+        gzip = accept_encoding != NULL && ap_find_token(r->pool, accept_encoding, "gzip");
+        accept = apr_table_get(r->headers_in, "Accept");
+        rc = prometheus_status_send_communication_socket(&metric_socket_fd, "metrics:%s:%.1024s\n", gzip ? "gzip" : "", accept != NULL ? accept : "");
+    }
+    if(!rc) {
         ap_rputs("ERROR: failed fetch metrics\n", r);
         logErrorf("failed fetch metrics: socket:%s fd:%d", metric_socket, metric_socket_fd);
         return(HTTP_INTERNAL_SERVER_ERROR);
     }
 
-    while((nbytes = read(metric_socket_fd, buffer, 32768)) > 0) {
-        if(nbytes < 0) {
-            logErrorf("reading metrics failed: socket:%s fd:%d errno:%d (%s)", metric_socket, metric_socket_fd, errno, strerror(errno));
-            ap_rputs("ERROR: failed fetch metrics\n", r);
-            return(HTTP_INTERNAL_SERVER_ERROR);
-        }
-        if(nbytes == 0) {
-            break;
-        }
-        buffer[nbytes] = 0;
-        ap_rputs(buffer, r);
-        // double newline at the end means EOF
-        if(nbytes > 3 && buffer[nbytes-1] == '\n' && buffer[nbytes-2] == '\n') {
-            break;
+    header_len = prometheus_status_read_metrics_header(metric_socket_fd, buffer, sizeof(buffer), &len, &body_fd);
+    eol = header_len > 0 ? memchr(buffer, '\n', header_len) : NULL;
+    if(eol == NULL || apr_strtoff(&body_len, eol + 1, &end, 10) != APR_SUCCESS || *end != '\n' || body_len < 0) {
+        logErrorf("reading metrics failed: socket:%s fd:%d errno:%d (%s)", metric_socket, metric_socket_fd, errno, strerror(errno));
+        prometheus_status_count_read_failure();
+        if(body_fd != -1) {
+            close(body_fd);
         }
+        prometheus_status_close_communication_socket(&metric_socket_fd);
+        ap_rputs("ERROR: failed fetch metrics\n", r);
+        return(HTTP_INTERNAL_SERVER_ERROR);
+    }
+    ap_set_content_type(r, apr_pstrmemdup(r->pool, buffer, eol - buffer));
+    ap_set_content_length(r, body_len);
+    if(!inflight) {
+        apr_table_mergen(r->headers_out, "Vary", "Accept, Accept-Encoding");
+    }
+    if(gzip) {
+        apr_table_setn(r->headers_out, "Content-Encoding", "gzip");
     }
 
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    if(body_fd != -1) {
+        rc = prometheus_status_metrics_from_fd(r, bb, body_fd, body_len);
+    } else {
+        rc = prometheus_status_metrics_from_socket(r, bb, buffer + header_len, len - header_len, body_len);
+    }
     prometheus_status_close_communication_socket(&metric_socket_fd);
+    if(!rc) {
+        // headers might be sent already, so just abort the connection
+        r->connection->aborted = 1;
+        return(OK);
+    }
 
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(r->connection->bucket_alloc));
+    ap_pass_brigade(r->output_filters, bb);
     return(OK);
 }
 
@@ -340,7 +1636,6 @@ static int prometheus_status_counter(request_rec *r) {
     apr_time_t now = apr_time_now();
     apr_time_t duration = now - r->request_time;
 
-    int fd = 0;
     // is the module enabled at all?
     prometheus_status_config *cfg = (prometheus_status_config*) ap_get_module_config(r->per_dir_config, &prometheus_status_module);
     if(cfg->enabled == 0) {
@@ -348,13 +1643,42 @@ static int prometheus_status_counter(request_rec *r) {
     }
 
     const char *label = NULL;
-    apr_array_header_t *format = cfg->label_format != NULL ? cfg->label_format : config.label_format;
+    prometheus_status_label_format *format = cfg->label_format != NULL ? cfg->label_format : config.label_format;
+
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_AGGREGATE) {
+        const char *values[PROMETHEUS_STATUS_PROTO_MAX_LABELS];
+        int num_values = prometheus_status_expand_label_values(format, r, values, PROMETHEUS_STATUS_PROTO_MAX_LABELS);
+        prometheus_status_aggregate_request(values, num_values, duration, r->bytes_sent);
+        return(OK);
+    }
+
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_SOCKET && config.protocol == PROMETHEUS_STATUS_PROTOCOL_BINARY) {
+        const char *values[PROMETHEUS_STATUS_PROTO_MAX_LABELS];
+        int num_values = prometheus_status_expand_label_values(format, r, values, PROMETHEUS_STATUS_PROTO_MAX_LABELS);
+        double seconds = (long)duration/(double)APR_USEC_PER_SEC;
+        apr_int64_t id = prometheus_status_intern_labels(values, num_values);
+        apr_uint64_t fields[PROMETHEUS_STATUS_NUM_FIELDS];
+        apr_uint64_t value;
+
+        // send all metrics of this request in a single record
+        memcpy(&value, &seconds, sizeof(value));
+        fields[PROMETHEUS_STATUS_FIELD_RESPONSE_SIZE] = (apr_uint64_t)r->bytes_sent;
+        prometheus_status_send_request_record(PROMETHEUS_STATUS_METRIC_REQUEST, value, fields, PROMETHEUS_STATUS_NUM_FIELDS, values, num_values, id);
+        return(OK);
+    }
+
     prometheus_status_expand_variables(format, r, &label);
 
-    prometheus_status_send_communication_socket(&fd, "request:promRequests;1;%s\n", label);
-    prometheus_status_send_communication_socket(&fd, "request:promResponseTime;%f;%s\n", (long)duration/(double)APR_USEC_PER_SEC, label);
-    prometheus_status_send_communication_socket(&fd, "request:promResponseSize;%d;%s\n", (int)r->bytes_sent, label);
-    prometheus_status_close_communication_socket(&fd);
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_SHM) {
+        if(!prometheus_status_shm_update(r, label, duration, r->bytes_sent)) {
+            logDebugf("shared memory label table full, dropped update for: %s", label);
+        }
+        return(OK);
+    }
+
+    prometheus_status_send_request_metrics("request:promRequests;1;%s\n", label);
+    prometheus_status_send_request_metrics("request:promResponseTime;%f;%s\n", (long)duration/(double)APR_USEC_PER_SEC, label);
+    prometheus_status_send_request_metrics("request:promResponseSize;%d;%s\n", (int)r->bytes_sent, label);
     return(OK);
 }
 
@@ -369,8 +1693,10 @@ static apr_status_t prometheus_status_cleanup_handler() {
 }
 
 /* prometheus_status_load_gomodule loads/starts the go part */
-static void prometheus_status_load_gomodule(apr_pool_t *p, server_rec *s) {
+static void prometheus_status_load_gomodule(apr_pool_t *p, server_rec *s, int ready_fd) {
     const char* mpm_name = ap_show_mpm();
+    // the go runtime starts while loading the module, the collector reports how long it took
+    apr_time_t load_start = apr_time_now();
 
     // detect go module .so location
     void *go_module_handle = NULL;
@@ -404,7 +1730,27 @@ static void prometheus_status_load_gomodule(apr_pool_t *p, server_rec *s) {
         (char *)mpm_name,
         DEFAULTSOCKETTIMEOUT,
         (char *)config.time_buckets,
-        (char *)config.size_buckets
+        (char *)config.size_buckets,
+        prometheus_status_shm_baseaddr(),
+        config.socket_type,
+        config.scrape_cache_ttl,
+        config.backend,
+        config.max_series,
+        config.series_ttl,
+        config.native_factor,
+        config.native_max_buckets,
+        config.native_reset,
+        (char *)config.quantiles,
+        config.quantile_window,
+        stats,
+        config.process_details,
+        load_start,
+        ready_fd,
+        previous_metric_socket,
+        (char *)config.listen,
+        ap_scoreboard_image,
+        ap_state_query(AP_SQ_CONFIG_GEN),
+        config.sample_rate
     );
     if(rc != 0) {
         logErrorf("mod_prometheus_status initializing failed");
@@ -427,19 +1773,56 @@ static void prometheus_status_metric_manager_maint(int reason, void *data, apr_w
             break;
         case APR_OC_REASON_UNREGISTER:
             prometheus_status_cleanup_handler();
-            kill(proc->pid, SIGHUP);
+            // the sighup tells the collector to leave a snapshot for the next generation, which is not started on shutdown
+            if(ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_EXITING) {
+                kill(proc->pid, SIGHUP);
+            }
             break;
     }
  }
 
+/* wait till the metrics collector accepts connections. It writes a single byte once it is ready,
+ * the pipe is closed without it if the collector fails to start */
+static void prometheus_status_wait_ready(int fd) {
+    struct pollfd pfd;
+    apr_time_t start = apr_time_now();
+    char ready;
+    int rc;
+
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    do {
+        rc = poll(&pfd, 1, STARTUPTIMEOUT);
+    } while(rc < 0 && errno == EINTR);
+    if(rc == 0) {
+        logErrorf("metrics manager failed to start in time");
+        return;
+    }
+    if(rc < 0 || read(fd, &ready, 1) != 1) {
+        logErrorf("metrics manager failed to start");
+        return;
+    }
+    logDebugf("metrics manager ready after %ld ms", (long)apr_time_as_msec(apr_time_now() - start));
+}
+
 static apr_status_t prometheus_status_create_metrics_manager(apr_pool_t * p, server_rec * s) {
     apr_status_t rv;
+    int ready[2];
+
+    if(pipe2(ready, O_CLOEXEC) == -1) {
+        logErrorf("failed to create metrics manager readiness pipe: errno:%d (%s)", errno, strerror(errno));
+        ready[0] = -1;
+        ready[1] = -1;
+    }
 
     g_metric_manager = (apr_proc_t *) apr_pcalloc(p, sizeof(*g_metric_manager));
     rv = apr_proc_fork(g_metric_manager, p);
     if(rv == APR_INCHILD) {
+        if(ready[0] != -1) {
+            close(ready[0]);
+        }
         // load all go stuff in a separated sub process
-        prometheus_status_load_gomodule(p, s);
+        prometheus_status_load_gomodule(p, s, ready[1]);
         // wait till process ends...
         while(g_metric_manager_keep_running) {
             sleep(60);
@@ -456,16 +1839,11 @@ static apr_status_t prometheus_status_create_metrics_manager(apr_pool_t * p, ser
     apr_pool_note_subprocess(p, g_metric_manager, APR_KILL_ONLY_ONCE);
     apr_proc_other_child_register(g_metric_manager, prometheus_status_metric_manager_maint, g_metric_manager, NULL, p);
 
-    // wait till socket exists
-    struct stat buffer;
-    int retries = 0;
-    while(stat(metric_socket, &buffer) != 0) {
-        usleep(50000);
-        retries++;
-        if(retries > 20) {
-            logErrorf("metrics manager failed to start in time");
-            break;
-        }
+    // children may send metrics right away, so wait till the collector listens
+    if(ready[0] != -1) {
+        close(ready[1]);
+        prometheus_status_wait_ready(ready[0]);
+        close(ready[0]);
     }
 
     return APR_SUCCESS;
@@ -477,6 +1855,7 @@ static int prometheus_status_init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *p
     main_server = s;
 
     void *data = NULL;
+    char *last_socket = NULL;
     const char *key = "prometheus_status_init";
 
     // This code is used to prevent double initialization of the module during Apache startup
@@ -488,23 +1867,102 @@ static int prometheus_status_init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *p
 
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &thread_limit);
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &server_limit);
-    ap_mpm_query(AP_MPMQ_MAX_DAEMONS, &max_servers);
-    ap_mpm_query(AP_MPMQ_MAX_THREADS, &threads_per_child);
 
-    /* work around buggy MPMs */
-    if (threads_per_child == 0)
-        threads_per_child = 1;
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_SHM) {
+        const char *err = prometheus_status_shm_create(p, server_limit * thread_limit, config.shm_label_sets, config.time_buckets, config.size_buckets);
+        if(err != NULL) {
+            logErrorf("failed to initialize shared memory: %s", err);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        logDebugf("prometheus_status_init: shared memory backend with %d slots and %d label sets", server_limit * thread_limit, config.shm_label_sets);
+    }
+
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_AGGREGATE) {
+        apr_size_t size = sizeof(prometheus_status_flush_control) + server_limit * sizeof(apr_uint64_t);
+        apr_status_t rv;
+
+        if(!prometheus_status_parse_buckets(config.time_buckets, aggregate_time_buckets, &aggregate_num_time_buckets)
+           || !prometheus_status_parse_buckets(config.size_buckets, aggregate_size_buckets, &aggregate_num_size_buckets)) {
+            logErrorf("invalid response time or size buckets: %s / %s", config.time_buckets, config.size_buckets);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        aggregate_num_values = PROMETHEUS_STATUS_SHM_REC_BUCKETS + aggregate_num_time_buckets + 1 + aggregate_num_size_buckets + 1;
+        if(config.quantiles[0] != '\0') {
+            sketch_log_gamma = log((1 + PROMETHEUS_STATUS_SKETCH_ACCURACY) / (1 - PROMETHEUS_STATUS_SKETCH_ACCURACY));
+        }
+
+        // scrapes use the flush control to force flushes in all children
+        rv = apr_shm_create(&flush_control_shm, size, NULL, p);
+        if(rv != APR_SUCCESS) {
+            logErrorf("failed to create flush control shared memory: %d", rv);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        flush_control = apr_shm_baseaddr_get(flush_control_shm);
+        memset(flush_control, 0, size);
+        logDebugf("prometheus_status_init: aggregate backend with %d values per label set", aggregate_num_values);
+    }
+
+    // each flushed batch must fit into a single datagram
+    if(config.socket_type == PROMETHEUS_STATUS_SOCKET_DATAGRAM && config.batch_bytes + MAXRECORDSIZE > PROMETHEUS_STATUS_MAX_DATAGRAM) {
+        logErrorf("PrometheusStatusBatchBytes too large for datagram sockets, using %d", PROMETHEUS_STATUS_MAX_DATAGRAM - MAXRECORDSIZE);
+        config.batch_bytes = PROMETHEUS_STATUS_MAX_DATAGRAM - MAXRECORDSIZE;
+    }
+
+    // the shm and aggregate backends merge fixed bucket counts
+    if(config.native_factor != 0 && config.backend != PROMETHEUS_STATUS_BACKEND_SOCKET) {
+        logErrorf("PrometheusStatusNativeHistogramFactor is only supported with the socket backend, using classic buckets");
+        config.native_factor = 0;
+    }
+
+    // children count failed sends here, so the collector can report them even if the socket is broken.
+    // The segment is kept across reloads, so the counters do not reset.
+    stats_shm = NULL;
+    apr_pool_userdata_get((void **)&stats_shm, "prometheus_status_stats", s->process->pool);
+    if(stats_shm == NULL) {
+        if(apr_shm_create(&stats_shm, sizeof(prometheus_status_stats), NULL, s->process->pool) == APR_SUCCESS) {
+            memset(apr_shm_baseaddr_get(stats_shm), 0, sizeof(prometheus_status_stats));
+            apr_pool_userdata_set(stats_shm, "prometheus_status_stats", apr_pool_cleanup_null, s->process->pool);
+        } else {
+            logErrorf("failed to create exporter statistics shared memory");
+            stats_shm = NULL;
+        }
+    }
+    stats = stats_shm != NULL ? apr_shm_baseaddr_get(stats_shm) : NULL;
 
     prometheus_status_cleanup_handler();
     g_metric_manager_keep_running = TRUE;
     metric_socket = tempnam(config.tmp_folder, "mtr.");
     logDebugf("prometheus_status_init: version %s - using tmp socket %s", VERSION, metric_socket);
 
+    // the module is reloaded on restarts, so the socket of the previous generation is kept in the process pool
+    apr_pool_userdata_get((void **)&last_socket, "prometheus_status_socket", s->process->pool);
+    if(last_socket == NULL) {
+        last_socket = apr_pcalloc(s->process->pool, PATH_MAX);
+        apr_pool_userdata_set(last_socket, "prometheus_status_socket", apr_pool_cleanup_null, s->process->pool);
+    }
+    apr_cpystrn(previous_metric_socket, last_socket, PATH_MAX);
+    apr_cpystrn(last_socket, metric_socket, PATH_MAX);
+
+    // the collector reads the scoreboard itself, which is created after the first post_config and kept on restarts
+    if(ap_scoreboard_image == NULL) {
+        g_metric_manager_pool = p;
+        return OK;
+    }
     prometheus_status_create_metrics_manager(p, s);
 
     return OK;
 }
 
+/* prometheus_status_pre_mpm starts the metrics manager on the first start, right after the scoreboard got created */
+static int prometheus_status_pre_mpm(apr_pool_t *p, ap_scoreboard_e sb_type) {
+    if(g_metric_manager_pool == NULL) {
+        return OK;
+    }
+    prometheus_status_create_metrics_manager(g_metric_manager_pool, main_server);
+    g_metric_manager_pool = NULL;
+    return OK;
+}
+
 /* prometheus_status_register_hooks registers all required hooks */
 static void prometheus_status_register_hooks(apr_pool_t *p) {
     const char *err_string = NULL;
@@ -514,11 +1972,30 @@ static void prometheus_status_register_hooks(apr_pool_t *p) {
     config.time_buckets = DEFAULTTIMEBUCKETS;
     config.size_buckets = DEFAULTSIZEBUCKETS;
     config.tmp_folder   = DEFAULTTMPFOLDER;
+    config.backend      = DEFAULTBACKEND;
+    config.shm_label_sets = DEFAULTSHMLABELS;
+    config.batch_bytes  = DEFAULTBATCHBYTES;
+    config.flush_interval = DEFAULTFLUSHINTERVAL;
+    config.protocol     = DEFAULTPROTOCOL;
+    config.socket_type  = DEFAULTSOCKETTYPE;
+    config.scrape_cache_ttl = DEFAULTSCRAPECACHETTL;
+    config.max_staleness = DEFAULTMAXSTALENESS;
+    config.max_series   = DEFAULTMAXSERIES;
+    config.series_ttl   = DEFAULTSERIESTTL;
+    config.native_factor = DEFAULTNATIVEFACTOR;
+    config.native_max_buckets = DEFAULTNATIVEMAXBUCKETS;
+    config.native_reset = DEFAULTNATIVERESET;
+    config.quantiles    = DEFAULTQUANTILES;
+    config.quantile_window = DEFAULTQUANTILEWINDOW;
+    config.process_details = DEFAULTPROCESSDETAILS;
+    config.send_mode    = DEFAULTSENDMODE;
+    config.listen       = DEFAULTLISTEN;
+    config.sample_rate  = DEFAULTSAMPLERATE;
     strcpy(config.label_values, DEFAULTLABELVALUES);
 
     log_hash = apr_hash_make(p);
     prometheus_status_register_all_log_handler(p);
-    config.label_format = parse_log_string(p, config.label_values, &err_string);
+    config.label_format = prometheus_status_compile_label_format(p, config.label_values, &err_string);
     if(err_string != NULL) {
         logErrorf("failed to parse label values: %s\n", err_string);
         exit(1);
@@ -526,6 +2003,9 @@ static void prometheus_status_register_hooks(apr_pool_t *p) {
 
     ap_hook_handler(prometheus_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(prometheus_status_init, NULL, NULL, APR_HOOK_MIDDLE);
+    // the core creates the scoreboard in its pre_mpm hook
+    ap_hook_pre_mpm(prometheus_status_pre_mpm, NULL, NULL, APR_HOOK_REALLY_LAST);
+    ap_hook_child_init(prometheus_status_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_log_transaction(prometheus_status_counter, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
@@ -17,21 +17,94 @@
 #include "unixd.h"
 #include "mod_unixd.h"
 #include "mod_log_config.h"
+#include "scoreboard.h"
+#include "apr_shm.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#include "apr_thread_rwlock.h"
+#include "mod_prometheus_status_proto.h"
 #include <unistd.h>
+#include <math.h>
 #include <link.h>
 #include <dlfcn.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #define DEFAULTSOCKETTIMEOUT 3
 
+/* milliseconds to wait for the metrics collector to accept connections on startup. On reloads this includes
+ * loading the snapshot file the previous generation left */
+#define STARTUPTIMEOUT     3000
+
 #define DEFAULTDEBUG       0
 #define DEFAULTTMPFOLDER   NULL
 #define DEFAULTLABELNAMES  "vhost;method;status"
 #define DEFAULTLABELVALUES "%v;%m;%s"
 #define DEFAULTTIMEBUCKETS "0.01;0.1;1;10;30"
 #define DEFAULTSIZEBUCKETS "1000;10000;100000;1000000;10000000;100000000"
+#define DEFAULTBACKEND     PROMETHEUS_STATUS_BACKEND_SOCKET
+#define DEFAULTSHMLABELS   256
+#define DEFAULTBATCHBYTES  0
+#define DEFAULTFLUSHINTERVAL 1000
+#define DEFAULTPROTOCOL    PROMETHEUS_STATUS_PROTOCOL_BINARY
+#define DEFAULTSOCKETTYPE  PROMETHEUS_STATUS_SOCKET_STREAM
+#define DEFAULTSCRAPECACHETTL 0
+#define DEFAULTMAXSTALENESS 0
+#define DEFAULTMAXSERIES   10000
+#define DEFAULTSERIESTTL   0
+#define DEFAULTNATIVEFACTOR 0
+#define DEFAULTNATIVEMAXBUCKETS 160
+#define DEFAULTNATIVERESET 0
+#define DEFAULTQUANTILES   ""
+#define DEFAULTQUANTILEWINDOW 60
+#define DEFAULTPROCESSDETAILS 0
+#define DEFAULTSENDMODE    PROMETHEUS_STATUS_SEND_BLOCKING
+#define DEFAULTLISTEN      ""
+#define DEFAULTSAMPLERATE  0
+
+/* maximum scoreboard samples per second */
+#define MAXSAMPLERATE      1000
+
+#define PROMETHEUS_STATUS_PROTOCOL_TEXT   0
+#define PROMETHEUS_STATUS_PROTOCOL_BINARY 1
+
+#define PROMETHEUS_STATUS_SEND_BLOCKING    0
+#define PROMETHEUS_STATUS_SEND_NONBLOCKING 1
+
+/* size of the chunks metrics are streamed to the client with */
+#define METRICSCHUNKSIZE   65536
+
+/* maximum size of a single metrics update */
+#define MAXRECORDSIZE      4096
+
+/* maximum number of interned label sets cached per child */
+#define MAXINTERNED        4096
+
+/* maximum number of label sets aggregated per thread before they are flushed */
+#define MAXAGGREGATES      4096
+
+/* additional buffer size per thread for request metrics the collector did not take yet in non-blocking mode */
+#define SENDQUEUESIZE      65536
+
+/* buffer size used to send aggregated request metrics */
+#define AGGREGATEBUFSIZE   16384
+
+/* milliseconds between checks of the aggregate flusher for forced flushes */
+#define AGGREGATEPOLLINTERVAL 10
+
+/* flush control shared by all children of the aggregate backend */
+typedef struct {
+    apr_uint64_t epoch;      /* incremented by scrapes to force a flush */
+    apr_time_t   requested;  /* time of the last forced flush */
+    apr_uint32_t acks;       /* incremented by children after each forced flush, scrapes wait on it as futex */
+    apr_uint64_t flushed[1]; /* last flushed epoch per process slot */
+} prometheus_status_flush_control;
 
 /* global logger */
 #define logDebugf(_fmt, ...) if(config.debug > 0) {\
@@ -42,6 +115,15 @@
     ap_log_error(APLOG_MARK, APLOG_ERR, 0, main_server, \
     "[%s][%s:%d] "_fmt, NAME, __FILE__, __LINE__, ## __VA_ARGS__);
 
-apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err);
-void prometheus_status_expand_variables(apr_array_header_t *format, request_rec *r, const char**output);
+/* label format compiled from PrometheusStatusLabelValues */
+typedef struct prometheus_status_label_format prometheus_status_label_format;
+
+prometheus_status_label_format *prometheus_status_compile_label_format(apr_pool_t *p, const char *s, const char **err);
+void prometheus_status_expand_variables(prometheus_status_label_format *format, request_rec *r, const char**output);
+int prometheus_status_expand_label_values(prometheus_status_label_format *format, request_rec *r, const char **values, int max_values);
 int prometheus_status_register_all_log_handler(apr_pool_t *p);
+
+int prometheus_status_parse_buckets(const char *raw, double *list, uint32_t *num);
+const char *prometheus_status_shm_create(apr_pool_t *p, int num_slots, int num_labels, const char *time_buckets, const char *size_buckets);
+void *prometheus_status_shm_baseaddr(void);
+int prometheus_status_shm_update(request_rec *r, const char *label, apr_time_t duration, apr_off_t bytes);
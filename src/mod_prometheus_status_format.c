@@ -14,6 +14,28 @@ typedef struct {
     apr_array_header_t *conditions;
 } log_format_item;
 
+/* compiled label format instructions */
+#define LABEL_OP_CONST 0    /* constant span */
+#define LABEL_OP_SEP   1    /* label value separator */
+#define LABEL_OP_ITEM  2    /* format item evaluated per request */
+
+/* number of format items which can be expanded without extra allocations */
+#define LABEL_FORMAT_STACK_ITEMS 16
+
+typedef struct {
+    int type;
+    const char *str;
+    apr_size_t len;
+    log_format_item *item;
+} label_format_op;
+
+struct prometheus_status_label_format {
+    label_format_op *ops;
+    int num_ops;
+    int num_items;          /* number of LABEL_OP_ITEM instructions */
+    apr_size_t const_len;   /* total length of all constant spans and separators */
+};
+
 
 static char *pfmt(apr_pool_t *p, int i)
 {
@@ -444,9 +466,9 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
     return "Ran off end of LabelFormat parsing args to some directive";
 }
 
-apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
+static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
 {
-    apr_array_header_t *a = apr_array_make(p, 30, sizeof(log_format_item));
+    apr_array_header_t *a = apr_array_make(p, 8, sizeof(log_format_item));
     char *res;
 
     while (*s) {
@@ -513,12 +535,81 @@ int prometheus_status_register_all_log_handler(apr_pool_t *p)
     return OK;
 }
 
-void prometheus_status_expand_variables(apr_array_header_t *format, request_rec *r, const char**output) {
-    log_format_item *items;
-    request_rec *orig;
+/* append a constant span to the label format program */
+static void label_format_add_const(apr_array_header_t *ops, const char *str, apr_size_t len)
+{
+    label_format_op *op;
+
+    if (len == 0) {
+        return;
+    }
+    op = (label_format_op *) apr_array_push(ops);
+    op->type = LABEL_OP_CONST;
+    op->str  = str;
+    op->len  = len;
+    op->item = NULL;
+}
+
+/* prometheus_status_compile_label_format parses the format and compiles it into a flat program.
+ * Constant items are split at label separators, so expansion does not need to search them again.
+ */
+prometheus_status_label_format *prometheus_status_compile_label_format(apr_pool_t *p, const char *s, const char **err)
+{
+    prometheus_status_label_format *format;
+    apr_array_header_t *items, *ops;
+    log_format_item *item;
+    label_format_op *op;
+    const char *str, *sep;
     int i;
 
-    items = (log_format_item *) format->elts;
+    items = parse_log_string(p, s, err);
+    if (items == NULL) {
+        return NULL;
+    }
+
+    format = apr_pcalloc(p, sizeof(*format));
+    ops = apr_array_make(p, items->nelts * 2, sizeof(label_format_op));
+    for (i = 0; i < items->nelts; ++i) {
+        item = &((log_format_item *) items->elts)[i];
+        if (item->func != constant_item) {
+            op = (label_format_op *) apr_array_push(ops);
+            op->type = LABEL_OP_ITEM;
+            op->item = item;
+            op->str  = NULL;
+            op->len  = 0;
+            format->num_items++;
+            continue;
+        }
+
+        str = item->arg;
+        while ((sep = strchr(str, ';')) != NULL) {
+            label_format_add_const(ops, str, sep - str);
+            op = (label_format_op *) apr_array_push(ops);
+            op->type = LABEL_OP_SEP;
+            op->str  = ";";
+            op->len  = 1;
+            op->item = NULL;
+            str = sep + 1;
+        }
+        label_format_add_const(ops, str, strlen(str));
+    }
+
+    format->ops     = (label_format_op *) ops->elts;
+    format->num_ops = ops->nelts;
+    for (i = 0; i < format->num_ops; ++i) {
+        format->const_len += format->ops[i].len;
+    }
+
+    return format;
+}
+
+/* evaluate all dynamic items of the format, returns the total length of all expanded values */
+static apr_size_t label_format_eval(prometheus_status_label_format *format, request_rec *r,
+                                    const char **strs, apr_size_t *lens)
+{
+    request_rec *orig;
+    apr_size_t total = format->const_len;
+    int i, n = 0;
 
     orig = r;
     while (orig->prev) {
@@ -528,14 +619,95 @@ void prometheus_status_expand_variables(apr_array_header_t *format, request_rec
         r = r->next;
     }
 
-    for (i = 0; i < format->nelts; ++i) {
-        const char *str = process_item(r, orig, &items[i]);
-        if(*output == NULL) {
-            *output = str;
-        } else {
-            *output = apr_psprintf(r->pool, "%s%s", *output, str);
+    for (i = 0; i < format->num_ops; ++i) {
+        if (format->ops[i].type != LABEL_OP_ITEM) {
+            continue;
+        }
+        strs[n] = process_item(r, orig, format->ops[i].item);
+        lens[n] = strlen(strs[n]);
+        total  += lens[n];
+        n++;
+    }
+
+    return total;
+}
+
+/* expand the format into buf, separators are replaced by sep. Returns the end of the expanded string */
+static char *label_format_write(prometheus_status_label_format *format, char *buf, char sep,
+                                const char **strs, apr_size_t *lens, const char **values, int max_values, int *num_values)
+{
+    label_format_op *op;
+    int i, n = 0;
+
+    if (values != NULL && max_values > 0 && format->num_ops > 0) {
+        values[(*num_values)++] = buf;
+    }
+    for (i = 0; i < format->num_ops; ++i) {
+        op = &format->ops[i];
+        switch (op->type) {
+        case LABEL_OP_CONST:
+            memcpy(buf, op->str, op->len);
+            buf += op->len;
+            break;
+        case LABEL_OP_SEP:
+            *buf++ = sep;
+            if (values != NULL && *num_values < max_values) {
+                values[(*num_values)++] = buf;
+            }
+            break;
+        case LABEL_OP_ITEM:
+            memcpy(buf, strs[n], lens[n]);
+            buf += lens[n];
+            n++;
+            break;
         }
     }
+    *buf = '\0';
+
+    return buf;
+}
+
+/* prometheus_status_expand_variables expands the format into a single semicolon separated string */
+void prometheus_status_expand_variables(prometheus_status_label_format *format, request_rec *r, const char **output) {
+    const char *strs_buf[LABEL_FORMAT_STACK_ITEMS];
+    apr_size_t lens_buf[LABEL_FORMAT_STACK_ITEMS];
+    const char **strs = strs_buf;
+    apr_size_t *lens = lens_buf;
+    char *buf;
+
+    if (format->num_items > LABEL_FORMAT_STACK_ITEMS) {
+        strs = apr_palloc(r->pool, format->num_items * sizeof(*strs));
+        lens = apr_palloc(r->pool, format->num_items * sizeof(*lens));
+    }
+
+    // the exact length is known after evaluating the items, so everything is written only once
+    buf = apr_palloc(r->pool, label_format_eval(format, r, strs, lens) + 1);
+    label_format_write(format, buf, ';', strs, lens, NULL, 0, NULL);
+    *output = buf;
 
     return;
-}
\ No newline at end of file
+}
+
+/* prometheus_status_expand_label_values expands the format into separate label values.
+ * Values are only split at semicolons which are part of the format itself, so
+ * expanded variables may contain semicolons as well. Returns the number of values.
+ */
+int prometheus_status_expand_label_values(prometheus_status_label_format *format, request_rec *r, const char **values, int max_values) {
+    const char *strs_buf[LABEL_FORMAT_STACK_ITEMS];
+    apr_size_t lens_buf[LABEL_FORMAT_STACK_ITEMS];
+    const char **strs = strs_buf;
+    apr_size_t *lens = lens_buf;
+    char *buf;
+    int num = 0;
+
+    if (format->num_items > LABEL_FORMAT_STACK_ITEMS) {
+        strs = apr_palloc(r->pool, format->num_items * sizeof(*strs));
+        lens = apr_palloc(r->pool, format->num_items * sizeof(*lens));
+    }
+
+    // values are terminated in place, separators turn into the terminating null bytes
+    buf = apr_palloc(r->pool, label_format_eval(format, r, strs, lens) + 1);
+    label_format_write(format, buf, '\0', strs, lens, values, max_values, &num);
+
+    return num;
+}
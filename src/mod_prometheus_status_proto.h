@@ -0,0 +1,102 @@
+/*
+**  mod_prometheus_status_proto.h -- binary wire protocol between workers and the collector
+**
+**  This header is shared between the apache module and the go collector, so it
+**  must not depend on any apache or apr headers.
+**
+**  A binary record uses native byte order and looks like this:
+**
+**    offset  size  description
+**    0       1     magic byte, never a valid first byte of the text protocol
+**    1       1     protocol version
+**    2       2     total record length including this header
+**    4       1     metric id
+**    5       1     number of label values
+**    6       8     value, double or uint64 depending on the metric id
+**    14      ...   label values, each prefixed with its uint16 length
+**
+**  Records with metric id PROMETHEUS_STATUS_METRIC_REQUEST contain all metrics of
+**  a single request. The value is the response time and the label values are
+**  preceded by a uint8 number of fields and the uint64 fields themselves, see
+**  PROMETHEUS_STATUS_FIELD_*. Unknown trailing fields are ignored, so new fields
+**  can be added without another record type.
+**
+**  Label sets can be interned: an intern request is a record with metric id
+**  PROMETHEUS_STATUS_METRIC_INTERN carrying the label values. The collector answers
+**  with the uint32 label set id. Records referencing an interned label set use
+**  PROMETHEUS_STATUS_PROTO_INTERNED as number of label values, followed by the
+**  uint32 label set id instead of the label values. The collector releases the ids
+**  of evicted label sets and increments interned_generation in the
+**  prometheus_status_stats structure, children then drop their interned ids and
+**  request new ones. Records referencing released ids are ignored.
+**
+**  Text protocol lines and binary records may be mixed on the same connection.
+**
+**  With the datagram socket type, request metrics are sent to the metrics socket
+**  path plus PROMETHEUS_STATUS_DATAGRAM_SUFFIX. Each datagram contains complete
+**  records only and is at most PROMETHEUS_STATUS_MAX_DATAGRAM bytes. Intern
+**  requests need a reply and are always sent over the stream socket.
+**
+**  With the aggregate backend, children sum up request metrics locally and send
+**  PROMETHEUS_STATUS_METRIC_AGGREGATE records containing the deltas since their
+**  last flush. The fields are laid out like the shared memory records, see
+**  mod_prometheus_status_shm.h: requests, time sum, size sum followed by the non
+**  cumulative time and size bucket counts including +Inf. The value is unused.
+**  If response time quantiles are enabled, further fields contain response time
+**  sketch bins, each encoded as bin index << 32 | count. Bin i counts response
+**  times in microseconds between gamma^(i-1) and gamma^i with
+**  gamma = (1 + PROMETHEUS_STATUS_SKETCH_ACCURACY) / (1 - PROMETHEUS_STATUS_SKETCH_ACCURACY),
+**  bin 0 counts everything up to 1 microsecond. Since the number of fields is
+**  limited, bins might be split over several records with zero values.
+**
+**  The children count failed sends in a prometheus_status_stats structure in
+**  shared memory, which the collector exposes as exporter self metrics.
+*/
+
+#ifndef MOD_PROMETHEUS_STATUS_PROTO_H
+#define MOD_PROMETHEUS_STATUS_PROTO_H
+
+#include <stdint.h>
+
+#define PROMETHEUS_STATUS_PROTO_MAGIC       0xFE
+#define PROMETHEUS_STATUS_PROTO_VERSION     1
+#define PROMETHEUS_STATUS_PROTO_HEADER_SIZE 14
+#define PROMETHEUS_STATUS_PROTO_MAX_LABELS  64
+#define PROMETHEUS_STATUS_PROTO_INTERNED    0xFF
+
+/* request metrics backends */
+#define PROMETHEUS_STATUS_BACKEND_SOCKET    0
+#define PROMETHEUS_STATUS_BACKEND_SHM       1
+#define PROMETHEUS_STATUS_BACKEND_AGGREGATE 2
+
+/* socket types for request metrics */
+#define PROMETHEUS_STATUS_SOCKET_STREAM     0
+#define PROMETHEUS_STATUS_SOCKET_DATAGRAM   1
+#define PROMETHEUS_STATUS_DATAGRAM_SUFFIX   ".dgram"
+#define PROMETHEUS_STATUS_MAX_DATAGRAM      65536
+
+/* relative accuracy of response time quantile sketches */
+#define PROMETHEUS_STATUS_SKETCH_ACCURACY   0.01
+
+/* metric ids */
+#define PROMETHEUS_STATUS_METRIC_REQUESTS      1 /* uint64 */
+#define PROMETHEUS_STATUS_METRIC_RESPONSE_TIME 2 /* double, seconds */
+#define PROMETHEUS_STATUS_METRIC_RESPONSE_SIZE 3 /* uint64, bytes */
+#define PROMETHEUS_STATUS_METRIC_REQUEST       4 /* double, response time in seconds, with fields */
+#define PROMETHEUS_STATUS_METRIC_AGGREGATE     5 /* unused, with aggregated fields */
+#define PROMETHEUS_STATUS_METRIC_INTERN        128 /* intern label set, value is unused */
+
+/* fields of PROMETHEUS_STATUS_METRIC_REQUEST records */
+#define PROMETHEUS_STATUS_FIELD_RESPONSE_SIZE  0 /* uint64, bytes */
+#define PROMETHEUS_STATUS_NUM_FIELDS           1
+
+/* exporter statistics updated atomically by all children */
+typedef struct {
+    uint64_t send_failures; /* sends to the collector which failed */
+    uint64_t send_timeouts; /* sends to the collector which timed out */
+    uint64_t send_drops;    /* request metric updates dropped instead of sent */
+    uint64_t read_failures; /* replies from the collector which could not be read */
+    uint64_t interned_generation; /* incremented by the collector when it releases interned label set ids */
+} prometheus_status_stats;
+
+#endif
@@ -0,0 +1,186 @@
+/*
+**  mod_prometheus_status_shm.c -- lock-free request counters in shared memory
+*/
+
+#include "mod_prometheus_status.h"
+#include "mod_prometheus_status_shm.h"
+
+static apr_shm_t *shm = NULL;
+static prometheus_status_shm_header *shm_header = NULL;
+
+/* parse semicolon separated list of bucket boundaries */
+int prometheus_status_parse_buckets(const char *raw, double *list, uint32_t *num) {
+    const char *s = raw;
+    char *end;
+
+    *num = 0;
+    while(*s) {
+        if(*num >= PROMETHEUS_STATUS_SHM_MAX_BUCKETS) {
+            return(FALSE);
+        }
+        list[*num] = strtod(s, &end);
+        if(end == s) {
+            return(FALSE);
+        }
+        // buckets must be in increasing order
+        if(*num > 0 && list[*num] <= list[*num-1]) {
+            return(FALSE);
+        }
+        (*num)++;
+        s = end;
+        while(*s == ';' || apr_isspace(*s)) {
+            s++;
+        }
+    }
+    return(TRUE);
+}
+
+static apr_status_t prometheus_status_shm_cleanup(void *data) {
+    shm        = NULL;
+    shm_header = NULL;
+    return(APR_SUCCESS);
+}
+
+/* create the shared memory segment, must be called before forking any children */
+const char *prometheus_status_shm_create(apr_pool_t *p, int num_slots, int num_labels, const char *time_buckets, const char *size_buckets) {
+    prometheus_status_shm_header header;
+    apr_size_t size;
+    apr_status_t rv;
+
+    memset(&header, 0, sizeof(header));
+    if(!prometheus_status_parse_buckets(time_buckets, header.time_buckets, &header.num_time_buckets)) {
+        return(apr_psprintf(p, "invalid response time buckets: %s", time_buckets));
+    }
+    if(!prometheus_status_parse_buckets(size_buckets, header.size_buckets, &header.num_size_buckets)) {
+        return(apr_psprintf(p, "invalid response size buckets: %s", size_buckets));
+    }
+
+    header.magic         = PROMETHEUS_STATUS_SHM_MAGIC;
+    header.num_slots     = num_slots;
+    header.num_labels    = num_labels;
+    header.record_size   = (PROMETHEUS_STATUS_SHM_REC_BUCKETS + header.num_time_buckets + 1 + header.num_size_buckets + 1) * sizeof(uint64_t);
+    // align slots to cache lines, so workers do not share lines with each other
+    header.slot_size     = APR_ALIGN((uint64_t)header.record_size * num_labels, 64);
+    header.labels_offset = APR_ALIGN(sizeof(header), 64);
+    header.slots_offset  = APR_ALIGN(header.labels_offset + (uint64_t)num_labels * sizeof(prometheus_status_shm_label), 64);
+    size = header.slots_offset + header.slot_size * num_slots;
+
+    // anonymous shared memory is zero initialized, do not touch it here so pages
+    // only get allocated once a worker actually uses them
+    rv = apr_shm_create(&shm, size, NULL, p);
+    if(rv != APR_SUCCESS) {
+        return(apr_psprintf(p, "failed to create shared memory segment of %" APR_SIZE_T_FMT " bytes: %d", size, rv));
+    }
+    shm_header = apr_shm_baseaddr_get(shm);
+    memcpy(shm_header, &header, sizeof(header));
+    apr_pool_cleanup_register(p, NULL, prometheus_status_shm_cleanup, apr_pool_cleanup_null);
+
+    return(NULL);
+}
+
+/* return base address of the shared memory segment or NULL */
+void *prometheus_status_shm_baseaddr(void) {
+    return(shm_header);
+}
+
+/* return the label table index for given label, inserts the label if not yet known. Returns -1 if table is full */
+static int prometheus_status_shm_label_index(const char *label) {
+    prometheus_status_shm_label *table, *entry;
+    uint32_t hash = 2166136261u;
+    uint32_t len, probe, state, idx;
+    const char *c;
+
+    for(c = label; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    len = c - label;
+    if(len >= PROMETHEUS_STATUS_SHM_LABEL_MAX) {
+        return(-1);
+    }
+
+    table = (prometheus_status_shm_label *)((char *)shm_header + shm_header->labels_offset);
+    for(probe = 0; probe < shm_header->num_labels; probe++) {
+        idx   = (hash + probe) % shm_header->num_labels;
+        entry = &table[idx];
+        state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+        if(state == PROMETHEUS_STATUS_SHM_LABEL_EMPTY) {
+            if(__atomic_compare_exchange_n(&entry->state, &state, PROMETHEUS_STATUS_SHM_LABEL_CLAIMED, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                entry->hash = hash;
+                entry->len  = len;
+                memcpy(entry->label, label, len+1);
+                __atomic_store_n(&entry->state, PROMETHEUS_STATUS_SHM_LABEL_READY, __ATOMIC_RELEASE);
+                return(idx);
+            }
+        }
+        // entries being claimed right now are skipped. Worst case the same label is
+        // inserted twice which is fine, since the collector merges them by name.
+        if(state == PROMETHEUS_STATUS_SHM_LABEL_READY && entry->hash == hash && entry->len == len && memcmp(entry->label, label, len) == 0) {
+            return(idx);
+        }
+    }
+
+    return(-1);
+}
+
+/* return slot index of the worker serving this request */
+static uint64_t prometheus_status_shm_worker_slot(request_rec *r) {
+    worker_score *ws;
+    apr_int64_t idx;
+
+    if(r->connection->sbh == NULL) {
+        return(0);
+    }
+    ws = ap_get_scoreboard_worker((ap_sb_handle_t *)r->connection->sbh);
+    if(ws == NULL) {
+        return(0);
+    }
+    // worker scores are allocated in one contiguous block
+    idx = ws - ap_get_scoreboard_worker_from_indexes(0, 0);
+    if(idx < 0 || idx >= shm_header->num_slots) {
+        return(0);
+    }
+    return((uint64_t)idx);
+}
+
+/* update request counters in the workers own slot, returns FALSE if the update had to be dropped */
+int prometheus_status_shm_update(request_rec *r, const char *label, apr_time_t duration, apr_off_t bytes) {
+    uint64_t *rec, *buckets;
+    double seconds;
+    uint32_t i;
+    int idx;
+
+    if(shm_header == NULL) {
+        return(FALSE);
+    }
+
+    idx = prometheus_status_shm_label_index(label);
+    if(idx < 0) {
+        __atomic_fetch_add(&shm_header->labels_dropped, 1, __ATOMIC_RELAXED);
+        return(FALSE);
+    }
+
+    if(duration < 0) {
+        duration = 0;
+    }
+    if(bytes < 0) {
+        bytes = 0;
+    }
+
+    rec = (uint64_t *)((char *)shm_header + shm_header->slots_offset
+                       + prometheus_status_shm_worker_slot(r) * shm_header->slot_size
+                       + (uint64_t)idx * shm_header->record_size);
+    __atomic_fetch_add(&rec[PROMETHEUS_STATUS_SHM_REC_REQUESTS], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rec[PROMETHEUS_STATUS_SHM_REC_TIME_SUM], (uint64_t)duration, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rec[PROMETHEUS_STATUS_SHM_REC_SIZE_SUM], (uint64_t)bytes, __ATOMIC_RELAXED);
+
+    buckets = &rec[PROMETHEUS_STATUS_SHM_REC_BUCKETS];
+    seconds = duration / (double)APR_USEC_PER_SEC;
+    for(i = 0; i < shm_header->num_time_buckets && seconds > shm_header->time_buckets[i]; i++);
+    __atomic_fetch_add(&buckets[i], 1, __ATOMIC_RELAXED);
+
+    buckets += shm_header->num_time_buckets + 1;
+    for(i = 0; i < shm_header->num_size_buckets && (double)bytes > shm_header->size_buckets[i]; i++);
+    __atomic_fetch_add(&buckets[i], 1, __ATOMIC_RELAXED);
+
+    return(TRUE);
+}
@@ -0,0 +1,60 @@
+/*
+**  mod_prometheus_status_shm.h -- shared memory layout for the request counter slots
+**
+**  This header is shared between the apache module and the go collector, so it
+**  must not depend on any apache or apr headers.
+**
+**  Layout of the segment:
+**
+**    header | label table (num_labels entries) | slots (num_slots * slot_size)
+**
+**  Each worker (process x thread) owns one slot. A slot contains one record per
+**  label set, the record index is the index of the label set in the label table.
+**  A record consists of record_size/8 uint64 values:
+**
+**    requests | time sum (usec) | size sum | time buckets (+Inf) | size buckets (+Inf)
+**
+**  Bucket counts are not cumulative, the collector sums them up on scrapes.
+*/
+
+#ifndef MOD_PROMETHEUS_STATUS_SHM_H
+#define MOD_PROMETHEUS_STATUS_SHM_H
+
+#include <stdint.h>
+
+#define PROMETHEUS_STATUS_SHM_MAGIC       0x50534d31 /* PSM1 */
+#define PROMETHEUS_STATUS_SHM_LABEL_MAX   256
+#define PROMETHEUS_STATUS_SHM_MAX_BUCKETS 32
+
+#define PROMETHEUS_STATUS_SHM_LABEL_EMPTY   0
+#define PROMETHEUS_STATUS_SHM_LABEL_CLAIMED 1
+#define PROMETHEUS_STATUS_SHM_LABEL_READY   2
+
+#define PROMETHEUS_STATUS_SHM_REC_REQUESTS  0
+#define PROMETHEUS_STATUS_SHM_REC_TIME_SUM  1
+#define PROMETHEUS_STATUS_SHM_REC_SIZE_SUM  2
+#define PROMETHEUS_STATUS_SHM_REC_BUCKETS   3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_slots;         /* number of worker slots */
+    uint32_t num_labels;        /* capacity of the label table */
+    uint32_t num_time_buckets;  /* number of response time buckets without +Inf */
+    uint32_t num_size_buckets;  /* number of response size buckets without +Inf */
+    uint32_t record_size;       /* bytes per label set record */
+    uint64_t slot_size;         /* bytes per worker slot */
+    uint64_t labels_offset;     /* offset of the label table from the segment start */
+    uint64_t slots_offset;      /* offset of the first slot from the segment start */
+    uint64_t labels_dropped;    /* updates dropped because the label table was full */
+    double   time_buckets[PROMETHEUS_STATUS_SHM_MAX_BUCKETS];
+    double   size_buckets[PROMETHEUS_STATUS_SHM_MAX_BUCKETS];
+} prometheus_status_shm_header;
+
+typedef struct {
+    uint32_t state;             /* one of PROMETHEUS_STATUS_SHM_LABEL_* */
+    uint32_t hash;
+    uint32_t len;
+    char     label[PROMETHEUS_STATUS_SHM_LABEL_MAX];
+} prometheus_status_shm_label;
+
+#endif
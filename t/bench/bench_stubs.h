@@ -0,0 +1,65 @@
+/*
+**  bench_stubs.h -- shared helpers of the microbenchmarks
+**
+**  Minimal replacements for the httpd functions used by the label format
+**  handlers and a mocked request. The benchmarks link against apr only,
+**  include this after the module sources.
+*/
+
+char *ap_escape_logitem(apr_pool_t *p, const char *str) {
+    return str ? apr_pstrdup(p, str) : NULL;
+}
+
+const char *ap_get_remote_host(conn_rec *conn, void *dir_config, int type, int *str_is_ip) {
+    return "127.0.0.1";
+}
+
+const char *ap_get_server_name(request_rec *r) {
+    return r->server->server_hostname;
+}
+
+apr_port_t ap_run_default_port(const request_rec *r) {
+    return 80;
+}
+
+char *ap_field_noparam(apr_pool_t *p, const char *intype) {
+    return apr_pstrdup(p, intype);
+}
+
+char *ap_getword(apr_pool_t *p, const char **line, char stop) {
+    const char *pos = strchr(*line, stop);
+    char *res;
+
+    if (pos == NULL) {
+        res = apr_pstrdup(p, *line);
+        *line += strlen(*line);
+        return res;
+    }
+    res = apr_pstrmemdup(p, *line, pos - *line);
+    *line = pos + 1;
+    return res;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static request_rec *create_request(apr_pool_t *p) {
+    request_rec *r = apr_pcalloc(p, sizeof(*r));
+
+    r->server = apr_pcalloc(p, sizeof(*r->server));
+    r->server->server_hostname = "www.example.com";
+    r->connection = apr_pcalloc(p, sizeof(*r->connection));
+    r->method = "GET";
+    r->uri = "/index.html";
+    r->status = 200;
+    r->headers_in = apr_table_make(p, 8);
+    r->headers_out = apr_table_make(p, 8);
+    r->subprocess_env = apr_table_make(p, 8);
+    apr_table_setn(r->headers_in, "User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0");
+    apr_table_setn(r->headers_in, "X-Forwarded-For", "192.0.2.1, 198.51.100.7");
+    apr_table_setn(r->headers_in, "Cookie", "theme=dark; session=0123456789abcdef; lang=en");
+    return r;
+}
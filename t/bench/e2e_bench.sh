@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+# e2e_bench.sh -- end-to-end benchmark of a local httpd with the module
+#
+# Starts httpd with mod_prometheus_status.so from the current folder and drives
+# it with ab, once with PrometheusStatusEnabled Off and once with On. Reports
+# requests per second and the 99th percentile latency.
+#
+# Usage: t/bench/e2e_bench.sh [extra module directives...]
+#
+#   BENCH_REQUESTS    number of requests per run (default 200000)
+#   BENCH_CONCURRENCY number of concurrent clients (default 32)
+#   BENCH_PORT        listen port (default 18080)
+#
+# Example:
+#   t/bench/e2e_bench.sh "PrometheusStatusBackend aggregate"
+
+set -e
+
+REQUESTS=${BENCH_REQUESTS:-200000}
+CONCURRENCY=${BENCH_CONCURRENCY:-32}
+PORT=${BENCH_PORT:-18080}
+MODULE=$(pwd)/mod_prometheus_status.so
+
+HTTPD=$(./apxs.sh -q SBINDIR)/$(./apxs.sh -q TARGET)
+MODULES=$(./apxs.sh -q LIBEXECDIR)
+AB=$(./apxs.sh -q BINDIR)/ab
+if [ ! -x "$AB" ]; then
+  AB=$(which ab 2>/dev/null)
+fi
+if [ ! -x "$HTTPD" ] || [ -z "$AB" ] || [ ! -f "$MODULE" ]; then
+  echo "requires httpd, ab and a built mod_prometheus_status.so, run make first" >&2
+  exit 1
+fi
+
+TMPDIR=$(mktemp -d)
+trap '"$HTTPD" -f "$TMPDIR/httpd.conf" -k stop >/dev/null 2>&1; rm -rf "$TMPDIR"' EXIT
+echo "benchmark" > "$TMPDIR/index.html"
+
+# write_config <PrometheusStatusEnabled value> [extra directives...]
+write_config() {
+  local enabled=$1
+  shift
+  {
+    echo "ServerRoot $TMPDIR"
+    echo "ServerName localhost"
+    echo "Listen 127.0.0.1:$PORT"
+    echo "PidFile $TMPDIR/httpd.pid"
+    echo "ErrorLog $TMPDIR/error.log"
+    echo "DocumentRoot $TMPDIR"
+    # only load modules which are not built in
+    for MOD in mpm_event unixd authz_core log_config; do
+      if [ -f "$MODULES/mod_$MOD.so" ] && ! "$HTTPD" -l | grep -q "mod_$MOD.c"; then
+        echo "LoadModule ${MOD}_module $MODULES/mod_$MOD.so"
+      fi
+    done
+    echo "LoadModule prometheus_status_module $MODULE"
+    echo "PrometheusStatusEnabled $enabled"
+    echo "PrometheusStatusTmpFolder $TMPDIR"
+    for DIRECTIVE in "$@"; do
+      echo "$DIRECTIVE"
+    done
+    echo "<Location /metrics>"
+    echo "  SetHandler prometheus-metrics"
+    echo "</Location>"
+  } > "$TMPDIR/httpd.conf"
+}
+
+# run_bench <name> <PrometheusStatusEnabled value> [extra directives...]
+run_bench() {
+  local name=$1
+  shift
+  write_config "$@"
+  "$HTTPD" -f "$TMPDIR/httpd.conf" -k start
+  for i in $(seq 50); do
+    curl -qsf "http://127.0.0.1:$PORT/index.html" >/dev/null 2>&1 && break
+    sleep 0.1
+  done
+  # warm up, this also starts all children and interns the label sets
+  "$AB" -q -k -n 10000 -c "$CONCURRENCY" "http://127.0.0.1:$PORT/index.html" >/dev/null
+  "$AB" -q -k -n "$REQUESTS" -c "$CONCURRENCY" "http://127.0.0.1:$PORT/index.html" > "$TMPDIR/ab.txt"
+  "$HTTPD" -f "$TMPDIR/httpd.conf" -k stop
+  for i in $(seq 50); do
+    [ -f "$TMPDIR/httpd.pid" ] || break
+    sleep 0.1
+  done
+  printf "%-10s %12s %10s\n" "$name" \
+    "$(awk '/^Requests per second:/ { print $4 }' "$TMPDIR/ab.txt")" \
+    "$(awk '$1 == "99%" { print $2 }' "$TMPDIR/ab.txt")"
+}
+
+printf "%-10s %12s %10s\n" "module" "req/s" "p99 ms"
+run_bench "disabled" Off "$@"
+run_bench "enabled" On "$@"
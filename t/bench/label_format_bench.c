@@ -0,0 +1,92 @@
+/*
+**  label_format_bench.c -- microbenchmark for the label format expansion
+**
+**  Compares the compiled label format with the previous implementation, which
+**  concatenated each item with apr_psprintf. Build and run with:
+**
+**    make label_format_bench && ./label_format_bench
+*/
+
+#include "../../src/mod_prometheus_status_format.c"
+#include <time.h>
+#include "bench_stubs.h"
+
+#define ITERATIONS 1000000
+
+/* previous implementation, copies the whole label for every item */
+static void legacy_expand_variables(apr_array_header_t *format, request_rec *r, const char **output) {
+    log_format_item *items = (log_format_item *) format->elts;
+    int i;
+
+    for (i = 0; i < format->nelts; ++i) {
+        const char *str = process_item(r, r, &items[i]);
+        if (*output == NULL) {
+            *output = str;
+        } else {
+            *output = apr_psprintf(r->pool, "%s%s", *output, str);
+        }
+    }
+}
+
+int main(void) {
+    const char *formats[] = {
+        "%v;%m;%s",
+        "%v;%m;%s;%{User-Agent}i",
+        "%v;%m;%s;%{session}C",
+        "%v;%m;%s;%U;%{X-Forwarded-For}i;%{User-Agent}i;%{lang}C",
+        NULL,
+    };
+    apr_pool_t *pool, *req_pool;
+    request_rec *r;
+    const char *err = NULL;
+    const char *legacy, *compiled;
+    double start, legacy_ns, compiled_ns;
+    int f, i;
+
+    apr_initialize();
+    apr_pool_create(&pool, NULL);
+    apr_pool_create(&req_pool, pool);
+    log_hash = apr_hash_make(pool);
+    prometheus_status_register_all_log_handler(pool);
+    r = create_request(pool);
+    r->pool = req_pool;
+
+    printf("%-60s %14s %14s\n", "format", "legacy ns/req", "compiled ns/req");
+    for (f = 0; formats[f] != NULL; f++) {
+        apr_array_header_t *items = parse_log_string(pool, formats[f], &err);
+        prometheus_status_label_format *format = prometheus_status_compile_label_format(pool, formats[f], &err);
+        if (items == NULL || format == NULL) {
+            fprintf(stderr, "failed to parse %s: %s\n", formats[f], err);
+            return 1;
+        }
+
+        legacy = NULL;
+        legacy_expand_variables(items, r, &legacy);
+        prometheus_status_expand_variables(format, r, &compiled);
+        if (strcmp(legacy, compiled) != 0) {
+            fprintf(stderr, "results differ for %s:\n  %s\n  %s\n", formats[f], legacy, compiled);
+            return 1;
+        }
+
+        start = now_ns();
+        for (i = 0; i < ITERATIONS; i++) {
+            legacy = NULL;
+            legacy_expand_variables(items, r, &legacy);
+            apr_pool_clear(req_pool);
+        }
+        legacy_ns = (now_ns() - start) / ITERATIONS;
+
+        start = now_ns();
+        for (i = 0; i < ITERATIONS; i++) {
+            prometheus_status_expand_variables(format, r, &compiled);
+            apr_pool_clear(req_pool);
+        }
+        compiled_ns = (now_ns() - start) / ITERATIONS;
+
+        printf("%-60s %14.1f %14.1f\n", formats[f], legacy_ns, compiled_ns);
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+**  send_path_bench.c -- microbenchmark for the request metrics send path
+**
+**  Runs the log_transaction hook with a mocked request against a fake metrics
+**  collector for each backend, protocol and socket type. Build and run with:
+**
+**    make send_path_bench && ./send_path_bench
+*/
+
+#include "../../src/mod_prometheus_status.c"
+#include <time.h>
+#include "bench_stubs.h"
+
+#define ITERATIONS 1000000
+#define LABEL_SETS 8
+
+typedef struct {
+    const char *name;
+    int         backend;
+    int         protocol;
+    int         socket_type;
+    int         batch_bytes;
+    const char *quantiles;
+    int         send_mode;
+} bench_scenario;
+
+static const bench_scenario scenarios[] = {
+    { "socket text",                    PROMETHEUS_STATUS_BACKEND_SOCKET,    PROMETHEUS_STATUS_PROTOCOL_TEXT,   PROMETHEUS_STATUS_SOCKET_STREAM,   0,     "",         PROMETHEUS_STATUS_SEND_BLOCKING },
+    { "socket binary",                  PROMETHEUS_STATUS_BACKEND_SOCKET,    PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_STREAM,   0,     "",         PROMETHEUS_STATUS_SEND_BLOCKING },
+    { "socket binary nonblocking",      PROMETHEUS_STATUS_BACKEND_SOCKET,    PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_STREAM,   0,     "",         PROMETHEUS_STATUS_SEND_NONBLOCKING },
+    { "socket binary batched",          PROMETHEUS_STATUS_BACKEND_SOCKET,    PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_STREAM,   16384, "",         PROMETHEUS_STATUS_SEND_BLOCKING },
+    { "socket binary datagram batched", PROMETHEUS_STATUS_BACKEND_SOCKET,    PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_DATAGRAM, 16384, "",         PROMETHEUS_STATUS_SEND_BLOCKING },
+    { "aggregate",                      PROMETHEUS_STATUS_BACKEND_AGGREGATE, PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_STREAM,   0,     "",         PROMETHEUS_STATUS_SEND_BLOCKING },
+    { "aggregate with quantiles",       PROMETHEUS_STATUS_BACKEND_AGGREGATE, PROMETHEUS_STATUS_PROTOCOL_BINARY, PROMETHEUS_STATUS_SOCKET_STREAM,   0,     "0.5;0.99", PROMETHEUS_STATUS_SEND_BLOCKING },
+    { NULL, 0, 0, 0, 0, NULL, 0 },
+};
+
+static int collector_fd = -1;
+static int collector_dgram_fd = -1;
+static apr_uint32_t collector_ids = 0;
+static apr_pool_t *collector_pool = NULL;
+
+/* the benchmark calls the hooks directly */
+void ap_hook_handler(ap_HOOK_handler_t *pf, const char * const *aszPre, const char * const *aszSucc, int nOrder) {}
+void ap_hook_post_config(ap_HOOK_post_config_t *pf, const char * const *aszPre, const char * const *aszSucc, int nOrder) {}
+void ap_hook_child_init(ap_HOOK_child_init_t *pf, const char * const *aszPre, const char * const *aszSucc, int nOrder) {}
+void ap_hook_pre_mpm(ap_HOOK_pre_mpm_t *pf, const char * const *aszPre, const char * const *aszSucc, int nOrder) {}
+void ap_hook_log_transaction(ap_HOOK_log_transaction_t *pf, const char * const *aszPre, const char * const *aszSucc, int nOrder) {}
+
+void ap_log_error_(const char *file, int line, int module_index, int level, apr_status_t status, const server_rec *s, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/* fake metrics collector connection, discards all updates and answers intern requests */
+static void * APR_THREAD_FUNC collector_connection(apr_thread_t *thread, void *data) {
+    int fd = (int)(apr_intptr_t)data;
+    char buf[65536];
+    char *nl;
+    apr_size_t len = 0, pos;
+    apr_uint16_t record_len;
+    apr_uint32_t id;
+    ssize_t nbytes;
+
+    while((nbytes = recv(fd, buf + len, sizeof(buf) - len, 0)) > 0) {
+        len += nbytes;
+        pos = 0;
+        while(pos < len) {
+            // text protocol updates never start with the binary magic
+            if((unsigned char)buf[pos] != PROMETHEUS_STATUS_PROTO_MAGIC) {
+                nl = memchr(buf + pos, '\n', len - pos);
+                if(nl == NULL) {
+                    break;
+                }
+                pos = nl - buf + 1;
+                continue;
+            }
+            if(len - pos < PROMETHEUS_STATUS_PROTO_HEADER_SIZE) {
+                break;
+            }
+            memcpy(&record_len, buf + pos + 2, 2);
+            if(len - pos < record_len) {
+                break;
+            }
+            if((unsigned char)buf[pos + 4] == PROMETHEUS_STATUS_METRIC_INTERN) {
+                id = __atomic_fetch_add(&collector_ids, 1, __ATOMIC_RELAXED);
+                send(fd, &id, sizeof(id), MSG_NOSIGNAL);
+            }
+            pos += record_len;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+    }
+    close(fd);
+    return(NULL);
+}
+
+/* accept connections of the worker threads and the aggregate flusher */
+static void * APR_THREAD_FUNC collector_accept(apr_thread_t *thread, void *data) {
+    apr_threadattr_t *attr;
+    apr_thread_t *conn;
+    int fd;
+
+    apr_threadattr_create(&attr, collector_pool);
+    apr_threadattr_detach_set(attr, 1);
+    while((fd = accept(collector_fd, NULL, NULL)) >= 0) {
+        apr_thread_create(&conn, attr, collector_connection, (void *)(apr_intptr_t)fd, collector_pool);
+    }
+    return(NULL);
+}
+
+/* drain the datagram socket */
+static void * APR_THREAD_FUNC collector_datagrams(apr_thread_t *thread, void *data) {
+    static char buf[PROMETHEUS_STATUS_MAX_DATAGRAM];
+
+    while(recv(collector_dgram_fd, buf, sizeof(buf), 0) >= 0 || errno == EINTR);
+    return(NULL);
+}
+
+/* listen on the stream and datagram metrics sockets like the go collector does */
+static void start_collector(apr_pool_t *p) {
+    struct sockaddr_un addr;
+    apr_thread_t *thread;
+
+    collector_pool = p;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", metric_socket);
+    collector_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if(bind(collector_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(collector_fd, 64) == -1) {
+        perror("failed to listen on metrics socket");
+        exit(1);
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", metric_socket, PROMETHEUS_STATUS_DATAGRAM_SUFFIX);
+    collector_dgram_fd = socket(PF_UNIX, SOCK_DGRAM, 0);
+    if(bind(collector_dgram_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("failed to bind datagram socket");
+        exit(1);
+    }
+    apr_thread_create(&thread, NULL, collector_accept, NULL, p);
+    apr_thread_create(&thread, NULL, collector_datagrams, NULL, p);
+}
+
+/* run the log_transaction hook for a fresh child, returns the nanoseconds per request */
+static double run_scenario(const bench_scenario *s, apr_pool_t *pool, request_rec *r) {
+    apr_pool_t *child;
+    double start, elapsed;
+    int i;
+
+    config.backend     = s->backend;
+    config.protocol    = s->protocol;
+    config.socket_type = s->socket_type;
+    config.batch_bytes = s->batch_bytes;
+    config.quantiles   = s->quantiles;
+    config.send_mode   = s->send_mode;
+
+    // same as prometheus_status_init
+    if(config.backend == PROMETHEUS_STATUS_BACKEND_AGGREGATE) {
+        prometheus_status_parse_buckets(config.time_buckets, aggregate_time_buckets, &aggregate_num_time_buckets);
+        prometheus_status_parse_buckets(config.size_buckets, aggregate_size_buckets, &aggregate_num_size_buckets);
+        aggregate_num_values = PROMETHEUS_STATUS_SHM_REC_BUCKETS + aggregate_num_time_buckets + 1 + aggregate_num_size_buckets + 1;
+        sketch_log_gamma = 0;
+        if(config.quantiles[0] != '\0') {
+            sketch_log_gamma = log((1 + PROMETHEUS_STATUS_SKETCH_ACCURACY) / (1 - PROMETHEUS_STATUS_SKETCH_ACCURACY));
+        }
+    }
+
+    apr_pool_create(&child, pool);
+    prometheus_status_child_init(child, r->server);
+    // the buffer of this thread has been destroyed with the previous child
+    thread_batch = NULL;
+
+    start = now_ns();
+    for(i = 0; i < ITERATIONS; i++) {
+        r->status = 200 + i % LABEL_SETS;
+        prometheus_status_counter(r);
+        apr_pool_clear(r->pool);
+    }
+    elapsed = now_ns() - start;
+
+    // flushes the remaining metrics just like a child exit
+    apr_pool_destroy(child);
+    return(elapsed / ITERATIONS);
+}
+
+int main(void) {
+    apr_pool_t *pool, *req_pool;
+    request_rec *r;
+    prometheus_status_config *dir_config;
+    void **dir_configs;
+    int s;
+
+    apr_initialize();
+    apr_pool_create(&pool, NULL);
+    apr_pool_create(&req_pool, pool);
+    prometheus_status_register_hooks(pool);
+
+    r = create_request(pool);
+    r->pool = req_pool;
+    r->request_time = apr_time_now();
+    r->bytes_sent = 4711;
+    r->server->log.level = APLOG_WARNING;
+    main_server = r->server;
+
+    // the module is the only one with a directory config
+    prometheus_status_module.module_index = 0;
+    dir_config = prometheus_status_create_dir_conf(pool, NULL);
+    dir_config->enabled = 1;
+    dir_configs = apr_pcalloc(pool, sizeof(void *));
+    dir_configs[0] = dir_config;
+    r->per_dir_config = (ap_conf_vector_t *)dir_configs;
+
+    metric_socket = tempnam(NULL, "mtr.");
+    start_collector(pool);
+
+    printf("%-40s %14s\n", "scenario", "ns/request");
+    for(s = 0; scenarios[s].name != NULL; s++) {
+        printf("%-40s %14.1f\n", scenarios[s].name, run_scenario(&scenarios[s], pool, r));
+    }
+
+    unlink(metric_socket);
+    unlink(apr_pstrcat(pool, metric_socket, PROMETHEUS_STATUS_DATAGRAM_SUFFIX, NULL));
+    apr_terminate();
+    return 0;
+}
@@ -2,7 +2,7 @@
 
 use warnings;
 use strict;
-use Test::More tests => 52;
+use Test::More tests => 76;
 
 for my $mpm (qw/prefork worker event/) {
     my $res = `omd stop apache`;
@@ -42,6 +42,22 @@ for my $mpm (qw/prefork worker event/) {
 
     $res = `curl -qs http://localhost:5000/metrics`;
     is($?, 0, "curl worked");
+
+    # the collector serves scrapes on its own listener and reads the scoreboard itself
+    $res = `curl -qsf http://127.0.0.1:5001/metrics`;
+    is($?, 0, "curl on scrape listener worked");
+    like($res, qr(\Qapache_workers_scoreboard{state="idle"}\E), "result contains scoreboard from collector");
+    like($res, qr(\Qapache_server_uptime_seconds\E), "result contains uptime from collector");
+    like($res, qr(\Qapache_inflight_requests{le="+Inf"}\E), "result contains in flight requests by age");
+    like($res, qr(\Qapache_inflight_requests_oldest_seconds\E), "result contains oldest request in flight");
+
+    # the oldest requests in flight
+    $res = `curl -qsf http://localhost:5000/inflight`;
+    is($?, 0, "curl on inflight handler worked");
+    like($res, qr(^\# age_seconds pid slot thread vhost request$)m, "result contains inflight report");
+
+    $res = `curl -qsf http://127.0.0.1:5001/inflight`;
+    like($res, qr(^\# age_seconds pid slot thread vhost request$)m, "result contains inflight report from collector");
 }
 
 ################################################################################
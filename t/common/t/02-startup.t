@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+
+use warnings;
+use strict;
+use Test::More tests => 14;
+use Time::HiRes qw/time/;
+
+# milliseconds the module may add to starting or reloading apache
+my $max_overhead = 500;
+my $runs         = 3;
+
+my $without = measure_startup("without module", 0);
+my $with    = measure_startup("with module", 1);
+
+cmp_ok($with->{'start'} - $without->{'start'}, '<', $max_overhead, sprintf("module adds less than %dms to start (%dms vs. %dms)", $max_overhead, $with->{'start'}, $without->{'start'}));
+# apache waits for the previous collector to exit on reloads. Its SIGHUP delay ends with the SIGTERM apache
+# sends right after, so the delay must not show up here.
+cmp_ok($with->{'reload'} - $without->{'reload'}, '<', $max_overhead, sprintf("module adds less than %dms to reloads (%dms vs. %dms)", $max_overhead, $with->{'reload'}, $without->{'reload'}));
+
+# the collector is ready once apache has started, so no retries are required
+`omd restart apache`;
+is($?, 0, "apache restarted");
+my $res = `curl -qsf http://localhost:5000/metrics`;
+is($?, 0, "metrics available right after start");
+like($res, qr(\Qapache_exporter_startup_duration_seconds{phase="runtime"}\E), "result contains go runtime startup duration");
+like($res, qr(\Qapache_exporter_startup_duration_seconds{phase="init"}\E), "result contains collector startup duration");
+
+################################################################################
+# returns the fastest start and reload in milliseconds until the first request succeeds
+sub measure_startup {
+    my($name, $enabled) = @_;
+    my $conf = "etc/apache/conf.d/prom.conf";
+    if(!$enabled) {
+        rename($conf, $conf.".disabled") or die("cannot disable module: $!");
+    }
+
+    my $best = { 'start' => -1, 'reload' => -1 };
+    my $rc   = 0;
+    for my $run (1..$runs) {
+        `omd stop apache`;
+        my $t0 = time();
+        `omd start apache`;
+        $rc |= $?;
+        wait_ready();
+        my $start = (time() - $t0) * 1000;
+        $best->{'start'} = $start if($best->{'start'} < 0 || $start < $best->{'start'});
+    }
+    is($rc, 0, "apache started $name");
+
+    $rc = 0;
+    for my $run (1..$runs) {
+        my $t0 = time();
+        `omd reload apache`;
+        $rc |= $?;
+        wait_ready();
+        my $reload = (time() - $t0) * 1000;
+        $best->{'reload'} = $reload if($best->{'reload'} < 0 || $reload < $best->{'reload'});
+    }
+    is($rc, 0, "apache reloaded $name");
+
+    if(!$enabled) {
+        rename($conf.".disabled", $conf) or die("cannot enable module: $!");
+        `omd restart apache`;
+    }
+    ok($best->{'start'} > 0, sprintf("start %s took %dms", $name, $best->{'start'}));
+    ok($best->{'reload'} > 0, sprintf("reload %s took %dms", $name, $best->{'reload'}));
+    return($best);
+}
+
+################################################################################
+# wait till apache answers requests
+sub wait_ready {
+    for my $x (1..500) {
+        `curl -qs -o /dev/null http://localhost:5000/`;
+        return if $? == 0;
+        select(undef, undef, undef, 0.01);
+    }
+}
@@ -0,0 +1,57 @@
+#!/usr/bin/perl
+
+use warnings;
+use strict;
+use Test::More tests => 9;
+
+# request counters continue across reloads instead of starting from zero
+my $series = qr(\Qapache_requests_total{application="/test",method="GET",status="404"}\E\s+(\d+));
+
+`omd restart apache`;
+is($?, 0, "apache restarted");
+
+my $before = request_and_count(0);
+ok($before > 0, "counter before reload: $before");
+
+for my $run (1..2) {
+    `omd reload apache`;
+    is($?, 0, "reload $run worked");
+    wait_ready();
+
+    my $after = request_and_count($before);
+    cmp_ok($after, '>', $before, "counter keeps counting after reload $run: $before -> $after");
+    $before = $after;
+}
+
+# a full restart starts over
+`omd restart apache`;
+is($?, 0, "apache restarted");
+my $res = `curl -qs http://localhost:5000/metrics`;
+is($?, 0, "curl worked");
+unlike($res, qr(\Qapplication="/test"\E), "counter starts from zero after restart");
+
+################################################################################
+# sends a request to /test and returns the counter once it is larger than previous
+sub request_and_count {
+    my($previous) = @_;
+    `curl -qs -o /dev/null http://localhost:5000/test`;
+    # request metrics are flushed in batches
+    my $count = 0;
+    for my $x (1..100) {
+        my $res = `curl -qs http://localhost:5000/metrics`;
+        $count = $1 if $res =~ $series;
+        return($count) if $count > $previous;
+        select(undef, undef, undef, 0.1);
+    }
+    return($count);
+}
+
+################################################################################
+# wait till apache answers requests
+sub wait_ready {
+    for my $x (1..500) {
+        `curl -qs -o /dev/null http://localhost:5000/`;
+        return if $? == 0;
+        select(undef, undef, undef, 0.01);
+    }
+}